@@ -0,0 +1,232 @@
+//
+//  main.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Times the audio mixer's building blocks and checks them: the mix kernel picked for this CPU against the plain
+//  version it replaces, and the codecs a frame at a time. The SIMD kernels have to give the same mix as the plain
+//  ones, and round to within a step of them (SSE2 rounds halves to even where the plain version rounds them up), and
+//  IMA ADPCM has to keep at least MIN_IMA_ADPCM_SNR_DB of signal to noise. Exits with 1 if any of that fails.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <AudioCodec.h>
+#include <AudioMixKernel.h>
+#include <AudioRingBuffer.h>
+#include <SharedUtil.h>
+
+// an agent's stereo frame, as the mixer mixes it
+const int MIX_SAMPLES = BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2;
+
+// sources added into each mix, about a busy room's worth
+const int MIX_SOURCES = 64;
+
+const int DEFAULT_FRAMES = 4000;
+
+// speech sits well above this in 4 bits a sample, anything under it means the codec is broken
+const float MIN_IMA_ADPCM_SNR_DB = 20.0f;
+
+// a sum of differences bigger than this from the plain mix isn't rounding
+const float MAX_MIX_RELATIVE_ERROR = 1e-5f;
+
+typedef void (*MixAddFunction)(float* destination, const float* source, float gain, int numSamples);
+
+float randomSample() {
+    return randFloatInRange(-20000.0f, 20000.0f);
+}
+
+// microseconds a frame, for mixing MIX_SOURCES sources with mixAdd
+float timeMixAdd(MixAddFunction mixAdd, const std::vector<float>& sources, std::vector<float>& mix, int numFrames) {
+    uint64_t start = usecTimestampNow();
+    for (int frame = 0; frame < numFrames; frame++) {
+        memset(&mix[0], 0, mix.size() * sizeof(float));
+        for (int source = 0; source < MIX_SOURCES; source++) {
+            mixAdd(&mix[0], &sources[source * MIX_SAMPLES], 1.0f / (source + 1), MIX_SAMPLES);
+        }
+    }
+    return (float) (usecTimestampNow() - start) / numFrames;
+}
+
+bool benchMixAdd(int numFrames) {
+    std::vector<float> sources(MIX_SOURCES * MIX_SAMPLES);
+    for (int i = 0; i < sources.size(); i++) {
+        sources[i] = randomSample();
+    }
+    std::vector<float> scalarMix(MIX_SAMPLES);
+    std::vector<float> kernelMix(MIX_SAMPLES);
+
+    float scalarUsecs = timeMixAdd(audioMixAddScalar, sources, scalarMix, numFrames);
+    float kernelUsecs = timeMixAdd(audioMixAdd, sources, kernelMix, numFrames);
+
+    // the products and sums are the same operations in the same order, just more of them at once
+    float maxError = 0.0f;
+    for (int i = 0; i < MIX_SAMPLES; i++) {
+        float error = fabsf(kernelMix[i] - scalarMix[i]) / std::max(1.0f, fabsf(scalarMix[i]));
+        maxError = std::max(maxError, error);
+    }
+
+    printf("mix %d sources of %d samples: scalar %.1f usecs, %s %.1f usecs, %.2fx, max relative error %g\n",
+           MIX_SOURCES, MIX_SAMPLES, scalarUsecs, getAudioMixKernelName(), kernelUsecs, scalarUsecs / kernelUsecs,
+           maxError);
+    return maxError <= MAX_MIX_RELATIVE_ERROR;
+}
+
+bool checkFloatToInt16(int numFrames) {
+    // halves are where the roundings differ, and the ends of the range are where the clamping matters
+    std::vector<float> mix;
+    for (int i = -40; i <= 40; i++) {
+        mix.push_back(i * 0.5f);
+        mix.push_back(32767.0f - i * 0.5f);
+        mix.push_back(-32768.0f + i * 0.5f);
+    }
+    const float OUT_OF_RANGE[] = { 40000.0f, -40000.0f, 1e10f, -1e10f, 32767.5f, -32768.5f };
+    mix.insert(mix.end(), OUT_OF_RANGE, OUT_OF_RANGE + sizeof(OUT_OF_RANGE) / sizeof(OUT_OF_RANGE[0]));
+    while (mix.size() < MIX_SAMPLES * 8 + 3) {
+        mix.push_back(randomSample() * 2.0f);
+    }
+
+    std::vector<int16_t> scalarSamples(mix.size());
+    std::vector<int16_t> kernelSamples(mix.size());
+
+    uint64_t start = usecTimestampNow();
+    for (int frame = 0; frame < numFrames; frame++) {
+        audioMixFloatToInt16Scalar(&mix[0], &scalarSamples[0], MIX_SAMPLES);
+    }
+    float scalarUsecs = (float) (usecTimestampNow() - start) / numFrames;
+
+    start = usecTimestampNow();
+    for (int frame = 0; frame < numFrames; frame++) {
+        audioMixFloatToInt16(&mix[0], &kernelSamples[0], MIX_SAMPLES);
+    }
+    float kernelUsecs = (float) (usecTimestampNow() - start) / numFrames;
+
+    audioMixFloatToInt16Scalar(&mix[0], &scalarSamples[0], mix.size());
+    audioMixFloatToInt16(&mix[0], &kernelSamples[0], mix.size());
+
+    // only a half can go either way, and only by one
+    int numHalvesRoundedDifferently = 0;
+    bool matches = true;
+    for (int i = 0; i < mix.size(); i++) {
+        int difference = abs(kernelSamples[i] - scalarSamples[i]);
+        if (difference == 0) {
+            continue;
+        }
+        if (difference == 1 && mix[i] - floorf(mix[i]) == 0.5f) {
+            numHalvesRoundedDifferently++;
+        } else {
+            printf("%f converted to %d, not %d\n", mix[i], kernelSamples[i], scalarSamples[i]);
+            matches = false;
+        }
+    }
+
+    printf("convert %d samples: scalar %.2f usecs, %s %.2f usecs, %d of %d rounded differently\n", MIX_SAMPLES,
+           scalarUsecs, getAudioMixKernelName(), kernelUsecs, numHalvesRoundedDifferently, (int) mix.size());
+    return matches;
+}
+
+// something like speech: a couple of harmonics that come and go, and a little noise
+void makeTestSignal(std::vector<int16_t>& samples, int numChannels) {
+    const float TWO_PI = 2.0f * 3.14159265358979f;
+    for (int i = 0; i < samples.size(); i++) {
+        int channel = i % numChannels;
+        float time = (float) (i / numChannels) / SAMPLE_RATE;
+        float envelope = 0.6f + 0.4f * sinf(TWO_PI * 3.0f * time);
+        float sample = envelope * (6000.0f * sinf(TWO_PI * (220.0f + 110.0f * channel) * time) +
+                                   2500.0f * sinf(TWO_PI * 1320.0f * time)) + randFloatInRange(-200.0f, 200.0f);
+        samples[i] = (int16_t) sample;
+    }
+}
+
+bool benchCodec(PACKET_VERSION codec, const char* codecName, int numChannels, int numFrames, float minSNR) {
+    int frameSamples = BUFFER_LENGTH_SAMPLES_PER_CHANNEL * numChannels;
+    std::vector<int16_t> samples(frameSamples * numFrames);
+    makeTestSignal(samples, numChannels);
+
+    // the codec lays a frame's channels out one after the other, so deinterleave each frame
+    std::vector<int16_t> frames(samples.size());
+    for (int frame = 0; frame < numFrames; frame++) {
+        for (int i = 0; i < frameSamples; i++) {
+            int channel = i % numChannels;
+            frames[frame * frameSamples + channel * BUFFER_LENGTH_SAMPLES_PER_CHANNEL + i / numChannels] =
+                samples[frame * frameSamples + i];
+        }
+    }
+
+    int frameBytes = bytesForAudioFrame(codec, BUFFER_LENGTH_SAMPLES_PER_CHANNEL, numChannels);
+    std::vector<unsigned char> encoded(frameBytes * numFrames);
+    std::vector<int16_t> decoded(frames.size());
+
+    AudioEncoder encoder(codec);
+    uint64_t start = usecTimestampNow();
+    for (int frame = 0; frame < numFrames; frame++) {
+        int bytesWritten = encoder.encode(&frames[frame * frameSamples], BUFFER_LENGTH_SAMPLES_PER_CHANNEL,
+                                          numChannels, &encoded[frame * frameBytes]);
+        if (bytesWritten != frameBytes) {
+            printf("%s wrote %d bytes for a frame, not %d\n", codecName, bytesWritten, frameBytes);
+            return false;
+        }
+    }
+    float encodeUsecs = (float) (usecTimestampNow() - start) / numFrames;
+
+    // each frame is decoded on its own, the way one that follows a lost packet would be
+    start = usecTimestampNow();
+    for (int frame = 0; frame < numFrames; frame++) {
+        int bytesRead = decodeAudioFrame(codec, &encoded[frame * frameBytes], frameBytes,
+                                         &decoded[frame * frameSamples], BUFFER_LENGTH_SAMPLES_PER_CHANNEL,
+                                         numChannels);
+        if (bytesRead != frameBytes) {
+            printf("%s read %d bytes of a frame, not %d\n", codecName, bytesRead, frameBytes);
+            return false;
+        }
+    }
+    float decodeUsecs = (float) (usecTimestampNow() - start) / numFrames;
+
+    double signalPower = 0.0;
+    double noisePower = 0.0;
+    for (int i = 0; i < frames.size(); i++) {
+        double error = decoded[i] - frames[i];
+        signalPower += (double) frames[i] * frames[i];
+        noisePower += error * error;
+    }
+    float snr = std::numeric_limits<float>::infinity();
+    if (noisePower > 0.0) {
+        snr = 10.0f * (float) log10(signalPower / noisePower);
+    }
+
+    printf("%s %d channel frames: %d bytes, encode %.2f usecs, decode %.2f usecs, SNR %.1f dB\n", codecName,
+           numChannels, frameBytes, encodeUsecs, decodeUsecs, snr);
+    return snr >= minSNR;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* FRAMES = "--frames";
+    const char* framesOption = getCmdOption(argc, argv, FRAMES);
+    int numFrames = framesOption ? atoi(framesOption) : DEFAULT_FRAMES;
+    if (numFrames < 1) {
+        printf("usage: audio-bench [%s <count>]\n", FRAMES);
+        return 1;
+    }
+
+    srand(1);
+    // PCM has to come back exactly
+    const float LOSSLESS_SNR = std::numeric_limits<float>::infinity();
+
+    bool passed = true;
+    passed &= benchMixAdd(numFrames);
+    passed &= checkFloatToInt16(numFrames);
+    for (int numChannels = 1; numChannels <= MAX_AUDIO_CODEC_CHANNELS; numChannels++) {
+        passed &= benchCodec(AUDIO_CODEC_PCM, "PCM", numChannels, numFrames, LOSSLESS_SNR);
+        passed &= benchCodec(AUDIO_CODEC_IMA_ADPCM, "IMA ADPCM", numChannels, numFrames, MIN_IMA_ADPCM_SNR_DB);
+    }
+
+    printf(passed ? "passed\n" : "FAILED\n");
+    return passed ? 0 : 1;
+}
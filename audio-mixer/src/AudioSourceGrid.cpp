@@ -0,0 +1,117 @@
+//
+//  AudioSourceGrid.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cmath>
+
+#include <AudioMixKernel.h>
+
+#include "AudioSourceGrid.h"
+
+// keeps the cell coordinates of far away (or NaN) positions in range of an int
+const float MAX_CELL_COORDINATE = 1 << 20;
+
+static bool isInEarlierCell(const AudioGridSource& sourceA, const AudioGridSource& sourceB) {
+    return sourceA.cellX < sourceB.cellX || (sourceA.cellX == sourceB.cellX && sourceA.cellZ < sourceB.cellZ);
+}
+
+static bool isEarlierCell(const AudioGridCell& cellA, const AudioGridCell& cellB) {
+    return cellA.cellX < cellB.cellX || (cellA.cellX == cellB.cellX && cellA.cellZ < cellB.cellZ);
+}
+
+AudioSourceGrid::AudioSourceGrid(float cellSize) :
+    _cellSize(cellSize) {
+}
+
+void AudioSourceGrid::clear() {
+    _sources.clear();
+    _wideSources.clear();
+    _cells.clear();
+}
+
+int AudioSourceGrid::cellCoordinateFor(float position) const {
+    float cellCoordinate = floorf(position / _cellSize);
+    if (!(cellCoordinate > -MAX_CELL_COORDINATE)) {
+        return -MAX_CELL_COORDINATE;
+    }
+    return std::min(cellCoordinate, MAX_CELL_COORDINATE);
+}
+
+void AudioSourceGrid::add(Node* node, PositionalAudioRingBuffer* buffer, float reach) {
+    AudioGridSource source;
+    source.node = node;
+    source.buffer = buffer;
+    source.reach = reach;
+    source.cellX = cellCoordinateFor(buffer->getPosition().x);
+    source.cellZ = cellCoordinateFor(buffer->getPosition().z);
+
+    if (reach > _cellSize) {
+        // anyone could be in range of this one, so it doesn't go in a cell
+        _wideSources.push_back(source);
+    } else {
+        _sources.push_back(source);
+    }
+}
+
+void AudioSourceGrid::build(float ambientBedGain) {
+    std::sort(_sources.begin(), _sources.end(), isInEarlierCell);
+
+    // each run of sources in the same cell becomes a cell
+    for (int i = 0; i < _sources.size(); i++) {
+        if (_cells.empty() || _cells.back().cellX != _sources[i].cellX || _cells.back().cellZ != _sources[i].cellZ) {
+            AudioGridCell cell;
+            cell.cellX = _sources[i].cellX;
+            cell.cellZ = _sources[i].cellZ;
+            cell.sources = &_sources[i];
+            cell.numSources = 0;
+            cell.bedSamples = NULL;
+            _cells.push_back(cell);
+        }
+        _cells.back().numSources++;
+    }
+
+    if (ambientBedGain > 0.0f && !_cells.empty()) {
+        _bedSamples.assign(_cells.size() * BUFFER_LENGTH_SAMPLES_PER_CHANNEL, 0.0f);
+        for (int i = 0; i < _cells.size(); i++) {
+            float* bedSamples = &_bedSamples[i * BUFFER_LENGTH_SAMPLES_PER_CHANNEL];
+            for (int j = 0; j < _cells[i].numSources; j++) {
+                audioMixAdd(bedSamples, _cells[i].sources[j].buffer->getMixSamples(), ambientBedGain,
+                            BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+            }
+            _cells[i].bedSamples = bedSamples;
+        }
+    }
+}
+
+const AudioGridCell* AudioSourceGrid::findCell(int cellX, int cellZ) const {
+    AudioGridCell wantedCell;
+    wantedCell.cellX = cellX;
+    wantedCell.cellZ = cellZ;
+
+    std::vector<AudioGridCell>::const_iterator cell = std::lower_bound(_cells.begin(), _cells.end(), wantedCell,
+                                                                       isEarlierCell);
+    if (cell != _cells.end() && cell->cellX == cellX && cell->cellZ == cellZ) {
+        return &*cell;
+    }
+    return NULL;
+}
+
+int AudioSourceGrid::findCellsNear(const glm::vec3& position, const AudioGridCell** cells) const {
+    int listenerCellX = cellCoordinateFor(position.x);
+    int listenerCellZ = cellCoordinateFor(position.z);
+
+    int numCells = 0;
+    for (int cellX = listenerCellX - 1; cellX <= listenerCellX + 1; cellX++) {
+        for (int cellZ = listenerCellZ - 1; cellZ <= listenerCellZ + 1; cellZ++) {
+            const AudioGridCell* cell = findCell(cellX, cellZ);
+            if (cell) {
+                cells[numCells++] = cell;
+            }
+        }
+    }
+    return numCells;
+}
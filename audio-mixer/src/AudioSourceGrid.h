@@ -0,0 +1,71 @@
+//
+//  AudioSourceGrid.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Uniform grid over the XZ plane of the sources being mixed this frame, so each listener only has to look at the
+//  sources around it rather than every node the mixer knows about. The cells are as wide as a normal source can be
+//  heard from, so everything a listener could hear is in the cell it's in or one of the eight around it. Sources
+//  that carry further than that (big injectors) are kept on their own and looked at by every listener.
+//
+
+#ifndef __hifi__AudioSourceGrid__
+#define __hifi__AudioSourceGrid__
+
+#include <vector>
+
+#include <Node.h>
+
+#include "PositionalAudioRingBuffer.h"
+
+class AudioGridSource {
+public:
+    Node* node;
+    PositionalAudioRingBuffer* buffer;
+    float reach; // how far from its position the source can be heard
+    int cellX;
+    int cellZ;
+};
+
+class AudioGridCell {
+public:
+    int cellX;
+    int cellZ;
+    const AudioGridSource* sources;
+    int numSources;
+    const float* bedSamples; // every source in the cell summed at the ambient bed gain, if the grid was asked for it
+};
+
+class AudioSourceGrid {
+public:
+    static const int MAX_CELLS_NEAR = 9;
+
+    AudioSourceGrid(float cellSize);
+
+    float getCellSize() const { return _cellSize; }
+
+    void clear();
+    void add(Node* node, PositionalAudioRingBuffer* buffer, float reach);
+
+    // Call once every source is added and before any lookups, the sources' mix samples have to be prepared first
+    // if there's an ambient bed gain. Lookups are safe from any number of threads until the next clear().
+    void build(float ambientBedGain);
+
+    // fills cells with the occupied cells around position and returns how many there are
+    int findCellsNear(const glm::vec3& position, const AudioGridCell** cells) const;
+
+    const std::vector<AudioGridSource>& getWideSources() const { return _wideSources; }
+
+private:
+    int cellCoordinateFor(float position) const;
+    const AudioGridCell* findCell(int cellX, int cellZ) const;
+
+    float _cellSize;
+    std::vector<AudioGridSource> _sources; // sorted by cell by build()
+    std::vector<AudioGridSource> _wideSources;
+    std::vector<AudioGridCell> _cells;
+    std::vector<float> _bedSamples;
+};
+
+#endif /* defined(__hifi__AudioSourceGrid__) */
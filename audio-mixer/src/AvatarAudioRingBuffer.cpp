@@ -6,24 +6,75 @@
 //  Copyright (c) 2013 HighFidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
+#include <cmath>
+
 #include <PacketHeaders.h>
 
 #include "AvatarAudioRingBuffer.h"
 
+MixPair::MixPair() :
+    attenuationCoefficient(1.0f),
+    bearingRelativeAngleToSource(0.0f),
+    numSamplesDelay(0),
+    weakChannelAmplitudeRatio(1.0f),
+    twoPole(NULL),
+    shouldFilter(false),
+    _hasInputs(false) {
+    
+}
+
+bool MixPair::isStale(const PositionalAudioRingBuffer* listener, const PositionalAudioRingBuffer* source,
+                      float sourceRadius, float sourceAttenuationRatio) const {
+    return !_hasInputs
+        || glm::distance(listener->getPosition(), _listenerPosition) > MIX_PAIR_POSITION_THRESHOLD
+        || glm::distance(source->getPosition(), _sourcePosition) > MIX_PAIR_POSITION_THRESHOLD
+        || fabsf(glm::dot(listener->getOrientation(), _listenerOrientation)) < MIX_PAIR_ORIENTATION_THRESHOLD
+        || fabsf(glm::dot(source->getOrientation(), _sourceOrientation)) < MIX_PAIR_ORIENTATION_THRESHOLD
+        || sourceRadius != _sourceRadius
+        || sourceAttenuationRatio != _sourceAttenuationRatio;
+}
+
+void MixPair::rememberInputs(const PositionalAudioRingBuffer* listener, const PositionalAudioRingBuffer* source,
+                             float sourceRadius, float sourceAttenuationRatio) {
+    _hasInputs = true;
+    _listenerPosition = listener->getPosition();
+    _listenerOrientation = listener->getOrientation();
+    _sourcePosition = source->getPosition();
+    _sourceOrientation = source->getOrientation();
+    _sourceRadius = sourceRadius;
+    _sourceAttenuationRatio = sourceAttenuationRatio;
+}
+
 AvatarAudioRingBuffer::AvatarAudioRingBuffer() :
-    _twoPoles(),
+    _mixPairs(),
     _shouldLoopbackForNode(false) {
     
 }
 
 AvatarAudioRingBuffer::~AvatarAudioRingBuffer() {
-    // enumerate the freeVerbs map and delete the FreeVerb objects
-    for (TwoPoleNodeMap::iterator poleIterator = _twoPoles.begin(); poleIterator != _twoPoles.end(); poleIterator++) {
-        delete poleIterator->second;
+    // enumerate the mix pairs and delete their TwoPole objects
+    for (MixPairSourceMap::iterator pairIterator = _mixPairs.begin(); pairIterator != _mixPairs.end(); pairIterator++) {
+        delete pairIterator->second.twoPole;
+    }
+}
+
+void AvatarAudioRingBuffer::forgetLeftSources(const std::vector<unsigned int>& liveSourceIDs) {
+    MixPairSourceMap::iterator pairIterator = _mixPairs.begin();
+    while (pairIterator != _mixPairs.end()) {
+        if (std::binary_search(liveSourceIDs.begin(), liveSourceIDs.end(), pairIterator->first)) {
+            pairIterator++;
+        } else {
+            delete pairIterator->second.twoPole;
+            _mixPairs.erase(pairIterator++);
+        }
     }
 }
 
 int AvatarAudioRingBuffer::parseData(unsigned char* sourceBuffer, int numBytes) {
-    _shouldLoopbackForNode = (sourceBuffer[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO);
+    // a silent frame doesn't say, and there's nothing in it to loop back anyway
+    if (sourceBuffer[0] != PACKET_TYPE_SILENT_AUDIO_FRAME) {
+        _shouldLoopbackForNode = (sourceBuffer[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO);
+    }
     return PositionalAudioRingBuffer::parseData(sourceBuffer, numBytes);
 }
\ No newline at end of file
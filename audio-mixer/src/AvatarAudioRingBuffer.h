@@ -9,12 +9,46 @@
 #ifndef __hifi__AvatarAudioRingBuffer__
 #define __hifi__AvatarAudioRingBuffer__
 
-#include <Stk.h>
-#include <TwoPole.h>
+#include <map>
+#include <vector>
+
+#include <AudioCodec.h>
+#include <AudioMixKernel.h>
 
 #include "PositionalAudioRingBuffer.h"
 
-typedef std::map<uint16_t, stk::TwoPole*> TwoPoleNodeMap;
+// how far either node has to move or turn before the coefficients for a pair are worked out again
+const float MIX_PAIR_POSITION_THRESHOLD = 0.01f;
+const float MIX_PAIR_ORIENTATION_THRESHOLD = 0.99999f; // dot product of the old and new orientation, about half a degree
+
+// What the mixer worked out for hearing one source from this listener, kept until one of them moves
+class MixPair {
+public:
+    MixPair();
+    
+    bool isStale(const PositionalAudioRingBuffer* listener, const PositionalAudioRingBuffer* source,
+                 float sourceRadius, float sourceAttenuationRatio) const;
+    void rememberInputs(const PositionalAudioRingBuffer* listener, const PositionalAudioRingBuffer* source,
+                        float sourceRadius, float sourceAttenuationRatio);
+    
+    float attenuationCoefficient;
+    float bearingRelativeAngleToSource;
+    int numSamplesDelay;
+    float weakChannelAmplitudeRatio;
+    AudioTwoPole* twoPole; // only used while the listener is outside the source's radius
+    bool shouldFilter;
+    
+private:
+    bool _hasInputs;
+    glm::vec3 _listenerPosition;
+    glm::quat _listenerOrientation;
+    glm::vec3 _sourcePosition;
+    glm::quat _sourceOrientation;
+    float _sourceRadius;
+    float _sourceAttenuationRatio;
+};
+
+typedef std::map<unsigned int, MixPair> MixPairSourceMap;
 
 class AvatarAudioRingBuffer : public PositionalAudioRingBuffer {
 public:
@@ -23,16 +57,24 @@ public:
     
     int parseData(unsigned char* sourceBuffer, int numBytes);
     
-    TwoPoleNodeMap& getTwoPoles() { return _twoPoles; }
+    // keyed by PositionalAudioRingBuffer::getSourceID(), only to be used by whoever is mixing for this listener
+    MixPair& getMixPair(unsigned int sourceID) { return _mixPairs[sourceID]; }
+    
+    // drops the pairs for sources that aren't in liveSourceIDs (sorted) any more
+    void forgetLeftSources(const std::vector<unsigned int>& liveSourceIDs);
     
     bool shouldLoopbackForNode() const { return _shouldLoopbackForNode; }
+    
+    // encodes the mixes sent back to this node
+    AudioEncoder& getMixEncoder() { return _mixEncoder; }
 private:
     // disallow copying of AvatarAudioRingBuffer objects
     AvatarAudioRingBuffer(const AvatarAudioRingBuffer&);
     AvatarAudioRingBuffer& operator= (const AvatarAudioRingBuffer&);
     
-    TwoPoleNodeMap _twoPoles;
+    MixPairSourceMap _mixPairs;
     bool _shouldLoopbackForNode;
+    AudioEncoder _mixEncoder;
 };
 
 #endif /* defined(__hifi__AvatarAudioRingBuffer__) */
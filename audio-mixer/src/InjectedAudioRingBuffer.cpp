@@ -22,13 +22,18 @@ InjectedAudioRingBuffer::InjectedAudioRingBuffer() :
 
 int InjectedAudioRingBuffer::parseData(unsigned char* sourceBuffer, int numBytes) {
     unsigned char* currentBuffer =  sourceBuffer + numBytesForPacketHeader(sourceBuffer);
+    _codec = sourceBuffer[1];
     
     // pull stream identifier from the packet
     memcpy(&_streamIdentifier, currentBuffer, sizeof(_streamIdentifier));
     currentBuffer += sizeof(_streamIdentifier);
     
     // use parsePositionalData in parent PostionalAudioRingBuffer class to pull common positional data
-    currentBuffer += parsePositionalData(currentBuffer, numBytes - (currentBuffer - sourceBuffer));
+    int positionalBytes = parsePositionalData(currentBuffer, numBytes - (currentBuffer - sourceBuffer));
+    if (positionalBytes == 0) {
+        return numBytes;
+    }
+    currentBuffer += positionalBytes;
     
     // pull out the radius for this injected source - if it's zero this is a point source
     memcpy(&_radius, currentBuffer, sizeof(_radius));
@@ -6,25 +6,45 @@
 //  Copyright (c) 2013 HighFidelity, Inc. All rights reserved.
 //
 
+#include <cmath>
 #include <cstring>
 
+#include <AudioMixKernel.h>
 #include <PacketHeaders.h>
 
 #include "PositionalAudioRingBuffer.h"
 
+// the mixer only makes its ring buffers on the Reactor thread, as packets come in, so this needs no atomics
+static unsigned int nextSourceID = 0;
+
 PositionalAudioRingBuffer::PositionalAudioRingBuffer() :
     AudioRingBuffer(false),
     _position(0.0f, 0.0f, 0.0f),
     _orientation(0.0f, 0.0f, 0.0f, 0.0f),
-    _willBeAddedToMix(false)
+    _willBeAddedToMix(false),
+    _loudness(0.0f),
+    _isSilent(false),
+    _isConcealingFrame(false),
+    _wasConcealingFrame(false),
+    _sourceID(nextSourceID++)
 {
     
 }
 
 int PositionalAudioRingBuffer::parseData(unsigned char* sourceBuffer, int numBytes) {
     unsigned char* currentBuffer = sourceBuffer + numBytesForPacketHeader(sourceBuffer);
-    currentBuffer += parsePositionalData(currentBuffer, numBytes - (currentBuffer - sourceBuffer));
-    currentBuffer += parseAudioSamples(currentBuffer, numBytes - (currentBuffer - sourceBuffer));
+    _codec = sourceBuffer[1];
+    int positionalBytes = parsePositionalData(currentBuffer, numBytes - (currentBuffer - sourceBuffer));
+    if (positionalBytes == 0) {
+        return numBytes;
+    }
+    currentBuffer += positionalBytes;
+    
+    if (sourceBuffer[0] == PACKET_TYPE_SILENT_AUDIO_FRAME) {
+        addSilentFrame();
+    } else {
+        currentBuffer += parseAudioSamples(currentBuffer, numBytes - (currentBuffer - sourceBuffer));
+    }
     
     return currentBuffer - sourceBuffer;
 }
@@ -32,30 +52,69 @@ int PositionalAudioRingBuffer::parseData(unsigned char* sourceBuffer, int numByt
 int PositionalAudioRingBuffer::parsePositionalData(unsigned char* sourceBuffer, int numBytes) {
     unsigned char* currentBuffer = sourceBuffer;
     
-    memcpy(&_position, currentBuffer, sizeof(_position));
-    currentBuffer += sizeof(_position);
+    glm::vec3 position;
+    memcpy(&position, currentBuffer, sizeof(position));
+    currentBuffer += sizeof(position);
     
-    memcpy(&_orientation, currentBuffer, sizeof(_orientation));
-    currentBuffer += sizeof(_orientation);
+    glm::quat orientation;
+    memcpy(&orientation, currentBuffer, sizeof(orientation));
+    currentBuffer += sizeof(orientation);
     
-    // if this node sent us a NaN for first float in orientation then don't consider this good audio and bail
-    if (std::isnan(_orientation.x)) {
-        _endOfLastWrite = _nextOutput = _buffer;
-        _isStarted = false;
+    // if this node sent us a NaN for first float in orientation then don't consider this good audio, the frame is
+    // dropped and the buffer covers for it the way it would for a lost one
+    if (std::isnan(orientation.x)) {
         return 0;
     }
     
+    _position = position;
+    _orientation = orientation;
     return currentBuffer - sourceBuffer;
 }
 
-bool PositionalAudioRingBuffer::shouldBeAddedToMix(int numJitterBufferSamples) {
-    if (_endOfLastWrite) {
-        if (!_isStarted && diffLastWriteNextOutput() <= BUFFER_LENGTH_SAMPLES_PER_CHANNEL + numJitterBufferSamples) {
+void PositionalAudioRingBuffer::prepareMixSamples() {
+    if (_wasConcealingFrame) {
+        memmove(_mixSamples, _mixSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL, PHASE_DELAY_AT_90 * sizeof(float));
+    } else {
+        int16_t* lastFrameEnd = (_nextOutput == _buffer)
+            ? _buffer + RING_BUFFER_LENGTH_SAMPLES - PHASE_DELAY_AT_90
+            : _nextOutput - PHASE_DELAY_AT_90;
+        audioMixInt16ToFloat(lastFrameEnd, _mixSamples, PHASE_DELAY_AT_90);
+    }
+    const int16_t* frame = _isConcealingFrame ? _concealedSamples : _nextOutput;
+    audioMixInt16ToFloat(frame, _mixSamples + PHASE_DELAY_AT_90, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+    _wasConcealingFrame = _isConcealingFrame;
+    
+    _loudness = 0.0f;
+    for (int i = 0; i < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; i++) {
+        _loudness += fabsf(_mixSamples[PHASE_DELAY_AT_90 + i]);
+    }
+    _loudness /= BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
+    
+    // the end of the last frame is still heard in a delayed channel, so it has to be quiet too
+    _isSilent = (_loudness == 0.0f);
+    for (int i = 0; _isSilent && i < PHASE_DELAY_AT_90; i++) {
+        _isSilent = (_mixSamples[i] == 0.0f);
+    }
+}
+
+bool PositionalAudioRingBuffer::shouldBeAddedToMix() {
+    _isConcealingFrame = false;
+    if (getEndOfLastWrite()) {
+        trimToJitterBuffer();
+        
+        if (!_isStarted && diffLastWriteNextOutput() <= BUFFER_LENGTH_SAMPLES_PER_CHANNEL + getJitterBufferSamples()) {
             printf("Buffer held back\n");
             return false;
         } else if (diffLastWriteNextOutput() < BUFFER_LENGTH_SAMPLES_PER_CHANNEL) {
+            // the frame is late or lost, if it's the first in a while cover for it with the one before
+            if (_isStarted && concealMissingFrame(_concealedSamples)) {
+                _isConcealingFrame = true;
+                return true;
+            }
+            
+            _wasConcealingFrame = false;
             printf("Buffer starved.\n");
-            _isStarted = false;
+            starve();
             return false;
         } else {
             // good buffer, add this to the mix
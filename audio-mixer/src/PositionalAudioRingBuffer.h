@@ -13,14 +13,25 @@
 
 #include <AudioRingBuffer.h>
 
+// the most a source's samples are delayed in the weak channel, for a source at 90 degrees
+const int PHASE_DELAY_AT_90 = 20;
+
+// The mixer's ring buffers keep to AudioRingBuffer's split: parsing a packet only ever writes, and deciding whether
+// to mix a frame only ever reads, so a frame covered for by concealment is kept apart here rather than written in.
 class PositionalAudioRingBuffer : public AudioRingBuffer {
 public:
     PositionalAudioRingBuffer();
     
     int parseData(unsigned char* sourceBuffer, int numBytes);
+    
+    // writer: returns 0 if the packet isn't good audio and should be dropped (a NaN orientation)
     int parsePositionalData(unsigned char* sourceBuffer, int numBytes);
     
-    bool shouldBeAddedToMix(int numJitterBufferSamples);
+    // reader: true if there's a frame to mix this time, the next output or one concealing it
+    bool shouldBeAddedToMix();
+    
+    // reader: true if the frame being mixed stands in for a missing one, the next output stays where it is for it
+    bool isConcealingFrame() const { return _isConcealingFrame; }
     
     bool willBeAddedToMix() const { return _willBeAddedToMix; }
     void setWillBeAddedToMix(bool willBeAddedToMix) { _willBeAddedToMix = willBeAddedToMix; }
@@ -28,6 +39,22 @@ public:
     const glm::vec3& getPosition() const { return _position; }
     const glm::quat& getOrientation() const { return _orientation; }
     
+    // converts the samples about to be mixed to float once, for all the listeners to share
+    void prepareMixSamples();
+    
+    // this frame's samples, the PHASE_DELAY_AT_90 samples before it are the end of the last frame
+    const float* getMixSamples() const { return _mixSamples + PHASE_DELAY_AT_90; }
+    
+    // average absolute sample of this frame, the same measure Audio uses for the loudness of its input
+    float getLoudness() const { return _loudness; }
+    
+    // true if nothing in the mix samples would be heard, they don't need to be mixed at all
+    bool isSilent() const { return _isSilent; }
+    
+    // tells this stream apart from every other the mixer has had, unlike node IDs which the mixer's own injector
+    // nodes share with the domain server's agents, and which are used again
+    unsigned int getSourceID() const { return _sourceID; }
+    
 protected:
     // disallow copying of PositionalAudioRingBuffer objects
     PositionalAudioRingBuffer(const PositionalAudioRingBuffer&);
@@ -36,6 +63,13 @@ protected:
     glm::vec3 _position;
     glm::quat _orientation;
     bool _willBeAddedToMix;
+    float _mixSamples[PHASE_DELAY_AT_90 + BUFFER_LENGTH_SAMPLES_PER_CHANNEL];
+    float _loudness;
+    bool _isSilent;
+    int16_t _concealedSamples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL];
+    bool _isConcealingFrame;
+    bool _wasConcealingFrame; // the end of the mix samples is then what was last heard, not the frame before output
+    unsigned int _sourceID;
 };
 
 #endif /* defined(__hifi__PositionalAudioRingBuffer__) */
@@ -6,11 +6,13 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
 //
 
+#include <algorithm>
 #include <errno.h>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <vector>
 #include <math.h>
 #include <signal.h>
 #include <stdio.h>
@@ -39,21 +41,44 @@
 #include <PacketHeaders.h>
 #include <SharedUtil.h>
 #include <StdDev.h>
+#include <Reactor.h>
+#include <ThreadPool.h>
 
+#include <AudioCodec.h>
+#include <AudioMixKernel.h>
 #include <AudioRingBuffer.h>
 
+#include "AudioSourceGrid.h"
 #include "AvatarAudioRingBuffer.h"
 #include "InjectedAudioRingBuffer.h"
 
 const unsigned short MIXER_LISTEN_PORT = 55443;
 
-const short JITTER_BUFFER_MSECS = 12;
-const short JITTER_BUFFER_SAMPLES = JITTER_BUFFER_MSECS * (SAMPLE_RATE / 1000.0);
+// where each stream's jitter buffer starts out, from there it adapts to how the stream arrives
+const short INITIAL_JITTER_BUFFER_MSECS = 12;
+const short INITIAL_JITTER_BUFFER_SAMPLES = INITIAL_JITTER_BUFFER_MSECS * (SAMPLE_RATE / 1000.0);
 
 const unsigned int BUFFER_SEND_INTERVAL_USECS = floorf((BUFFER_LENGTH_SAMPLES_PER_CHANNEL / SAMPLE_RATE) * 1000000);
 
-const int MAX_SAMPLE_VALUE = std::numeric_limits<int16_t>::max();
-const int MIN_SAMPLE_VALUE = std::numeric_limits<int16_t>::min();
+// the rate the stk::TwoPole filters that AudioTwoPole replaced assumed, which keeps the effect sounding the same
+const float TWO_POLE_SAMPLE_RATE = 44100.0f;
+
+const float DISTANCE_SCALE = 2.5f;
+const float GEOMETRIC_AMPLITUDE_SCALAR = 0.3f;
+const float DISTANCE_LOG_BASE = 2.5f;
+const float DISTANCE_SCALE_LOG = logf(DISTANCE_SCALE) / logf(DISTANCE_LOG_BASE);
+
+// a source attenuated below this is too quiet to bother mixing, for a full scale source it's under -40dB
+const float MIN_AUDIBLE_ATTENUATION = 0.01f;
+
+// in a crowd each listener only gets the loudest sources it can hear mixed in properly
+const int DEFAULT_MAX_MIX_SOURCES = 16;
+
+// how loud the sources that didn't make the cut are in the ambient bed, with --ambientBed
+const float AMBIENT_BED_GAIN = 0.05f;
+
+// how often, in frames, the listeners forget what they worked out for sources that have gone (about a second)
+const int FORGET_LEFT_SOURCES_INTERVAL_FRAMES = 100;
 
 void attachNewBufferToNode(Node *newNode) {
     if (!newNode->getLinkedData()) {
@@ -62,316 +87,519 @@ void attachNewBufferToNode(Node *newNode) {
         } else {
             newNode->setLinkedData(new InjectedAudioRingBuffer());
         }
+        
+        ((AudioRingBuffer*) newNode->getLinkedData())->setJitterBufferSamples(INITIAL_JITTER_BUFFER_SAMPLES);
     }
 }
 
 bool wantLocalDomain = false;
 
-int main(int argc, const char* argv[]) {
-    setvbuf(stdout, NULL, _IOLBF, 0);
+int numStatCollections = 0;
+float sumFrameTimePercentages = 0.0f;
+
+void checkInWithDomainServer(void* extraData) {
+    NodeList::getInstance()->sendDomainServerCheckIn();
     
-    // Handle Local Domain testing with the --local command line
-    const char* local = "--local";
-    ::wantLocalDomain = cmdOptionExists(argc, argv,local);
-    if (::wantLocalDomain) {
-        printf("Local Domain MODE!\n");
-        int ip = getLocalAddress();
-        sprintf(DOMAIN_IP,"%d.%d.%d.%d", (ip & 0xFF), ((ip >> 8) & 0xFF),((ip >> 16) & 0xFF), ((ip >> 24) & 0xFF));
+    if (Logstash::shouldSendStats() && numStatCollections > 0) {
+        // if we should be sending stats to Logstash send the appropriate average now
+        const char MIXER_LOGSTASH_METRIC_NAME[] = "audio-mixer-frame-time-usage";
+        
+        float averageFrameTimePercentage = sumFrameTimePercentages / numStatCollections;
+        Logstash::stashValue(STAT_TYPE_TIMER, MIXER_LOGSTASH_METRIC_NAME, averageFrameTimePercentage);
+        
+        sumFrameTimePercentages = 0.0f;
+        numStatCollections = 0;
     }
     
-    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AUDIO_MIXER, MIXER_LISTEN_PORT);
+    if (Logstash::shouldSendStats()) {
+        // how deep the jitter buffers have had to be, and how much they've covered for late and lost frames
+        const char JITTER_BUFFER_METRIC_NAME[] = "audio-mixer-jitter-buffer-msecs";
+        const char CONCEALED_FRAMES_METRIC_NAME[] = "audio-mixer-concealed-frames";
+        
+        NodeList* nodeList = NodeList::getInstance();
+        NodeListReadScope readScope(nodeList);
+        
+        float sumJitterBufferSamples = 0.0f;
+        int numBuffers = 0;
+        int numConcealedFrames = 0;
+        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+            AudioRingBuffer* ringBuffer = (AudioRingBuffer*) node->getLinkedData();
+            if (ringBuffer) {
+                sumJitterBufferSamples += ringBuffer->getJitterBufferSamples();
+                numConcealedFrames += ringBuffer->getNumConcealedFrames();
+                numBuffers++;
+            }
+        }
+        
+        if (numBuffers > 0) {
+            const float MSECS_PER_SECOND = 1000.0f;
+            Logstash::stashValue(STAT_TYPE_GAUGE, JITTER_BUFFER_METRIC_NAME,
+                                 sumJitterBufferSamples / numBuffers / SAMPLE_RATE * MSECS_PER_SECOND);
+            Logstash::stashValue(STAT_TYPE_GAUGE, CONCEALED_FRAMES_METRIC_NAME, numConcealedFrames);
+        }
+    }
+}
+
+// a source a listener can hear this frame, audibility is how loud it will be once attenuated
+class MixCandidate {
+public:
+    PositionalAudioRingBuffer* buffer;
+    MixPair* pair;
+    float audibility;
+    bool isInCellBed; // false for the grid's wide sources
+};
+
+// scratch space for one mix worker, the mixes it makes go out through its own send batch
+class MixWorkerScratch {
+public:
+    MixWorkerScratch(UDPSocket* socket) :
+        sendBatch(socket) {
+    }
     
-    ssize_t receivedBytes = 0;
+    float mixSamples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2];
+    float sourceSamples[PHASE_DELAY_AT_90 + BUFFER_LENGTH_SAMPLES_PER_CHANNEL]; // room for the delayed samples first
+    std::vector<MixCandidate> candidates;
+    int16_t clientSamples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2];
+    unsigned char clientPacket[BUFFER_LENGTH_BYTES_STEREO + MAX_PACKET_HEADER_BYTES];
+    UDPSendBatch sendBatch;
+};
+
+int numMixThreads = ThreadPool::getNumberOfCores();
+ThreadPool* mixWorkers = NULL;
+std::vector<MixWorkerScratch*> mixWorkerScratch;
+
+int maxMixSources = DEFAULT_MAX_MIX_SOURCES;
+bool wantAmbientBed = false;
+
+// the sources that will be mixed this frame, by where they are
+AudioSourceGrid* sourceGrid = NULL;
+
+void getRadiusAndAttenuationRatio(Node* sourceNode, float& radius, float& attenuationRatio) {
+    radius = 0.0f;
+    attenuationRatio = 1.0f;
     
-    nodeList->linkedDataCreateCallback = attachNewBufferToNode;
+    if (sourceNode->getType() == NODE_TYPE_AUDIO_INJECTOR) {
+        InjectedAudioRingBuffer* injectedBuffer = (InjectedAudioRingBuffer*) sourceNode->getLinkedData();
+        radius = injectedBuffer->getRadius();
+        attenuationRatio = injectedBuffer->getAttenuationRatio();
+    }
+}
+
+// How far away a source with this attenuation ratio is attenuated down to MIN_AUDIBLE_ATTENUATION, the inverse of
+// the distance coefficient in updateMixPair(). Off axis attenuation only ever makes a source quieter.
+float audibleDistanceFor(float attenuationRatio) {
+    if (attenuationRatio <= MIN_AUDIBLE_ATTENUATION) {
+        return 0.0f;
+    }
+    float distanceLog = logf(MIN_AUDIBLE_ATTENUATION / attenuationRatio) / logf(GEOMETRIC_AMPLITUDE_SCALAR)
+        + 1 - DISTANCE_SCALE_LOG;
+    return powf(DISTANCE_LOG_BASE, distanceLog);
+}
+
+// works out how loud, from which side and how filtered the source sounds to the listener
+void updateMixPair(MixPair& pair, AvatarAudioRingBuffer* listenerBuffer, PositionalAudioRingBuffer* sourceBuffer,
+                   float radius, float attenuationRatio) {
+    pair.attenuationCoefficient = attenuationRatio;
+    pair.bearingRelativeAngleToSource = 0.0f;
+    pair.numSamplesDelay = 0;
+    pair.weakChannelAmplitudeRatio = 1.0f;
+    pair.shouldFilter = false;
     
-    nodeList->startSilentNodeRemovalThread();
+    glm::vec3 relativePosition = sourceBuffer->getPosition() - listenerBuffer->getPosition();
+    glm::quat inverseOrientation = glm::inverse(listenerBuffer->getOrientation());
+    
+    float distanceSquareToSource = glm::dot(relativePosition, relativePosition);
+    
+    if (radius == 0 || (distanceSquareToSource > radius * radius)) {
+        // this is either not a spherical source, or the listener is outside the sphere
+        
+        if (radius > 0) {
+            // this is a spherical source - the distance used for the coefficient
+            // needs to be the closest point on the boundary to the source
+                                     
+            // ovveride the distance to the node with the distance to the point on the
+            // boundary of the sphere
+            distanceSquareToSource -= (radius * radius);
+            
+        } else {
+            // calculate the angle delivery for off-axis attenuation
+            glm::vec3 rotatedListenerPosition = glm::inverse(sourceBuffer->getOrientation()) * relativePosition;
+            
+            float angleOfDelivery = glm::angle(glm::vec3(0.0f, 0.0f, -1.0f),
+                                               glm::normalize(rotatedListenerPosition));
+            
+            const float MAX_OFF_AXIS_ATTENUATION = 0.2f;
+            const float OFF_AXIS_ATTENUATION_FORMULA_STEP = (1 - MAX_OFF_AXIS_ATTENUATION) / 2.0f;
+            
+            float offAxisCoefficient = MAX_OFF_AXIS_ATTENUATION +
+                (OFF_AXIS_ATTENUATION_FORMULA_STEP * (angleOfDelivery / 90.0f));
+            
+            // multiply the current attenuation coefficient by the calculated off axis coefficient
+            pair.attenuationCoefficient *= offAxisCoefficient;
+        }
+        
+        glm::vec3 rotatedSourcePosition = inverseOrientation * relativePosition;
+        
+        // calculate the distance coefficient using the distance to this node
+        float distanceCoefficient = powf(GEOMETRIC_AMPLITUDE_SCALAR,
+                                   DISTANCE_SCALE_LOG +
+                                   (0.5f * logf(distanceSquareToSource) / logf(DISTANCE_LOG_BASE)) - 1);
+        distanceCoefficient = std::min(1.0f, distanceCoefficient);
+        
+        // multiply the current attenuation coefficient by the distance coefficient
+        pair.attenuationCoefficient *= distanceCoefficient;
+        
+        // project the rotated source position vector onto the XZ plane
+        rotatedSourcePosition.y = 0.0f;
+        
+        // produce an oriented angle about the y-axis
+        pair.bearingRelativeAngleToSource = glm::orientedAngle(glm::vec3(0.0f, 0.0f, -1.0f),
+                                                               glm::normalize(rotatedSourcePosition),
+                                                               glm::vec3(0.0f, 1.0f, 0.0f));
+        
+        const float PHASE_AMPLITUDE_RATIO_AT_90 = 0.5;
+        
+        // figure out the number of samples of delay and the ratio of the amplitude
+        // in the weak channel for audio spatialization
+        float sinRatio = fabsf(sinf(glm::radians(pair.bearingRelativeAngleToSource)));
+        pair.numSamplesDelay = PHASE_DELAY_AT_90 * sinRatio;
+        pair.weakChannelAmplitudeRatio = 1 - (PHASE_AMPLITUDE_RATIO_AT_90 * sinRatio);
+        
+        // setup the freeVerb effect for this source for this client, if it doesn't have one yet
+        if (!pair.twoPole) {
+            pair.twoPole = new AudioTwoPole(TWO_POLE_SAMPLE_RATE);
+        }
+        
+        // calculate the reasonance for this TwoPole based on angle to source
+        float TWO_POLE_CUT_OFF_FREQUENCY = 800.0f;
+        float TWO_POLE_MAX_FILTER_STRENGTH = 0.4f;
+        
+        pair.twoPole->setResonance(TWO_POLE_CUT_OFF_FREQUENCY,
+                                   TWO_POLE_MAX_FILTER_STRENGTH * fabsf(pair.bearingRelativeAngleToSource) / 180.0f,
+                                   true);
+        pair.shouldFilter = true;
+    }
+}
+
+// adds one source to the listener's mix, as worked out in its MixPair
+void mixSourceIntoListener(MixWorkerScratch* scratch, PositionalAudioRingBuffer* sourceBuffer, MixPair* pair) {
+    float* goodChannel = (pair->bearingRelativeAngleToSource > 0.0f)
+        ? scratch->mixSamples
+        : scratch->mixSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
+    float* delayedChannel = (pair->bearingRelativeAngleToSource > 0.0f)
+        ? scratch->mixSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL
+        : scratch->mixSamples;
+    
+    // the source's samples were converted once for every listener, the samples before them are the end of
+    // its last frame for the delayed channel
+    const float* sourceSamples = sourceBuffer->getMixSamples();
+    
+    if (pair->shouldFilter) {
+        // perform the TwoPole effect on this frame's samples, they're shared so it goes into our scratch
+        float* filteredSamples = scratch->sourceSamples + PHASE_DELAY_AT_90;
+        memcpy(filteredSamples - pair->numSamplesDelay, sourceSamples - pair->numSamplesDelay,
+               pair->numSamplesDelay * sizeof(float));
+        pair->twoPole->process(sourceSamples, filteredSamples, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+        sourceSamples = filteredSamples;
+    }
+    
+    audioMixAdd(goodChannel, sourceSamples, pair->attenuationCoefficient, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+    audioMixAdd(delayedChannel, sourceSamples - pair->numSamplesDelay,
+                pair->attenuationCoefficient * pair->weakChannelAmplitudeRatio, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+}
 
-    unsigned char* packetData = new unsigned char[MAX_PACKET_SIZE];
+bool isMoreAudible(const MixCandidate& candidateA, const MixCandidate& candidateB) {
+    return candidateA.audibility > candidateB.audibility;
+}
 
-    sockaddr* nodeAddress = new sockaddr;
+// hearing yourself has no spatialization at all, and is never culled. Returns true if there was any loopback.
+bool mixLoopbackForListener(MixWorkerScratch* scratch, AvatarAudioRingBuffer* listenerBuffer) {
+    if (listenerBuffer->shouldLoopbackForNode()) {
+        MixPair loopbackPair;
+        mixSourceIntoListener(scratch, listenerBuffer, &loopbackPair);
+        return true;
+    }
+    return false;
+}
 
-    // make sure our node socket is non-blocking
-    nodeList->getNodeSocket()->setBlocking(false);
+// adds the source to the listener's candidates for this frame, if the listener is close enough to hear it
+void addMixCandidate(MixWorkerScratch* scratch, AvatarAudioRingBuffer* listenerBuffer, const AudioGridSource& source,
+                     bool isInCellBed) {
+    glm::vec3 relativePosition = source.buffer->getPosition() - listenerBuffer->getPosition();
+    if (glm::dot(relativePosition, relativePosition) > source.reach * source.reach) {
+        return;
+    }
     
-    int nextFrame = 0;
-    timeval startTime;
+    float radius = 0.0f;
+    float attenuationRatio = 1.0f;
+    getRadiusAndAttenuationRatio(source.node, radius, attenuationRatio);
     
-    int numBytesPacketHeader = numBytesForPacketHeader((unsigned char*) &PACKET_TYPE_MIXED_AUDIO);
-    unsigned char clientPacket[BUFFER_LENGTH_BYTES_STEREO + numBytesPacketHeader];
-    populateTypeAndVersion(clientPacket, PACKET_TYPE_MIXED_AUDIO);
+    // only work the coefficients out again if one of us has moved since the last time
+    MixPair* pair = &listenerBuffer->getMixPair(source.buffer->getSourceID());
+    if (pair->isStale(listenerBuffer, source.buffer, radius, attenuationRatio)) {
+        updateMixPair(*pair, listenerBuffer, source.buffer, radius, attenuationRatio);
+        pair->rememberInputs(listenerBuffer, source.buffer, radius, attenuationRatio);
+    }
     
-    int16_t clientSamples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2] = {};
+    MixCandidate candidate;
+    candidate.buffer = source.buffer;
+    candidate.pair = pair;
+    candidate.audibility = source.buffer->getLoudness() * pair->attenuationCoefficient;
+    candidate.isInCellBed = isInCellBed;
+    scratch->candidates.push_back(candidate);
+}
+
+// ThreadPoolJob that mixes and queues up the audio for a single listener. Listeners only read from the source ring
+// buffers, so they can all be mixed at once, the only thing each one writes to is its own mix pairs.
+void mixAudioForListener(void* jobData, int workerIndex) {
+    Node* node = (Node*) jobData;
+    MixWorkerScratch* scratch = mixWorkerScratch[workerIndex];
     
-    gettimeofday(&startTime, NULL);
+    AvatarAudioRingBuffer* nodeRingBuffer = (AvatarAudioRingBuffer*) node->getLinkedData();
     
-    timeval lastDomainServerCheckIn = {};
+    // zero out the client mix for this node
+    memset(scratch->mixSamples, 0, sizeof(scratch->mixSamples));
     
-    timeval beginSendTime, endSendTime;
-    float sumFrameTimePercentages = 0.0f;
-    int numStatCollections = 0;
+    std::vector<MixCandidate>& candidates = scratch->candidates;
+    candidates.clear();
     
-    stk::StkFrames stkFrameBuffer(BUFFER_LENGTH_SAMPLES_PER_CHANNEL, 1);
+    // anything we can hear is either in one of the cells around us, or carries far enough to be heard from anywhere
+    const AudioGridCell* nearbyCells[AudioSourceGrid::MAX_CELLS_NEAR];
+    int numNearbyCells = ::sourceGrid->findCellsNear(nodeRingBuffer->getPosition(), nearbyCells);
+    bool isListenerInCellBed = false;
+    bool hasLoopback = false;
     
-    // if we'll be sending stats, call the Logstash::socket() method to make it load the logstash IP outside the loop
-    if (Logstash::shouldSendStats()) {
-        Logstash::socket();
+    for (int i = 0; i < numNearbyCells; i++) {
+        for (int j = 0; j < nearbyCells[i]->numSources; j++) {
+            const AudioGridSource& source = nearbyCells[i]->sources[j];
+            if (source.node == node) {
+                isListenerInCellBed = true;
+                hasLoopback = mixLoopbackForListener(scratch, nodeRingBuffer);
+            } else {
+                addMixCandidate(scratch, nodeRingBuffer, source, true);
+            }
+        }
     }
     
-    while (true) {
-        if (Logstash::shouldSendStats()) {
-            gettimeofday(&beginSendTime, NULL);
+    const std::vector<AudioGridSource>& wideSources = ::sourceGrid->getWideSources();
+    for (int i = 0; i < wideSources.size(); i++) {
+        if (wideSources[i].node == node) {
+            hasLoopback = mixLoopbackForListener(scratch, nodeRingBuffer);
+        } else {
+            addMixCandidate(scratch, nodeRingBuffer, wideSources[i], false);
         }
-        
-        // send a check in packet to the domain server if DOMAIN_SERVER_CHECK_IN_USECS has elapsed
-        if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
-            gettimeofday(&lastDomainServerCheckIn, NULL);
-            NodeList::getInstance()->sendDomainServerCheckIn();
-            
-            if (Logstash::shouldSendStats() && numStatCollections > 0) {
-                // if we should be sending stats to Logstash send the appropriate average now
-                const char MIXER_LOGSTASH_METRIC_NAME[] = "audio-mixer-frame-time-usage";
-                
-                float averageFrameTimePercentage = sumFrameTimePercentages / numStatCollections;
-                Logstash::stashValue(STAT_TYPE_TIMER, MIXER_LOGSTASH_METRIC_NAME, averageFrameTimePercentage);
-                
-                sumFrameTimePercentages = 0.0f;
-                numStatCollections = 0;
+    }
+    
+    // in a crowd only the loudest sources we can hear get the full treatment
+    int numSourcesToMix = std::min((int) candidates.size(), ::maxMixSources);
+    if (numSourcesToMix < (int) candidates.size()) {
+        std::nth_element(candidates.begin(), candidates.begin() + numSourcesToMix, candidates.end(), isMoreAudible);
+    }
+    
+    for (int i = 0; i < numSourcesToMix; i++) {
+        mixSourceIntoListener(scratch, candidates[i].buffer, candidates[i].pair);
+    }
+    
+    if (::wantAmbientBed && numSourcesToMix < (int) candidates.size()) {
+        // The rest are heard through the ambient beds of the cells around us. Those have everything in the cell in
+        // them, so take out what we already mixed and ourselves, and add the wide sources that didn't make it.
+        float* bedSamples = scratch->sourceSamples;
+        memset(bedSamples, 0, BUFFER_LENGTH_SAMPLES_PER_CHANNEL * sizeof(float));
+        for (int i = 0; i < numNearbyCells; i++) {
+            audioMixAdd(bedSamples, nearbyCells[i]->bedSamples, 1.0f, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+        }
+        for (int i = 0; i < candidates.size(); i++) {
+            if (i < numSourcesToMix && candidates[i].isInCellBed) {
+                audioMixAdd(bedSamples, candidates[i].buffer->getMixSamples(), -AMBIENT_BED_GAIN,
+                            BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+            } else if (i >= numSourcesToMix && !candidates[i].isInCellBed) {
+                audioMixAdd(bedSamples, candidates[i].buffer->getMixSamples(), AMBIENT_BED_GAIN,
+                            BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
             }
         }
+        if (isListenerInCellBed) {
+            audioMixAdd(bedSamples, nodeRingBuffer->getMixSamples(), -AMBIENT_BED_GAIN, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+        }
         
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-            PositionalAudioRingBuffer* positionalRingBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
-            
-            if (positionalRingBuffer && positionalRingBuffer->shouldBeAddedToMix(JITTER_BUFFER_SAMPLES)) {
-                // this is a ring buffer that is ready to go
-                // set its flag so we know to push its buffer when all is said and done
-                positionalRingBuffer->setWillBeAddedToMix(true);
-            }
+        audioMixAdd(scratch->mixSamples, bedSamples, 1.0f, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+        audioMixAdd(scratch->mixSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL, bedSamples, 1.0f,
+                    BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
+    }
+    
+    // answer in the codec the listener sends us its own audio in
+    PACKET_VERSION codec = nodeRingBuffer->getCodec();
+    AudioEncoder& mixEncoder = nodeRingBuffer->getMixEncoder();
+    if (mixEncoder.getCodec() != codec) {
+        mixEncoder.setCodec(codec);
+    }
+    
+    if (!hasLoopback && candidates.empty()) {
+        // there's nothing for this listener to hear, so all it gets is a tiny packet saying so
+        int numBytesSilentPacket = populateTypeAndVersion(scratch->clientPacket, PACKET_TYPE_SILENT_AUDIO_FRAME, codec);
+        scratch->sendBatch.queue(node->getPublicSocket(), scratch->clientPacket, numBytesSilentPacket);
+        return;
+    }
+    
+    // the whole mix is saturated once, rather than after each source
+    audioMixFloatToInt16(scratch->mixSamples, scratch->clientSamples, BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2);
+    
+    unsigned char* currentPacketPtr = scratch->clientPacket
+        + populateTypeAndVersion(scratch->clientPacket, PACKET_TYPE_MIXED_AUDIO, codec);
+    currentPacketPtr += mixEncoder.encode(scratch->clientSamples, BUFFER_LENGTH_SAMPLES_PER_CHANNEL, 2, currentPacketPtr);
+    scratch->sendBatch.queue(node->getPublicSocket(), scratch->clientPacket, currentPacketPtr - scratch->clientPacket);
+}
+
+// Reactor timer, mixes and sends a frame of audio for each listener every BUFFER_SEND_INTERVAL_USECS
+void mixAudioFrame(void* extraData) {
+    NodeList* nodeList = NodeList::getInstance();
+    NodeListReadScope readScope(nodeList); // the mix workers are covered by this too
+    
+    timeval beginSendTime;
+    gettimeofday(&beginSendTime, NULL);
+    
+    static std::vector<void*> listeners;
+    listeners.clear();
+    
+    static int numFramesMixed = 0;
+    bool shouldForgetLeftSources = (++numFramesMixed % FORGET_LEFT_SOURCES_INTERVAL_FRAMES == 0);
+    static std::vector<unsigned int> liveSourceIDs;
+    liveSourceIDs.clear();
+    
+    ::sourceGrid->clear();
+    
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        PositionalAudioRingBuffer* positionalRingBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
+        
+        if (positionalRingBuffer && shouldForgetLeftSources) {
+            liveSourceIDs.push_back(positionalRingBuffer->getSourceID());
         }
         
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-            
-            const int PHASE_DELAY_AT_90 = 20;
+        if (positionalRingBuffer && positionalRingBuffer->shouldBeAddedToMix()) {
+            // this is a ring buffer that is ready to go
+            // set its flag so we know to push its buffer when all is said and done
+            positionalRingBuffer->setWillBeAddedToMix(true);
+            positionalRingBuffer->prepareMixSamples();
+        }
+        
+        // silent sources still move on below, but there's no point in anyone looking at them
+        if (positionalRingBuffer && positionalRingBuffer->willBeAddedToMix() && !positionalRingBuffer->isSilent()) {
+            float radius = 0.0f;
+            float attenuationRatio = 1.0f;
+            getRadiusAndAttenuationRatio(&*node, radius, attenuationRatio);
             
-            if (node->getType() == NODE_TYPE_AGENT) {
-                AvatarAudioRingBuffer* nodeRingBuffer = (AvatarAudioRingBuffer*) node->getLinkedData();
-                
-                // zero out the client mix for this node
-                memset(clientSamples, 0, sizeof(clientSamples));
-                
-                for (NodeList::iterator otherNode = nodeList->begin(); otherNode != nodeList->end(); otherNode++) {
-                    if (((PositionalAudioRingBuffer*) otherNode->getLinkedData())->willBeAddedToMix()
-                        && (otherNode != node || (otherNode == node && nodeRingBuffer->shouldLoopbackForNode()))) {
-                        
-                        PositionalAudioRingBuffer* otherNodeBuffer = (PositionalAudioRingBuffer*) otherNode->getLinkedData();
-                        
-                        float bearingRelativeAngleToSource = 0.0f;
-                        float attenuationCoefficient = 1.0f;
-                        int numSamplesDelay = 0;
-                        float weakChannelAmplitudeRatio = 1.0f;
-                        
-                        stk::TwoPole* otherNodeTwoPole = NULL;
-                        
-                        if (otherNode != node) {
-                            
-                            glm::vec3 listenerPosition = nodeRingBuffer->getPosition();
-                            glm::vec3 relativePosition = otherNodeBuffer->getPosition() - nodeRingBuffer->getPosition();
-                            glm::quat inverseOrientation = glm::inverse(nodeRingBuffer->getOrientation());
-                            
-                            float distanceSquareToSource = glm::dot(relativePosition, relativePosition);
-                            float radius = 0.0f;
-                            
-                            if (otherNode->getType() == NODE_TYPE_AUDIO_INJECTOR) {
-                                InjectedAudioRingBuffer* injectedBuffer = (InjectedAudioRingBuffer*) otherNodeBuffer;
-                                radius = injectedBuffer->getRadius();
-                                attenuationCoefficient *= injectedBuffer->getAttenuationRatio();
-                            }
-                            
-                            if (radius == 0 || (distanceSquareToSource > radius * radius)) {
-                                // this is either not a spherical source, or the listener is outside the sphere
-                                
-                                if (radius > 0) {
-                                    // this is a spherical source - the distance used for the coefficient
-                                    // needs to be the closest point on the boundary to the source
-                                                             
-                                    // ovveride the distance to the node with the distance to the point on the
-                                    // boundary of the sphere
-                                    distanceSquareToSource -= (radius * radius);
-                                    
-                                } else {
-                                    // calculate the angle delivery for off-axis attenuation
-                                    glm::vec3 rotatedListenerPosition = glm::inverse(otherNodeBuffer->getOrientation())
-                                        * relativePosition;
-                                    
-                                    float angleOfDelivery = glm::angle(glm::vec3(0.0f, 0.0f, -1.0f),
-                                                                       glm::normalize(rotatedListenerPosition));
-                                    
-                                    const float MAX_OFF_AXIS_ATTENUATION = 0.2f;
-                                    const float OFF_AXIS_ATTENUATION_FORMULA_STEP = (1 - MAX_OFF_AXIS_ATTENUATION) / 2.0f;
-                                    
-                                    float offAxisCoefficient = MAX_OFF_AXIS_ATTENUATION +
-                                        (OFF_AXIS_ATTENUATION_FORMULA_STEP * (angleOfDelivery / 90.0f));
-                                    
-                                    // multiply the current attenuation coefficient by the calculated off axis coefficient
-                                    attenuationCoefficient *= offAxisCoefficient;
-                                }
-                                
-                                glm::vec3 rotatedSourcePosition = inverseOrientation * relativePosition;
-                                
-                                const float DISTANCE_SCALE = 2.5f;
-                                const float GEOMETRIC_AMPLITUDE_SCALAR = 0.3f;
-                                const float DISTANCE_LOG_BASE = 2.5f;
-                                const float DISTANCE_SCALE_LOG = logf(DISTANCE_SCALE) / logf(DISTANCE_LOG_BASE);
-                                
-                                // calculate the distance coefficient using the distance to this node
-                                float distanceCoefficient = powf(GEOMETRIC_AMPLITUDE_SCALAR,
-                                                           DISTANCE_SCALE_LOG +
-                                                           (0.5f * logf(distanceSquareToSource) / logf(DISTANCE_LOG_BASE)) - 1);
-                                distanceCoefficient = std::min(1.0f, distanceCoefficient);
-                                
-                                // multiply the current attenuation coefficient by the distance coefficient
-                                attenuationCoefficient *= distanceCoefficient;
-                                
-                                // project the rotated source position vector onto the XZ plane
-                                rotatedSourcePosition.y = 0.0f;
-                                
-                                // produce an oriented angle about the y-axis
-                                bearingRelativeAngleToSource = glm::orientedAngle(glm::vec3(0.0f, 0.0f, -1.0f),
-                                                                                  glm::normalize(rotatedSourcePosition),
-                                                                                  glm::vec3(0.0f, 1.0f, 0.0f));
-                                
-                                const float PHASE_AMPLITUDE_RATIO_AT_90 = 0.5;
-                                
-                                // figure out the number of samples of delay and the ratio of the amplitude
-                                // in the weak channel for audio spatialization
-                                float sinRatio = fabsf(sinf(glm::radians(bearingRelativeAngleToSource)));
-                                numSamplesDelay = PHASE_DELAY_AT_90 * sinRatio;
-                                weakChannelAmplitudeRatio = 1 - (PHASE_AMPLITUDE_RATIO_AT_90 * sinRatio);
-                                
-                                // grab the TwoPole object for this source, add it if it doesn't exist
-                                TwoPoleNodeMap& nodeTwoPoles = nodeRingBuffer->getTwoPoles();
-                                TwoPoleNodeMap::iterator twoPoleIterator = nodeTwoPoles.find(otherNode->getNodeID());
-                                
-                                if (twoPoleIterator == nodeTwoPoles.end()) {
-                                    // setup the freeVerb effect for this source for this client
-                                    otherNodeTwoPole = nodeTwoPoles[otherNode->getNodeID()] = new stk::TwoPole;
-                                } else {
-                                    otherNodeTwoPole = twoPoleIterator->second;
-                                }
-                                
-                                // calculate the reasonance for this TwoPole based on angle to source
-                                float TWO_POLE_CUT_OFF_FREQUENCY = 800.0f;
-                                float TWO_POLE_MAX_FILTER_STRENGTH = 0.4f;
-                                
-                                otherNodeTwoPole->setResonance(TWO_POLE_CUT_OFF_FREQUENCY,
-                                                                TWO_POLE_MAX_FILTER_STRENGTH
-                                                                * fabsf(bearingRelativeAngleToSource) / 180.0f,
-                                                                true);
-                            }
-                        }
-                        
-                        int16_t* sourceBuffer = otherNodeBuffer->getNextOutput();
-                        
-                        int16_t* goodChannel = (bearingRelativeAngleToSource > 0.0f)
-                            ? clientSamples
-                            : clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
-                        int16_t* delayedChannel = (bearingRelativeAngleToSource > 0.0f)
-                            ? clientSamples + BUFFER_LENGTH_SAMPLES_PER_CHANNEL
-                            : clientSamples;
-                        
-                        int16_t* delaySamplePointer = otherNodeBuffer->getNextOutput() == otherNodeBuffer->getBuffer()
-                            ? otherNodeBuffer->getBuffer() + RING_BUFFER_LENGTH_SAMPLES - numSamplesDelay
-                            : otherNodeBuffer->getNextOutput() - numSamplesDelay;
-                        
-                        for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
-                            // load up the stkFrameBuffer with this source's samples
-                            stkFrameBuffer[s] = (stk::StkFloat) sourceBuffer[s];
-                        }
-                        
-                        // perform the TwoPole effect on the stkFrameBuffer
-                        if (otherNodeTwoPole) {
-                            otherNodeTwoPole->tick(stkFrameBuffer);
-                        }
-                        
-                        for (int s = 0; s < BUFFER_LENGTH_SAMPLES_PER_CHANNEL; s++) {
-                            if (s < numSamplesDelay) {
-                                // pull the earlier sample for the delayed channel
-                                int earlierSample = delaySamplePointer[s] * attenuationCoefficient * weakChannelAmplitudeRatio;
-                                
-                                delayedChannel[s] = glm::clamp(delayedChannel[s] + earlierSample,
-                                                               MIN_SAMPLE_VALUE,
-                                                               MAX_SAMPLE_VALUE);
-                            }
-                            
-                            int16_t currentSample = stkFrameBuffer[s] * attenuationCoefficient;
-                            
-                            goodChannel[s] = glm::clamp(goodChannel[s] + currentSample,
-                                                        MIN_SAMPLE_VALUE,
-                                                        MAX_SAMPLE_VALUE);
-                            
-                            if (s + numSamplesDelay < BUFFER_LENGTH_SAMPLES_PER_CHANNEL) {
-                                int sumSample = delayedChannel[s + numSamplesDelay]
-                                    + (currentSample * weakChannelAmplitudeRatio);
-                                delayedChannel[s + numSamplesDelay] = glm::clamp(sumSample,
-                                                                                 MIN_SAMPLE_VALUE,
-                                                                                 MAX_SAMPLE_VALUE);
-                            }
-                            
-                            if (s >= BUFFER_LENGTH_SAMPLES_PER_CHANNEL - PHASE_DELAY_AT_90) {
-                                // this could be a delayed sample on the next pass
-                                // so store the affected back in the ARB
-                                otherNodeBuffer->getNextOutput()[s] = (int16_t) stkFrameBuffer[s];
-                            }
-                        }
-                    }
-                }
-                
-                memcpy(clientPacket + numBytesPacketHeader, clientSamples, sizeof(clientSamples));
-                nodeList->getNodeSocket()->send(node->getPublicSocket(), clientPacket, sizeof(clientPacket));
+            // a spherical source is heard at full volume anywhere inside it, and fades from its boundary
+            float reach = audibleDistanceFor(attenuationRatio);
+            if (radius > 0.0f) {
+                reach = sqrtf(reach * reach + radius * radius);
             }
+            ::sourceGrid->add(&*node, positionalRingBuffer, reach);
         }
         
-        // push forward the next output pointers for any audio buffers we used
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-            PositionalAudioRingBuffer* nodeBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
-            if (nodeBuffer && nodeBuffer->willBeAddedToMix()) {
+        if (node->getType() == NODE_TYPE_AGENT) {
+            listeners.push_back(&*node);
+        }
+    }
+    
+    ::sourceGrid->build(::wantAmbientBed ? AMBIENT_BED_GAIN : 0.0f);
+    
+    // before the workers start, each listener's pairs are only touched by the worker mixing for it
+    if (shouldForgetLeftSources) {
+        std::sort(liveSourceIDs.begin(), liveSourceIDs.end());
+        for (int i = 0; i < listeners.size(); i++) {
+            Node* listener = (Node*) listeners[i];
+            AvatarAudioRingBuffer* listenerBuffer = (AvatarAudioRingBuffer*) listener->getLinkedData();
+            if (listenerBuffer) {
+                listenerBuffer->forgetLeftSources(liveSourceIDs);
+            }
+        }
+    }
+    
+    // runJobs() returns once every listener has been mixed, only then can the source buffers move on
+    if (!listeners.empty()) {
+        mixWorkers->runJobs(mixAudioForListener, &listeners[0], listeners.size());
+    }
+    for (int i = 0; i < mixWorkerScratch.size(); i++) {
+        mixWorkerScratch[i]->sendBatch.flush();
+    }
+    
+    // push forward the next output pointers for any audio buffers we used
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        PositionalAudioRingBuffer* nodeBuffer = (PositionalAudioRingBuffer*) node->getLinkedData();
+        if (nodeBuffer && nodeBuffer->willBeAddedToMix()) {
+            // a concealed frame was never in the buffer, the one it covered for is still next if it turns up late
+            if (!nodeBuffer->isConcealingFrame()) {
                 nodeBuffer->setNextOutput(nodeBuffer->getNextOutput() + BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
                 
                 if (nodeBuffer->getNextOutput() >= nodeBuffer->getBuffer() + RING_BUFFER_LENGTH_SAMPLES) {
                     nodeBuffer->setNextOutput(nodeBuffer->getBuffer());
                 }
-                
-                nodeBuffer->setWillBeAddedToMix(false);
             }
+            
+            nodeBuffer->setWillBeAddedToMix(false);
         }
+    }
+    
+    if (Logstash::shouldSendStats()) {
+        // send a packet to our logstash instance
+        
+        // calculate the percentage value for time elapsed for this send (of the max allowable time)
+        timeval endSendTime;
+        gettimeofday(&endSendTime, NULL);
+        
+        float percentageOfMaxElapsed = ((float) (usecTimestamp(&endSendTime) - usecTimestamp(&beginSendTime))
+            / BUFFER_SEND_INTERVAL_USECS) * 100.0f;
         
-        // pull any new audio data from nodes off of the network stack
-        while (nodeList->getNodeSocket()->receive(nodeAddress, packetData, &receivedBytes) &&
-               packetVersionMatch(packetData)) {
+        sumFrameTimePercentages += percentageOfMaxElapsed;
+        
+        numStatCollections++;
+    }
+    
+    if (usecTimestampNow() - usecTimestamp(&beginSendTime) > BUFFER_SEND_INTERVAL_USECS) {
+        std::cout << "Took too much time, the next frame will be late!\n";
+    }
+}
+
+// Reactor handler for the node socket, pulls any new audio data from nodes off of the network stack, as many
+// packets at a time as are waiting
+void processAudioPackets(void* extraData) {
+    UDPReceiveBatch* receiveBatch = (UDPReceiveBatch*) extraData;
+    NodeList* nodeList = NodeList::getInstance();
+    NodeListReadScope readScope(nodeList);
+    
+    while (receiveBatch->receive() > 0) {
+        for (int packetIndex = 0; packetIndex < receiveBatch->getCount(); packetIndex++) {
+            unsigned char* packetData = receiveBatch->getPacket(packetIndex);
+            ssize_t receivedBytes = receiveBatch->getByteLength(packetIndex);
+            sockaddr* nodeAddress = receiveBatch->getSenderAddress(packetIndex);
+            
+            if (!packetVersionMatch(packetData)) {
+                continue;
+            }
+            
             if (packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO ||
-                packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO) {
+                packetData[0] == PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO ||
+                packetData[0] == PACKET_TYPE_SILENT_AUDIO_FRAME) {
                 Node* avatarNode = nodeList->addOrUpdateNode(nodeAddress,
                                                              nodeAddress,
                                                              NODE_TYPE_AGENT,
                                                              nodeList->getLastNodeID());
-                
+            
                 if (avatarNode->getNodeID() == nodeList->getLastNodeID()) {
                     nodeList->increaseNodeID();
                 }
-                
+            
                 nodeList->updateNodeWithData(nodeAddress, packetData, receivedBytes);
-                
+            
                 if (std::isnan(((PositionalAudioRingBuffer *)avatarNode->getLinkedData())->getOrientation().x)) {
                     // kill off this node - temporary solution to mixer crash on mac sleep
                     avatarNode->setAlive(false);
                 }
             } else if (packetData[0] == PACKET_TYPE_INJECT_AUDIO) {
                 Node* matchingInjector = NULL;
-                
+            
                 for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
                     if (node->getLinkedData()) {
-                       
+                   
                         InjectedAudioRingBuffer* ringBuffer = (InjectedAudioRingBuffer*) node->getLinkedData();
                         if (memcmp(ringBuffer->getStreamIdentifier(),
                                    packetData + 1,
@@ -382,16 +610,16 @@ int main(int argc, const char* argv[]) {
                         }
                     }
                 }
-                
+            
                 if (!matchingInjector) {
                     matchingInjector = nodeList->addOrUpdateNode(NULL,
                                                                  NULL,
                                                                  NODE_TYPE_AUDIO_INJECTOR,
                                                                  nodeList->getLastNodeID());
                     nodeList->increaseNodeID();
-                    
-                }
                 
+                }
+            
                 // give the new audio data to the matching injector node
                 nodeList->updateNodeWithData(matchingInjector, packetData, receivedBytes);
             } else if (packetData[0] == PACKET_TYPE_PING) {
@@ -400,29 +628,72 @@ int main(int argc, const char* argv[]) {
                 nodeList->processNodeData(nodeAddress, packetData, receivedBytes);
             }
         }
-        
-        if (Logstash::shouldSendStats()) {
-            // send a packet to our logstash instance
-            
-            // calculate the percentage value for time elapsed for this send (of the max allowable time)
-            gettimeofday(&endSendTime, NULL);
-            
-            float percentageOfMaxElapsed = ((float) (usecTimestamp(&endSendTime) - usecTimestamp(&beginSendTime))
-                / BUFFER_SEND_INTERVAL_USECS) * 100.0f;
-            
-            sumFrameTimePercentages += percentageOfMaxElapsed;
-            
-            numStatCollections++;
-        }
-        
-        int usecToSleep = usecTimestamp(&startTime) + (++nextFrame * BUFFER_SEND_INTERVAL_USECS) - usecTimestampNow();
-        
-        if (usecToSleep > 0) {
-            usleep(usecToSleep);
-        } else {
-            std::cout << "Took too much time, not sleeping!\n";
-        }
     }
+}
+
+int main(int argc, const char* argv[]) {
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    
+    // Handle Local Domain testing with the --local command line
+    const char* local = "--local";
+    ::wantLocalDomain = cmdOptionExists(argc, argv,local);
+    if (::wantLocalDomain) {
+        printf("Local Domain MODE!\n");
+        int ip = getLocalAddress();
+        sprintf(DOMAIN_IP,"%d.%d.%d.%d", (ip & 0xFF), ((ip >> 8) & 0xFF),((ip >> 16) & 0xFF), ((ip >> 24) & 0xFF));
+    }
+    
+    NodeList* nodeList = NodeList::createInstance(NODE_TYPE_AUDIO_MIXER, MIXER_LISTEN_PORT);
+    
+    nodeList->linkedDataCreateCallback = attachNewBufferToNode;
+    
+    nodeList->startSilentNodeRemovalThread();
+
+    // make sure our node socket is non-blocking
+    nodeList->getNodeSocket()->setBlocking(false);
+    
+    const char* MIX_THREADS = "--mixThreads";
+    const char* mixThreads = getCmdOption(argc, argv, MIX_THREADS);
+    if (mixThreads) {
+        ::numMixThreads = std::max(1, atoi(mixThreads));
+    }
+    printf("numMixThreads=%d\n", ::numMixThreads);
+    printf("mix kernel=%s\n", getAudioMixKernelName());
+    
+    const char* MAX_MIX_SOURCES = "--maxMixSources";
+    const char* maxMixSources = getCmdOption(argc, argv, MAX_MIX_SOURCES);
+    if (maxMixSources) {
+        ::maxMixSources = std::max(1, atoi(maxMixSources));
+    }
+    printf("maxMixSources=%d\n", ::maxMixSources);
+    
+    const char* AMBIENT_BED = "--ambientBed";
+    ::wantAmbientBed = cmdOptionExists(argc, argv, AMBIENT_BED);
+    printf("wantAmbientBed=%s\n", ::wantAmbientBed ? "yes" : "no");
+    
+    // each worker sends the mixes it made together at the end of each frame
+    ::mixWorkers = new ThreadPool(::numMixThreads);
+    for (int i = 0; i < ::numMixThreads; i++) {
+        ::mixWorkerScratch.push_back(new MixWorkerScratch(nodeList->getNodeSocket()));
+    }
+    
+    // a cell is as wide as an ordinary source can be heard from
+    ::sourceGrid = new AudioSourceGrid(audibleDistanceFor(1.0f));
+    
+    UDPReceiveBatch receiveBatch(nodeList->getNodeSocket());
+    
+    // if we'll be sending stats, call the Logstash::socket() method to make it load the logstash IP outside the loop
+    if (Logstash::shouldSendStats()) {
+        Logstash::socket();
+    }
+    
+    Reactor reactor;
+    reactor.watchForRead(nodeList->getNodeSocket()->getHandle(), processAudioPackets, &receiveBatch);
+    reactor.addTimer(BUFFER_SEND_INTERVAL_USECS, mixAudioFrame, NULL);
+    reactor.addTimer(DOMAIN_SERVER_CHECK_IN_USECS, checkInWithDomainServer, NULL);
+    
+    checkInWithDomainServer(NULL);
+    reactor.run();
     
     return 0;
 }
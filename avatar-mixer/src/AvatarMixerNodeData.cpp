@@ -0,0 +1,233 @@
+//
+//  AvatarMixerNodeData.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include <NodeList.h>
+#include <PacketHeaders.h>
+
+#include "AvatarMixerNodeData.h"
+
+// about the size of an avatar, for telling if one is in view
+const float AVATAR_VIEW_RADIUS = 1.0f;
+
+AvatarMixerNodeData::AvatarSendState::AvatarSendState() :
+    lastReplySent(-1),
+    nextStateSequence(0),
+    hasAckedState(false),
+    ackedStateSequence(0) {
+}
+
+AvatarMixerNodeData::AvatarMixerNodeData(Node* owningNode) :
+    AvatarData(owningNode),
+    _hasNewHeadData(false),
+    _hasStateToSend(false),
+    _hasViewFrustum(false),
+    _numReplies(0),
+    _nextPacketSequence(0) {
+}
+
+int AvatarMixerNodeData::parseData(unsigned char* sourceBuffer, int numBytes) {
+    _hasNewHeadData = true;
+    return AvatarData::parseData(sourceBuffer, numBytes);
+}
+
+bool AvatarMixerNodeData::takeNewHeadData() {
+    if (!_hasNewHeadData) {
+        return false;
+    }
+    _hasNewHeadData = false;
+
+    unsigned char broadcastData[MAX_AVATAR_BROADCAST_BYTES];
+    _hasStateToSend = _stateToSend.setBroadcastData(broadcastData, getBroadcastData(broadcastData));
+
+    updateViewFrustum();
+    return true;
+}
+
+void AvatarMixerNodeData::updateViewFrustum() {
+    _hasViewFrustum = _cameraFov > 0.0f;
+    if (!_hasViewFrustum) {
+        return;
+    }
+
+    ViewFrustum newestViewFrustum;
+    newestViewFrustum.setPosition(_cameraPosition);
+    newestViewFrustum.setOrientation(_cameraOrientation);
+    newestViewFrustum.setFieldOfView(_cameraFov);
+    newestViewFrustum.setAspectRatio(_cameraAspectRatio);
+    newestViewFrustum.setNearClip(_cameraNearClip);
+    newestViewFrustum.setFarClip(_cameraFarClip);
+
+    // only recalculate if the view has changed
+    if (!newestViewFrustum.matches(_viewFrustum)) {
+        _viewFrustum = newestViewFrustum;
+        _viewFrustum.calculate();
+    }
+}
+
+int AvatarMixerNodeData::sendPeriodFor(const glm::vec3& avatarPosition, float distance) const {
+    if (distance <= FULL_RATE_AVATAR_DISTANCE) {
+        return 1;
+    }
+    if (!(distance < FULL_RATE_AVATAR_DISTANCE * MAX_AVATAR_SEND_PERIOD)) {
+        // this also catches avatars with a NaN position
+        return MAX_AVATAR_SEND_PERIOD;
+    }
+
+    int sendPeriod = ceilf(distance / FULL_RATE_AVATAR_DISTANCE);
+    if (_hasViewFrustum && _viewFrustum.sphereInFrustum(avatarPosition, AVATAR_VIEW_RADIUS) == ViewFrustum::OUTSIDE) {
+        sendPeriod *= OUT_OF_VIEW_AVATAR_SEND_PERIOD_SCALE;
+    }
+    return std::min(sendPeriod, MAX_AVATAR_SEND_PERIOD);
+}
+
+bool AvatarMixerNodeData::isMoreOverdue(const DueAvatar& avatarA, const DueAvatar& avatarB) {
+    if (avatarA.overdueRatio != avatarB.overdueRatio) {
+        return avatarA.overdueRatio > avatarB.overdueRatio;
+    }
+    return avatarA.distance < avatarB.distance;
+}
+
+void AvatarMixerNodeData::chooseAvatarsToSend(Node* ownNode, std::vector<Node*>& avatarsToSend) {
+    _numReplies++;
+    _dueAvatars.clear();
+
+    NodeList* nodeList = NodeList::getInstance();
+
+    // every avatar still around is sent at least this often, so it's often enough to forget the ones that have left
+    if (_numReplies % MAX_AVATAR_SEND_PERIOD == 0) {
+        forgetLeftAvatars();
+    }
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        AvatarMixerNodeData* avatarData = (AvatarMixerNodeData*) node->getLinkedData();
+        if (&*node == ownNode || !avatarData || !avatarData->getStateToSend()) {
+            continue;
+        }
+
+        const glm::vec3& avatarPosition = avatarData->getPosition();
+        float distance = glm::distance(avatarPosition, _position);
+        int sendPeriod = sendPeriodFor(avatarPosition, distance);
+
+        DueAvatar dueAvatar;
+        dueAvatar.node = &*node;
+        dueAvatar.distance = distance;
+
+        std::map<uint16_t, AvatarSendState>::const_iterator sendState = _avatarSendStates.find(node->getNodeID());
+        if (sendState == _avatarSendStates.end() || sendState->second.lastReplySent < 0) {
+            // an avatar this node hasn't heard about yet goes ahead of the rest
+            dueAvatar.overdueRatio = FLT_MAX;
+        } else {
+            int repliesSinceSent = _numReplies - sendState->second.lastReplySent;
+            if (repliesSinceSent < sendPeriod) {
+                continue;
+            }
+            dueAvatar.overdueRatio = (float) repliesSinceSent / sendPeriod;
+        }
+        _dueAvatars.push_back(dueAvatar);
+    }
+
+    std::sort(_dueAvatars.begin(), _dueAvatars.end(), isMoreOverdue);
+
+    avatarsToSend.clear();
+    for (int i = 0; i < _dueAvatars.size(); i++) {
+        avatarsToSend.push_back(_dueAvatars[i].node);
+    }
+}
+
+void AvatarMixerNodeData::forgetLeftAvatars() {
+    NodeList* nodeList = NodeList::getInstance();
+
+    std::map<uint16_t, AvatarSendState>::iterator sendState = _avatarSendStates.begin();
+    while (sendState != _avatarSendStates.end()) {
+        if (nodeList->nodeWithID(sendState->first)) {
+            sendState++;
+        } else {
+            _avatarSendStates.erase(sendState++);
+        }
+    }
+}
+
+int AvatarMixerNodeData::startPacket(unsigned char* destination) {
+    uint16_t sequence = _nextPacketSequence++;
+
+    SentPacket& sentPacket = _sentPackets[sequence % SENT_PACKET_HISTORY];
+    sentPacket.sequence = sequence;
+    sentPacket.avatarStates.clear();
+
+    memcpy(destination, &sequence, sizeof(sequence));
+    return sizeof(sequence);
+}
+
+int AvatarMixerNodeData::packAvatar(Node* avatarNode, unsigned char* destination) {
+    const AvatarState* stateToSend = ((AvatarMixerNodeData*) avatarNode->getLinkedData())->getStateToSend();
+
+    // the acked state is only any use while the node could still have it
+    AvatarSendState& sendState = _avatarSendStates[avatarNode->getNodeID()];
+    const AvatarState* baseline = NULL;
+    if (sendState.hasAckedState) {
+        baseline = sendState.sentStates.find(sendState.ackedStateSequence);
+    }
+
+    unsigned char* destinationStart = destination;
+    destination += packNodeId(destination, avatarNode->getNodeID());
+    destination += packAvatarState(*stateToSend, sendState.nextStateSequence, baseline, sendState.ackedStateSequence,
+                                   destination, _packedState);
+    return destination - destinationStart;
+}
+
+void AvatarMixerNodeData::markAvatarSent(Node* avatarNode) {
+    AvatarSendState& sendState = _avatarSendStates[avatarNode->getNodeID()];
+    sendState.lastReplySent = _numReplies;
+
+    SentAvatarState sentAvatarState;
+    sentAvatarState.nodeID = avatarNode->getNodeID();
+    sentAvatarState.stateSequence = sendState.nextStateSequence;
+    _sentPackets[(uint16_t) (_nextPacketSequence - 1) % SENT_PACKET_HISTORY].avatarStates.push_back(sentAvatarState);
+
+    sendState.sentStates.add(sendState.nextStateSequence++, _packedState);
+}
+
+void AvatarMixerNodeData::processAck(unsigned char* packetData, int numBytes) {
+    int numBytesPacketHeader = numBytesForPacketHeader(packetData);
+
+    uint16_t sequence;
+    if (numBytes < numBytesPacketHeader + sizeof(sequence)) {
+        return;
+    }
+    memcpy(&sequence, packetData + numBytesPacketHeader, sizeof(sequence));
+
+    SentPacket& sentPacket = _sentPackets[sequence % SENT_PACKET_HISTORY];
+    if (sentPacket.sequence != sequence) {
+        // we don't remember that far back
+        return;
+    }
+
+    for (int i = 0; i < sentPacket.avatarStates.size(); i++) {
+        uint16_t nodeID = sentPacket.avatarStates[i].nodeID;
+        std::map<uint16_t, AvatarSendState>::iterator foundState = _avatarSendStates.find(nodeID);
+        if (foundState == _avatarSendStates.end()) {
+            continue;
+        }
+        AvatarSendState& sendState = foundState->second;
+
+        // acks can come out of order, only ever move on to a newer state
+        uint16_t stateSequence = sentPacket.avatarStates[i].stateSequence;
+        if (sendState.hasAckedState && (int16_t) (stateSequence - sendState.ackedStateSequence) <= 0) {
+            continue;
+        }
+
+        if (sendState.sentStates.find(stateSequence)) {
+            sendState.hasAckedState = true;
+            sendState.ackedStateSequence = stateSequence;
+        }
+    }
+    sentPacket.avatarStates.clear();
+}
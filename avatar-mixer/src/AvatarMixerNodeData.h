@@ -0,0 +1,121 @@
+//
+//  AvatarMixerNodeData.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  What the avatar mixer keeps about each node on top of its avatar data: the state of it that goes out this tick,
+//  the view it's looking at, and when it was last sent each of the other avatars. Avatars near the node go out in
+//  every reply to it, the ones further away (and further again if they're out of view) only every so many replies.
+//  Those that are due are sent most overdue first, so when there isn't room in a reply for all of them the rest go
+//  out in the next one.
+//
+//  It also keeps the node's end of the avatar state stream (see AvatarStateStream.h): the states it was sent of each
+//  avatar, which of them it has acked, and which avatars went in each of the packets it might still ack.
+//
+
+#ifndef __hifi__AvatarMixerNodeData__
+#define __hifi__AvatarMixerNodeData__
+
+#include <map>
+#include <vector>
+
+#include <AvatarData.h>
+#include <AvatarStateStream.h>
+#include <Node.h>
+#include <ViewFrustum.h>
+
+// avatars closer than this are sent in every reply
+const float FULL_RATE_AVATAR_DISTANCE = 10.0f;
+
+// no avatar waits more than this many replies, about twice a second for an agent that gets a reply every tick
+const int MAX_AVATAR_SEND_PERIOD = 30;
+
+// avatars out of view wait this many times longer than they would if they were in view
+const int OUT_OF_VIEW_AVATAR_SEND_PERIOD_SCALE = 4;
+
+class AvatarMixerNodeData : public AvatarData {
+public:
+    AvatarMixerNodeData(Node* owningNode);
+
+    int parseData(unsigned char* sourceBuffer, int numBytes);
+
+    // Call on every node at the start of a tick, before any replies: takes the head data that came in since the last
+    // tick as the state to send the others. Returns true if there was any, which means the node is waiting on a reply.
+    bool takeNewHeadData();
+
+    const AvatarState* getStateToSend() const { return _hasStateToSend ? &_stateToSend : NULL; }
+
+    // Fills avatarsToSend with the other nodes that are due to be sent in this reply, the most overdue first. Each
+    // call is a new reply.
+    void chooseAvatarsToSend(Node* ownNode, std::vector<Node*>& avatarsToSend);
+
+    // writes the start of a new bulk avatar packet to this node after its header, returns the bytes written
+    int startPacket(unsigned char* destination);
+
+    // Writes the node ID and state to send of one of the chosen avatars, as the changes since a state this node has
+    // acked if there's one to go on. Returns the bytes written.
+    int packAvatar(Node* avatarNode, unsigned char* destination);
+
+    // call for the avatar just packed if it made it into the packet
+    void markAvatarSent(Node* avatarNode);
+
+    // the states in the packet acked can be baselines now
+    void processAck(unsigned char* packetData, int numBytes);
+
+private:
+    class DueAvatar {
+    public:
+        Node* node;
+        float overdueRatio; // replies since it was last sent, over how many it's meant to wait
+        float distance;
+    };
+
+    // what we've sent this node of one of the other avatars
+    class AvatarSendState {
+    public:
+        AvatarSendState();
+
+        int lastReplySent; // -1 if it hasn't been sent yet
+        AvatarStateHistory sentStates;
+        uint16_t nextStateSequence;
+        bool hasAckedState;
+        uint16_t ackedStateSequence;
+    };
+
+    class SentAvatarState {
+    public:
+        uint16_t nodeID;
+        uint16_t stateSequence;
+    };
+
+    class SentPacket {
+    public:
+        uint16_t sequence;
+        std::vector<SentAvatarState> avatarStates;
+    };
+
+    static const int SENT_PACKET_HISTORY = 64; // the packets we remember what was in, for when they're acked
+
+    static bool isMoreOverdue(const DueAvatar& avatarA, const DueAvatar& avatarB);
+
+    void updateViewFrustum();
+    void forgetLeftAvatars(); // drops what we've sent of the avatars whose nodes are gone
+    int sendPeriodFor(const glm::vec3& avatarPosition, float distance) const;
+
+    bool _hasNewHeadData;
+    AvatarState _stateToSend;
+    bool _hasStateToSend; // false until there's been head data that was whole
+
+    ViewFrustum _viewFrustum;
+    bool _hasViewFrustum; // not every agent sends camera details, the ones that don't see everything
+    int _numReplies;
+    std::map<uint16_t, AvatarSendState> _avatarSendStates; // by node ID
+    std::vector<DueAvatar> _dueAvatars;
+
+    SentPacket _sentPackets[SENT_PACKET_HISTORY];
+    uint16_t _nextPacketSequence;
+    AvatarState _packedState; // the state of the avatar last packed, as this node will have it
+};
+
+#endif /* defined(__hifi__AvatarMixerNodeData__) */
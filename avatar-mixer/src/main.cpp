@@ -6,10 +6,12 @@
 //  Copyright (c) 2013 High Fidelity, Inc. All rights reserved
 //
 //  The avatar mixer receives head, hand and positional data from all connected
-//  nodes, and broadcasts that data back to them, every BROADCAST_INTERVAL ms.
+//  nodes, and every tick answers each of them that sent some with the data of the
+//  other avatars, the ones near it and in its view more often than those far away.
 //
 //
 
+#include <algorithm>
 #include <iostream>
 #include <math.h>
 #include <string.h>
@@ -31,24 +33,250 @@
 #include <NodeTypes.h>
 #include <StdDev.h>
 #include <UDPSocket.h>
+#include <Reactor.h>
+#include <ThreadPool.h>
 
-#include "AvatarData.h"
+#include "AvatarMixerNodeData.h"
 
 const int AVATAR_LISTEN_PORT = 55444;
 
-unsigned char *addNodeToBroadcastPacket(unsigned char *currentPosition, Node *nodeToAdd) {
-    currentPosition += packNodeId(currentPosition, nodeToAdd->getNodeID());
+// how often everyone waiting on one is sent a reply, about as often as agents send their head data
+const uint64_t AVATAR_BROADCAST_INTERVAL_USECS = 1000000 / 60;
 
-    AvatarData *nodeData = (AvatarData *)nodeToAdd->getLinkedData();
-    currentPosition += nodeData->getBroadcastData(currentPosition);
+// the most packets of avatars a reply can take, the avatars that don't fit wait for the next reply
+const int MAX_PACKETS_PER_REPLY = 8;
+
+// what each send worker needs of its own to put together the replies it's given
+class SendWorkerScratch {
+public:
+    SendWorkerScratch(UDPSocket* socket) :
+        numHeaderBytes(populateTypeAndVersion(broadcastPacket, PACKET_TYPE_BULK_AVATAR_DATA)),
+        sendBatch(socket) {
+    }
     
-    return currentPosition;
+    unsigned char broadcastPacket[MAX_PACKET_SIZE];
+    int numHeaderBytes;
+    unsigned char avatarBytes[sizeof(uint16_t) + MAX_AVATAR_BROADCAST_BYTES + 6]; // a node ID and a packed state
+    std::vector<Node*> avatarsToSend;
+    AvatarState sentState;
+    UDPSendBatch sendBatch;
+};
+
+int numSendThreads = ThreadPool::getNumberOfCores();
+ThreadPool* sendWorkers = NULL;
+std::vector<SendWorkerScratch*> sendWorkerScratch;
+
+// the injectors that asked for the avatars since the last tick, each gets one reply
+std::vector<sockaddr_in> injectorAddresses;
+
+// writes the packet sequence number, which is always 0 for things that don't ack (injectors)
+void startBulkAvatarPacket(unsigned char* destination, AvatarMixerNodeData* receiverData) {
+    if (receiverData) {
+        receiverData->startPacket(destination);
+    } else {
+        uint16_t noSequence = 0;
+        memcpy(destination, &noSequence, sizeof(noSequence));
+    }
+}
+
+// for things that don't ack, so always the whole state
+int packWholeAvatar(Node* avatarNode, unsigned char* destination, AvatarState& sentState) {
+    const AvatarState* stateToSend = ((AvatarMixerNodeData*) avatarNode->getLinkedData())->getStateToSend();
+    
+    unsigned char* destinationStart = destination;
+    destination += packNodeId(destination, avatarNode->getNodeID());
+    destination += packAvatarState(*stateToSend, 0, NULL, 0, destination, sentState);
+    return destination - destinationStart;
 }
 
 void attachAvatarDataToNode(Node* newNode) {
     if (newNode->getLinkedData() == NULL) {
-        newNode->setLinkedData(new AvatarData(newNode));
+        newNode->setLinkedData(new AvatarMixerNodeData(newNode));
+    }
+}
+
+// Queues up a reply to whoever's at receiverAddress with the other avatars, over as many packets as it takes. An
+// agent is only sent the avatars that are due for it, receiverNode is NULL for anything else (injectors) and they
+// get them all.
+void sendAvatarsToNode(sockaddr* receiverAddress, Node* receiverNode, SendWorkerScratch* scratch) {
+    NodeList* nodeList = NodeList::getInstance();
+    
+    std::vector<Node*>& avatarsToSend = scratch->avatarsToSend;
+    unsigned char* broadcastPacket = scratch->broadcastPacket;
+    
+    // each packet starts with its sequence number, then the avatars
+    unsigned char* avatarsStart = broadcastPacket + scratch->numHeaderBytes + sizeof(uint16_t);
+    
+    AvatarMixerNodeData* receiverData = receiverNode ? (AvatarMixerNodeData*) receiverNode->getLinkedData() : NULL;
+    if (receiverData) {
+        receiverData->chooseAvatarsToSend(receiverNode, avatarsToSend);
+    } else {
+        avatarsToSend.clear();
+        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+            if (node->getLinkedData() && ((AvatarMixerNodeData*) node->getLinkedData())->getStateToSend()
+                && !socketMatch(receiverAddress, node->getActiveSocket())) {
+                avatarsToSend.push_back(&*node);
+            }
+        }
+    }
+    
+    startBulkAvatarPacket(broadcastPacket + scratch->numHeaderBytes, receiverData);
+    unsigned char* currentBufferPosition = avatarsStart;
+    int numPacketsQueued = 0;
+    
+    for (int i = 0; i < avatarsToSend.size(); i++) {
+        Node* avatarNode = avatarsToSend[i];
+        int numAvatarBytes = receiverData
+            ? receiverData->packAvatar(avatarNode, scratch->avatarBytes)
+            : packWholeAvatar(avatarNode, scratch->avatarBytes, scratch->sentState);
+        if ((avatarsStart - broadcastPacket) + numAvatarBytes > MAX_PACKET_SIZE) {
+            // this one won't fit in any packet
+            continue;
+        }
+        
+        if (currentBufferPosition + numAvatarBytes > broadcastPacket + MAX_PACKET_SIZE) {
+            scratch->sendBatch.queue(receiverAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
+            currentBufferPosition = avatarsStart;
+            
+            if (++numPacketsQueued == MAX_PACKETS_PER_REPLY && receiverData) {
+                break;
+            }
+            
+            startBulkAvatarPacket(broadcastPacket + scratch->numHeaderBytes, receiverData);
+        }
+        
+        memcpy(currentBufferPosition, scratch->avatarBytes, numAvatarBytes);
+        currentBufferPosition += numAvatarBytes;
+        
+        if (receiverData) {
+            receiverData->markAvatarSent(avatarNode);
+        }
+    }
+    
+    // always reply, even if there's nothing to send, so the agent knows we're still here
+    if (currentBufferPosition > avatarsStart || numPacketsQueued == 0) {
+        scratch->sendBatch.queue(receiverAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
+    }
+}
+
+// ThreadPoolJob that replies to a single agent. Each reply only reads the states to send of the other avatars, and
+// only writes to its own node's data.
+void sendAvatarsForJob(void* jobData, int workerIndex) {
+    Node* node = (Node*) jobData;
+    sendAvatarsToNode(node->getPublicSocket(), node, sendWorkerScratch[workerIndex]);
+}
+
+// Reactor handler for the node socket, takes in everything that arrived together. Replies wait for the next tick.
+void processAvatarMixerPackets(void* extraData) {
+    NodeList* nodeList = NodeList::getInstance();
+    NodeListReadScope readScope(nodeList);
+    
+    static UDPReceiveBatch* receiveBatch = new UDPReceiveBatch(nodeList->getNodeSocket());
+    static UDPSendBatch* sendBatch = new UDPSendBatch(nodeList->getNodeSocket());
+    
+    uint16_t nodeID = 0;
+    Node* avatarNode = NULL;
+    
+    int packetsReceived = receiveBatch->receive();
+    for (int packetIndex = 0; packetIndex < packetsReceived; packetIndex++) {
+        unsigned char* packetData = receiveBatch->getPacket(packetIndex);
+        ssize_t receivedBytes = receiveBatch->getByteLength(packetIndex);
+        sockaddr* nodeAddress = receiveBatch->getSenderAddress(packetIndex);
+        
+        if (!packetVersionMatch(packetData)) {
+            continue;
+        }
+        
+        switch (packetData[0]) {
+            case PACKET_TYPE_HEAD_DATA:
+                // grab the node ID from the packet
+                unpackNodeId(packetData + numBytesForPacketHeader(packetData), &nodeID);
+                
+                // add or update the node in our list
+                avatarNode = nodeList->addOrUpdateNode(nodeAddress, nodeAddress, NODE_TYPE_AGENT, nodeID);
+                
+                // parse positional data from an node, the newest of it goes out at the next tick
+                nodeList->updateNodeWithData(avatarNode, packetData, receivedBytes);
+                break;
+            case PACKET_TYPE_INJECT_AUDIO: {
+                bool isWaiting = false;
+                for (int i = 0; i < injectorAddresses.size() && !isWaiting; i++) {
+                    isWaiting = socketMatch(nodeAddress, (sockaddr*) &injectorAddresses[i]);
+                }
+                if (!isWaiting) {
+                    injectorAddresses.push_back(*(sockaddr_in*) nodeAddress);
+                }
+                break;
+            }
+            case PACKET_TYPE_BULK_AVATAR_DATA_ACK:
+                avatarNode = nodeList->nodeWithAddress(nodeAddress);
+                
+                if (avatarNode && avatarNode->getLinkedData()) {
+                    ((AvatarMixerNodeData*) avatarNode->getLinkedData())->processAck(packetData, receivedBytes);
+                }
+                break;
+            case PACKET_TYPE_AVATAR_VOXEL_URL:
+                // grab the node ID from the packet
+                unpackNodeId(packetData + numBytesForPacketHeader(packetData), &nodeID);
+                
+                // let everyone else know about the update
+                for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+                    if (node->getActiveSocket() && node->getNodeID() != nodeID) {
+                        sendBatch->queue(node->getActiveSocket(), packetData, receivedBytes);
+                    }
+                }
+                break;
+            case PACKET_TYPE_DOMAIN:
+                // ignore the DS packet, for now nodes are added only when they communicate directly with us
+                break;
+            default:
+                // hand this off to the NodeList
+                nodeList->processNodeData(nodeAddress, packetData, receivedBytes);
+                break;
+        }
     }
+    sendBatch->flush();
+}
+
+// Reactor timer, replies once to everyone that's sent head data since the last tick however many times they sent it
+void broadcastAvatars(void* extraData) {
+    NodeList* nodeList = NodeList::getInstance();
+    NodeListReadScope readScope(nodeList); // the send workers are covered by this too
+    
+    uint64_t tickStart = usecTimestampNow();
+    
+    static std::vector<void*> receivers;
+    receivers.clear();
+    
+    // every state to send is settled before the replies start reading them
+    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+        AvatarMixerNodeData* nodeData = (AvatarMixerNodeData*) node->getLinkedData();
+        
+        if (nodeData && nodeData->takeNewHeadData()) {
+            receivers.push_back(&*node);
+        }
+    }
+    
+    if (!receivers.empty()) {
+        sendWorkers->runJobs(sendAvatarsForJob, &receivers[0], receivers.size());
+    }
+    
+    for (int i = 0; i < injectorAddresses.size(); i++) {
+        sendAvatarsToNode((sockaddr*) &injectorAddresses[i], NULL, sendWorkerScratch[0]);
+    }
+    injectorAddresses.clear();
+    
+    for (int i = 0; i < sendWorkerScratch.size(); i++) {
+        sendWorkerScratch[i]->sendBatch.flush();
+    }
+    
+    if (usecTimestampNow() - tickStart > AVATAR_BROADCAST_INTERVAL_USECS) {
+        printf("Took too much time, the next tick will be late!\n");
+    }
+}
+
+void checkInWithDomainServer(void* extraData) {
+    NodeList::getInstance()->sendDomainServerCheckIn();
 }
 
 int main(int argc, const char* argv[]) {
@@ -64,80 +292,33 @@ int main(int argc, const char* argv[]) {
         sprintf(DOMAIN_IP,"%d.%d.%d.%d", (ip & 0xFF), ((ip >> 8) & 0xFF),((ip >> 16) & 0xFF), ((ip >> 24) & 0xFF));
     }
     
-    nodeList->linkedDataCreateCallback = attachAvatarDataToNode;
-    
-    nodeList->startSilentNodeRemovalThread();
-    
-    sockaddr *nodeAddress = new sockaddr;
-    unsigned char *packetData = new unsigned char[MAX_PACKET_SIZE];
-    ssize_t receivedBytes = 0;
+    const char* SEND_THREADS = "--sendThreads";
+    const char* sendThreads = getCmdOption(argc, argv, SEND_THREADS);
+    if (sendThreads) {
+        ::numSendThreads = std::max(1, atoi(sendThreads));
+    }
+    printf("numSendThreads=%d\n", ::numSendThreads);
     
-    unsigned char *broadcastPacket = new unsigned char[MAX_PACKET_SIZE];
-    int numHeaderBytes = populateTypeAndVersion(broadcastPacket, PACKET_TYPE_BULK_AVATAR_DATA);
+    // each worker sends the replies it put together at the end of each tick
+    ::sendWorkers = new ThreadPool(::numSendThreads);
+    for (int i = 0; i < ::numSendThreads; i++) {
+        ::sendWorkerScratch.push_back(new SendWorkerScratch(nodeList->getNodeSocket()));
+    }
     
-    unsigned char* currentBufferPosition = NULL;
+    nodeList->linkedDataCreateCallback = attachAvatarDataToNode;
     
-    uint16_t nodeID = 0;
-    Node* avatarNode = NULL;
+    nodeList->startSilentNodeRemovalThread();
     
-    timeval lastDomainServerCheckIn = {};
     // we only need to hear back about avatar nodes from the DS
     NodeList::getInstance()->setNodeTypesOfInterest(&NODE_TYPE_AGENT, 1);
     
-    while (true) {
-        
-        // send a check in packet to the domain server if DOMAIN_SERVER_CHECK_IN_USECS has elapsed
-        if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
-            gettimeofday(&lastDomainServerCheckIn, NULL);
-            NodeList::getInstance()->sendDomainServerCheckIn();
-        }
-        
-        if (nodeList->getNodeSocket()->receive(nodeAddress, packetData, &receivedBytes) &&
-            packetVersionMatch(packetData)) {
-            switch (packetData[0]) {
-                case PACKET_TYPE_HEAD_DATA:
-                    // grab the node ID from the packet
-                    unpackNodeId(packetData + 1, &nodeID);
-                    
-                    // add or update the node in our list
-                    avatarNode = nodeList->addOrUpdateNode(nodeAddress, nodeAddress, NODE_TYPE_AGENT, nodeID);
-                    
-                    // parse positional data from an node
-                    nodeList->updateNodeWithData(avatarNode, packetData, receivedBytes);
-                case PACKET_TYPE_INJECT_AUDIO:
-                    currentBufferPosition = broadcastPacket + numHeaderBytes;
-                    
-                    // send back a packet with other active node data to this node
-                    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-                        if (node->getLinkedData() && !socketMatch(nodeAddress, node->getActiveSocket())) {
-                            currentBufferPosition = addNodeToBroadcastPacket(currentBufferPosition, &*node);
-                        }
-                    }
-                    
-                    nodeList->getNodeSocket()->send(nodeAddress, broadcastPacket, currentBufferPosition - broadcastPacket);
-                    
-                    break;
-                case PACKET_TYPE_AVATAR_VOXEL_URL:
-                    // grab the node ID from the packet
-                    unpackNodeId(packetData + numBytesForPacketHeader(packetData), &nodeID);
-                    
-                    // let everyone else know about the update
-                    for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-                        if (node->getActiveSocket() && node->getNodeID() != nodeID) {
-                            nodeList->getNodeSocket()->send(node->getActiveSocket(), packetData, receivedBytes);
-                        }
-                    }
-                    break;
-                case PACKET_TYPE_DOMAIN:
-                    // ignore the DS packet, for now nodes are added only when they communicate directly with us
-                    break;
-                default:
-                    // hand this off to the NodeList
-                    nodeList->processNodeData(nodeAddress, packetData, receivedBytes);
-                    break;
-            }
-        }
-    }
+    Reactor reactor;
+    reactor.watchForRead(nodeList->getNodeSocket()->getHandle(), processAvatarMixerPackets, NULL);
+    reactor.addTimer(AVATAR_BROADCAST_INTERVAL_USECS, broadcastAvatars, NULL);
+    reactor.addTimer(DOMAIN_SERVER_CHECK_IN_USECS, checkInWithDomainServer, NULL);
+    
+    checkInWithDomainServer(NULL);
+    reactor.run();
     
     nodeList->stopSilentNodeRemovalThread();
     
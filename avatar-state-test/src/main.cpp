@@ -0,0 +1,359 @@
+//
+//  main.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Runs the avatar state stream (see AvatarStateStream.h) between a sender that does what the avatar mixer does for
+//  one agent and a receiver that does what an agent does, over a link that drops and reorders packets and acks.
+//  Every state the receiver reads has to be the one the sender meant it to have, and within a position step of the
+//  avatar's real state. Prints the bytes each avatar took, against sending the whole state, and exits with 1 if any
+//  state didn't match.
+//
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <AvatarData.h>
+#include <AvatarStateStream.h>
+#include <Node.h>
+#include <NodeList.h>
+#include <SharedUtil.h>
+
+// the most a position can be off by, the offsets from a baseline are in 1/256ths of a meter, rounded towards zero
+const float POSITION_STEP = 1.0f / 256.0f;
+
+// what the mixer remembers of the packets it sent, for when they're acked
+const int SENT_PACKET_HISTORY = 64;
+
+const int DEFAULT_AVATARS = 20;
+const int DEFAULT_TICKS = 1200;
+
+class InFlightPacket {
+public:
+    int arrivalTick;
+    std::vector<unsigned char> data;
+};
+
+// packets on their way, each arriving after a random delay, so ones sent later can get there first
+class Link {
+public:
+    Link(int dropPercent, int maxDelayTicks) : _dropPercent(dropPercent), _maxDelayTicks(maxDelayTicks) {}
+
+    void send(int tick, const unsigned char* data, int numBytes) {
+        if (randIntInRange(0, 100) < _dropPercent) {
+            return;
+        }
+        InFlightPacket packet;
+        packet.arrivalTick = tick + (_maxDelayTicks ? randIntInRange(0, _maxDelayTicks + 1) : 0);
+        packet.data.assign(data, data + numBytes);
+        _inFlight.push_back(packet);
+    }
+
+    // takes the packets that have arrived by tick, in the order they arrive
+    void receive(int tick, std::vector<std::vector<unsigned char> >& arrived) {
+        arrived.clear();
+        int numStillInFlight = 0;
+        for (int i = 0; i < _inFlight.size(); i++) {
+            if (_inFlight[i].arrivalTick <= tick) {
+                arrived.push_back(_inFlight[i].data);
+            } else {
+                _inFlight[numStillInFlight++] = _inFlight[i];
+            }
+        }
+        _inFlight.resize(numStillInFlight);
+    }
+
+private:
+    int _dropPercent;
+    int _maxDelayTicks;
+    std::vector<InFlightPacket> _inFlight;
+};
+
+// the mixer's end for one agent, like AvatarMixerNodeData
+class Sender {
+public:
+    Sender(int numAvatars) :
+        _avatars(numAvatars),
+        _nextPacketSequence(0) {
+    }
+
+    int startPacket(unsigned char* destination) {
+        uint16_t sequence = _nextPacketSequence++;
+        SentPacket& sentPacket = _sentPackets[sequence % SENT_PACKET_HISTORY];
+        sentPacket.sequence = sequence;
+        sentPacket.avatarStates.clear();
+
+        memcpy(destination, &sequence, sizeof(sequence));
+        return sizeof(sequence);
+    }
+
+    int packAvatar(uint16_t nodeID, const AvatarState& state, unsigned char* destination) {
+        SendState& sendState = _avatars[nodeID];
+        const AvatarState* baseline = NULL;
+        if (sendState.hasAckedState) {
+            baseline = sendState.sentStates.find(sendState.ackedStateSequence);
+        }
+
+        unsigned char* destinationStart = destination;
+        destination += packNodeId(destination, nodeID);
+        destination += packAvatarState(state, sendState.nextStateSequence, baseline, sendState.ackedStateSequence,
+                                       destination, _packedState);
+        return destination - destinationStart;
+    }
+
+    // the state that was just packed, as the receiver will have it
+    void markAvatarSent(uint16_t nodeID) {
+        SendState& sendState = _avatars[nodeID];
+
+        SentAvatarState sentAvatarState = { nodeID, sendState.nextStateSequence };
+        SentPacket& sentPacket = _sentPackets[(uint16_t) (_nextPacketSequence - 1) % SENT_PACKET_HISTORY];
+        sentPacket.avatarStates.push_back(sentAvatarState);
+
+        sendState.sentStates.add(sendState.nextStateSequence, _packedState);
+        sendState.allSentStates.push_back(_packedState);
+        sendState.nextStateSequence++;
+    }
+
+    void processAck(uint16_t sequence) {
+        SentPacket& sentPacket = _sentPackets[sequence % SENT_PACKET_HISTORY];
+        if (sentPacket.sequence != sequence) {
+            return;
+        }
+        for (int i = 0; i < sentPacket.avatarStates.size(); i++) {
+            SendState& sendState = _avatars[sentPacket.avatarStates[i].nodeID];
+            uint16_t stateSequence = sentPacket.avatarStates[i].stateSequence;
+            if (sendState.hasAckedState && (int16_t) (stateSequence - sendState.ackedStateSequence) <= 0) {
+                continue;
+            }
+            if (sendState.sentStates.find(stateSequence)) {
+                sendState.hasAckedState = true;
+                sendState.ackedStateSequence = stateSequence;
+            }
+        }
+        sentPacket.avatarStates.clear();
+    }
+
+    // what the receiver should have for a state, by its sequence number
+    const AvatarState& sentState(uint16_t nodeID, uint16_t sequence) const {
+        return _avatars[nodeID].allSentStates[sequence];
+    }
+
+private:
+    class SendState {
+    public:
+        SendState() : nextStateSequence(0), hasAckedState(false), ackedStateSequence(0) {}
+
+        AvatarStateHistory sentStates;
+        std::vector<AvatarState> allSentStates;
+        uint16_t nextStateSequence;
+        bool hasAckedState;
+        uint16_t ackedStateSequence;
+    };
+
+    class SentAvatarState {
+    public:
+        uint16_t nodeID;
+        uint16_t stateSequence;
+    };
+
+    class SentPacket {
+    public:
+        uint16_t sequence;
+        std::vector<SentAvatarState> avatarStates;
+    };
+
+    std::vector<SendState> _avatars;
+    SentPacket _sentPackets[SENT_PACKET_HISTORY];
+    uint16_t _nextPacketSequence;
+    AvatarState _packedState;
+};
+
+class RunResult {
+public:
+    RunResult() : statesSent(0), bytesSent(0), fullBytes(0), statesRead(0), statesWithoutBaseline(0), mismatches(0) {}
+
+    long statesSent;
+    long bytesSent; // the node IDs and packed states
+    long fullBytes; // what the same states would have taken with the whole state every time
+    long statesRead;
+    long statesWithoutBaseline;
+    long mismatches;
+};
+
+// checks a state that was read against what the sender meant and what the avatar really was
+bool stateMatches(const AvatarState& readState, const AvatarState& sentState, const AvatarState& realState) {
+    if (readState.getNumBytes() != sentState.getNumBytes() ||
+        memcmp(readState.getBroadcastData(), sentState.getBroadcastData(), readState.getNumBytes()) != 0) {
+        return false;
+    }
+
+    // only the position is allowed to differ from the real thing, and only by less than a step
+    glm::vec3 readPosition, realPosition;
+    memcpy(&readPosition, readState.getBroadcastData(), sizeof(readPosition));
+    memcpy(&realPosition, realState.getBroadcastData(), sizeof(realPosition));
+    glm::vec3 error = readPosition - realPosition;
+    return readState.getNumBytes() == realState.getNumBytes() &&
+        memcmp(readState.getBroadcastData() + sizeof(readPosition), realState.getBroadcastData() + sizeof(realPosition),
+               readState.getNumBytes() - sizeof(readPosition)) == 0 &&
+        fabsf(error.x) < POSITION_STEP && fabsf(error.y) < POSITION_STEP && fabsf(error.z) < POSITION_STEP;
+}
+
+RunResult runStream(int numAvatars, int numTicks, int movingEvery, int dropPercent, int maxDelayTicks) {
+    srand(1);
+    RunResult result;
+
+    std::vector<AvatarData*> avatars(numAvatars);
+    int side = (int) ceilf(sqrtf(numAvatars));
+    for (int i = 0; i < numAvatars; i++) {
+        avatars[i] = new AvatarData();
+        avatars[i]->setPosition(glm::vec3((i % side) * 2.0f, 0.0f, (i / side) * 2.0f));
+    }
+
+    Sender sender(numAvatars);
+    std::vector<std::vector<AvatarState> > realStates(numAvatars);
+    std::vector<AvatarStateHistory> receivedStates(numAvatars);
+    Link packetLink(dropPercent, maxDelayTicks);
+    Link ackLink(dropPercent, maxDelayTicks);
+    std::vector<std::vector<unsigned char> > arrived;
+
+    unsigned char broadcastData[MAX_AVATAR_BROADCAST_BYTES];
+    unsigned char packet[MAX_PACKET_SIZE];
+    unsigned char avatarBytes[sizeof(uint16_t) + MAX_AVATAR_BROADCAST_BYTES + 6];
+
+    for (int tick = 0; tick < numTicks; tick++) {
+        // some of the avatars move and turn, the odd one waves a hand
+        for (int i = 0; i < numAvatars; i++) {
+            if (movingEvery && i % movingEvery == 0) {
+                avatars[i]->setPosition(avatars[i]->getPosition() + glm::vec3(0.031f, 0.0f, -0.017f));
+                avatars[i]->setBodyYaw(avatars[i]->getBodyYaw() + 1.5f);
+            }
+            if (randIntInRange(0, 100) == 0) {
+                avatars[i]->setHandState(avatars[i]->getHandState() ? 0 : 1);
+            }
+        }
+
+        // the sender packs every avatar, starting a new packet when one is full
+        unsigned char* packetPosition = packet + sender.startPacket(packet);
+        for (int i = 0; i < numAvatars; i++) {
+            AvatarState state;
+            state.setBroadcastData(broadcastData, avatars[i]->getBroadcastData(broadcastData));
+            realStates[i].push_back(state);
+
+            int avatarLength = sender.packAvatar(i, state, avatarBytes);
+            if (packetPosition + avatarLength > packet + MAX_PACKET_SIZE) {
+                packetLink.send(tick, packet, packetPosition - packet);
+                packetPosition = packet + sender.startPacket(packet);
+            }
+            memcpy(packetPosition, avatarBytes, avatarLength);
+            packetPosition += avatarLength;
+            sender.markAvatarSent(i);
+
+            result.statesSent++;
+            result.bytesSent += avatarLength;
+            result.fullBytes += sizeof(uint16_t) + state.getNumBytes();
+        }
+        packetLink.send(tick, packet, packetPosition - packet);
+
+        // the receiver reads what's arrived, and acks each packet it could read all of
+        packetLink.receive(tick, arrived);
+        for (int p = 0; p < arrived.size(); p++) {
+            const unsigned char* source = &arrived[p][0];
+            const unsigned char* sourceEnd = source + arrived[p].size();
+            uint16_t packetSequence;
+            memcpy(&packetSequence, source, sizeof(packetSequence));
+            source += sizeof(packetSequence);
+
+            bool readAll = true;
+            while (source < sourceEnd) {
+                uint16_t nodeID;
+                source += unpackNodeId((unsigned char*) source, &nodeID);
+
+                uint16_t stateSequence;
+                AvatarState state;
+                bool hasBaseline;
+                int stateLength = unpackAvatarState(source, sourceEnd - source, receivedStates[nodeID],
+                                                    stateSequence, state, hasBaseline);
+                if (stateLength == 0) {
+                    printf("packet %d can't be read past avatar %d\n", packetSequence, nodeID);
+                    result.mismatches++;
+                    readAll = false;
+                    break;
+                }
+                source += stateLength;
+
+                if (!hasBaseline) {
+                    result.statesWithoutBaseline++;
+                    readAll = false;
+                    continue;
+                }
+                receivedStates[nodeID].add(stateSequence, state);
+                result.statesRead++;
+
+                if (!stateMatches(state, sender.sentState(nodeID, stateSequence), realStates[nodeID][stateSequence])) {
+                    printf("avatar %d state %d doesn't match\n", nodeID, stateSequence);
+                    result.mismatches++;
+                }
+            }
+            if (readAll) {
+                ackLink.send(tick, (unsigned char*) &packetSequence, sizeof(packetSequence));
+            }
+        }
+
+        ackLink.receive(tick, arrived);
+        for (int a = 0; a < arrived.size(); a++) {
+            uint16_t ackedSequence;
+            memcpy(&ackedSequence, &arrived[a][0], sizeof(ackedSequence));
+            sender.processAck(ackedSequence);
+        }
+    }
+
+    for (int i = 0; i < numAvatars; i++) {
+        delete avatars[i];
+    }
+    return result;
+}
+
+int main(int argc, const char* argv[]) {
+    const char* AVATARS = "--avatars";
+    const char* TICKS = "--ticks";
+
+    const char* avatarsOption = getCmdOption(argc, argv, AVATARS);
+    const char* ticksOption = getCmdOption(argc, argv, TICKS);
+    int numAvatars = avatarsOption ? atoi(avatarsOption) : DEFAULT_AVATARS;
+    int numTicks = ticksOption ? atoi(ticksOption) : DEFAULT_TICKS;
+
+    // sequence numbers are 16 bits, and the sender keeps every state it sent to check against
+    if (numAvatars < 1 || numTicks < 1 || numTicks > 65536) {
+        printf("usage: avatar-state-test [%s <count>] [%s <1 to 65536>]\n", AVATARS, TICKS);
+        return 1;
+    }
+
+    const int NUM_MOVEMENTS = 3;
+    const int MOVING_EVERY[NUM_MOVEMENTS] = { 0, 2, 1 };
+    const char* MOVEMENT_NAMES[NUM_MOVEMENTS] = { "still", "half moving", "all moving" };
+
+    const int NUM_LINKS = 3;
+    const int DROP_PERCENT[NUM_LINKS] = { 0, 5, 20 };
+    const int MAX_DELAY_TICKS[NUM_LINKS] = { 0, 3, 6 };
+
+    printf("%d avatars, %d ticks\n", numAvatars, numTicks);
+    printf("%-12s %5s %6s %10s %10s %12s %10s\n", "avatars", "drop%", "delay", "bytes/avtr", "full/avtr",
+           "no baseline", "mismatches");
+
+    long totalMismatches = 0;
+    for (int m = 0; m < NUM_MOVEMENTS; m++) {
+        for (int l = 0; l < NUM_LINKS; l++) {
+            RunResult result = runStream(numAvatars, numTicks, MOVING_EVERY[m], DROP_PERCENT[l], MAX_DELAY_TICKS[l]);
+            printf("%-12s %5d %6d %10.1f %10.1f %12ld %10ld\n", MOVEMENT_NAMES[m], DROP_PERCENT[l], MAX_DELAY_TICKS[l],
+                   (float) result.bytesSent / result.statesSent, (float) result.fullBytes / result.statesSent,
+                   result.statesWithoutBaseline, result.mismatches);
+            totalMismatches += result.mismatches;
+        }
+    }
+
+    return totalMismatches > 0 ? 1 : 0;
+}
@@ -89,6 +89,8 @@ int main(int argc, const char * argv[])
             (packetData[0] == PACKET_TYPE_DOMAIN_REPORT_FOR_DUTY || packetData[0] == PACKET_TYPE_DOMAIN_LIST_REQUEST) &&
             packetVersionMatch(packetData)) {
             // this is an RFD or domain list request packet, and there is a version match
+            NodeListReadScope readScope(nodeList);
+            
             std::map<char, Node *> newestSoloNodes;
             
             int numBytesSenderHeader = numBytesForPacketHeader(packetData);
@@ -51,11 +51,13 @@ void *receiveNodeData(void *args) {
     while (!::stopReceiveNodeDataThread) {
         if (nodeList->getNodeSocket()->receive(&senderAddress, incomingPacket, &bytesReceived) &&
             packetVersionMatch(incomingPacket)) {
+            NodeListReadScope readScope(nodeList);
+            
             switch (incomingPacket[0]) {
                 case PACKET_TYPE_BULK_AVATAR_DATA:
                     // this is the positional data for other nodes
-                    // pass that off to the nodeList processBulkNodeData method
-                    nodeList->processBulkNodeData(&senderAddress, incomingPacket, bytesReceived);
+                    // hand each avatar in it to its node
+                    processBulkAvatarData(&senderAddress, incomingPacket, bytesReceived);
                     
                     break;
                 default:
@@ -146,43 +148,49 @@ int main(int argc, const char* argv[]) {
         // update the thisSend timeval to the current time
         gettimeofday(&thisSend, NULL);
         
-        // find the current avatar mixer
-        Node* avatarMixer = nodeList->soloNodeOfType(NODE_TYPE_AVATAR_MIXER);
-        
-        // make sure we actually have an avatar mixer with an active socket
-        if (nodeList->getOwnerID() != UNKNOWN_NODE_ID && avatarMixer && avatarMixer->getActiveSocket() != NULL) {
-            unsigned char* packetPosition = broadcastPacket + numHeaderBytes;
-            packetPosition += packNodeId(packetPosition, nodeList->getOwnerID());
+        // the nodes found here can't be deleted until we're done with them, the scope is closed before sleeping
+        {
+            NodeListReadScope readScope(nodeList);
             
-            // use the getBroadcastData method in the AvatarData class to populate the broadcastPacket buffer
-            packetPosition += eve.getBroadcastData(packetPosition);
+            // find the current avatar mixer
+            Node* avatarMixer = nodeList->soloNodeOfType(NODE_TYPE_AVATAR_MIXER);
             
-            // use the UDPSocket instance attached to our node list to send avatar data to mixer
-            nodeList->getNodeSocket()->send(avatarMixer->getActiveSocket(), broadcastPacket, packetPosition - broadcastPacket);
-        }
-        
-        if (!eveAudioInjector.isInjectingAudio()) {
-            // enumerate the other nodes to decide if one is close enough that eve should talk
-            for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-                AvatarData* avatarData = (AvatarData*) node->getLinkedData();
+            // make sure we actually have an avatar mixer with an active socket
+            if (nodeList->getOwnerID() != UNKNOWN_NODE_ID && avatarMixer && avatarMixer->getActiveSocket() != NULL) {
+                unsigned char* packetPosition = broadcastPacket + numHeaderBytes;
+                packetPosition += packNodeId(packetPosition, nodeList->getOwnerID());
                 
-                if (avatarData) {
-                    glm::vec3 tempVector = eve.getPosition() - avatarData->getPosition();
-                    float squareDistance = glm::dot(tempVector, tempVector);
+                // use the getBroadcastData method in the AvatarData class to populate the broadcastPacket buffer
+                packetPosition += eve.getBroadcastData(packetPosition);
+                
+                // use the UDPSocket instance attached to our node list to send avatar data to mixer
+                nodeList->getNodeSocket()->send(avatarMixer->getActiveSocket(), broadcastPacket,
+                                                packetPosition - broadcastPacket);
+            }
+            
+            if (!eveAudioInjector.isInjectingAudio()) {
+                // enumerate the other nodes to decide if one is close enough that eve should talk
+                for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+                    AvatarData* avatarData = (AvatarData*) node->getLinkedData();
                     
-                    if (squareDistance <= AUDIO_INJECT_PROXIMITY) {
-                        // look for an audio mixer in our node list
-                        Node* audioMixer = NodeList::getInstance()->soloNodeOfType(NODE_TYPE_AUDIO_MIXER);
+                    if (avatarData) {
+                        glm::vec3 tempVector = eve.getPosition() - avatarData->getPosition();
+                        float squareDistance = glm::dot(tempVector, tempVector);
                         
-                        if (audioMixer) {
-                            // update the destination socket for the AIM, in case the mixer has changed
-                            AudioInjectionManager::setDestinationSocket(*audioMixer->getPublicSocket());
+                        if (squareDistance <= AUDIO_INJECT_PROXIMITY) {
+                            // look for an audio mixer in our node list
+                            Node* audioMixer = NodeList::getInstance()->soloNodeOfType(NODE_TYPE_AUDIO_MIXER);
                             
-                            // we have an active audio mixer we can send data to
-                            AudioInjectionManager::threadInjector(&eveAudioInjector);
+                            if (audioMixer) {
+                                // update the destination socket for the AIM, in case the mixer has changed
+                                AudioInjectionManager::setDestinationSocket(*audioMixer->getPublicSocket());
+                                
+                                // we have an active audio mixer we can send data to
+                                AudioInjectionManager::threadInjector(&eveAudioInjector);
+                            }
                         }
-                    }
-                }            
+                    }            
+                }
             }
         }
         
@@ -171,10 +171,12 @@ int main(int argc, char* argv[]) {
                 
                 while (nodeList->getNodeSocket()->receive(&senderAddress, incomingPacket, &bytesReceived) &&
                        packetVersionMatch(incomingPacket)) {
+                    NodeListReadScope readScope(nodeList);
+                    
                     switch (incomingPacket[0]) {
                         case PACKET_TYPE_BULK_AVATAR_DATA:                  // this is the positional data for other nodes
-                            // pass that off to the nodeList processBulkNodeData method
-                            nodeList->processBulkNodeData(&senderAddress, incomingPacket, bytesReceived);
+                            // hand each avatar in it to its node
+                            processBulkAvatarData(&senderAddress, incomingPacket, bytesReceived);
                             break;
                         default:
                             // have the nodeList handle list of nodes from DS, replies from other nodes, etc.
@@ -184,6 +186,8 @@ int main(int argc, char* argv[]) {
                 }
                 
                 if (::triggerDistance) {
+                    NodeListReadScope readScope(nodeList);
+                    
                     if (!injector.isInjectingAudio()) {
                         // enumerate the other nodes to decide if one is close enough that we should inject
                         for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
@@ -223,6 +223,13 @@ Application::Application(int& argc, char** argv, timeval &startup_time) :
         NodeList::getInstance()->getNodeSocket()->setBlocking(false);
     }
     
+    // our audio is IMA ADPCM unless we're asked for raw samples
+    #ifndef _WIN32
+    if (cmdOptionExists(argc, constArgv, "--pcmAudio")) {
+        _audio.setCodec(AUDIO_CODEC_PCM);
+    }
+    #endif
+    
     const char* domainIP = getCmdOption(argc, constArgv, "--domain");
     if (domainIP) {
         strcpy(DOMAIN_IP, domainIP);
@@ -364,6 +371,8 @@ void Application::initializeGL() {
 
 void Application::paintGL() {
     PerfStat("display");
+    // nodes (and the avatars they link to) aren't deleted while we draw them
+    NodeListReadScope readScope(NodeList::getInstance());
 
     glEnable(GL_LINE_SMOOTH);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -966,6 +975,7 @@ static glm::vec3 getFaceVector(BoxFace face) {
 }
 
 void Application::idle() {
+    NodeListReadScope readScope(NodeList::getInstance());
     
     timeval check;
     gettimeofday(&check, NULL);
@@ -3188,6 +3198,7 @@ void* Application::networkReceive(void* args) {
         }
     
         if (NodeList::getInstance()->getNodeSocket()->receive(&senderAddress, app->_incomingPacket, &bytesReceived)) {
+            NodeListReadScope readScope(NodeList::getInstance());
             app->_packetCount++;
             app->_bytesCount += bytesReceived;
             
@@ -3200,6 +3211,7 @@ void* Application::networkReceive(void* args) {
                         
                         break;
                     case PACKET_TYPE_MIXED_AUDIO:
+                    case PACKET_TYPE_SILENT_AUDIO_FRAME:
                         app->_audio.addReceivedAudioToBuffer(app->_incomingPacket, bytesReceived);
                         break;
                     case PACKET_TYPE_VOXEL_DATA:
@@ -3212,9 +3224,7 @@ void* Application::networkReceive(void* args) {
                         app->_environment.parseData(&senderAddress, app->_incomingPacket, bytesReceived);
                         break;
                     case PACKET_TYPE_BULK_AVATAR_DATA:
-                        NodeList::getInstance()->processBulkNodeData(&senderAddress,
-                                                                     app->_incomingPacket,
-                                                                     bytesReceived);
+                        processBulkAvatarData(&senderAddress, app->_incomingPacket, bytesReceived);
                         getInstance()->_bandwidthMeter.inputStream(BandwidthMeter::AVATARS).updateValue(bytesReceived);
                         break;
                     case PACKET_TYPE_AVATAR_VOXEL_URL:
@@ -48,6 +48,10 @@ static const float AUDIO_CALLBACK_MSECS = (float)BUFFER_LENGTH_SAMPLES_PER_CHANN
 
 static const int NODE_LOOPBACK_MODIFIER = 307;
 
+// once the mic has been this quiet for long enough we only send the mixer silent frames, until it picks up again
+static const float SILENT_INPUT_LOUDNESS = 20.f;                                // Average absolute sample
+static const int   QUIET_FRAMES_BEFORE_SILENCE = 20;                            // About a quarter of a second
+
 // Speex preprocessor and echo canceller adaption
 static const int   AEC_N_CHANNELS_MIC = 1;                                      // Number of microphone channels
 static const int   AEC_N_CHANNELS_PLAY = 2;                                     // Number of speaker channels
@@ -80,6 +84,7 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
     addProceduralSounds(inputLeft, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
     
     if (nodeList && inputLeft) {
+        NodeListReadScope readScope(nodeList);
         
         //  Measure the loudness of the signal from the microphone and store in audio object
         float loudness = 0;
@@ -90,6 +95,9 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
         loudness /= BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
         _lastInputLoudness = loudness;
         
+        _numQuietInputFrames = (loudness < SILENT_INPUT_LOUDNESS) ? _numQuietInputFrames + 1 : 0;
+        bool isInputSilent = _numQuietInputFrames > QUIET_FRAMES_BEFORE_SILENCE;
+        
         // add input (@microphone) data to the scope
         _scope->addSamples(0, inputLeft, BUFFER_LENGTH_SAMPLES_PER_CHANNEL);
 
@@ -110,7 +118,14 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
                 ? PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO
                 : PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO;
             
-            unsigned char* currentPacketPtr = dataPacket + populateTypeAndVersion(dataPacket, packetType);
+            // a silent frame still has our position, the mixer needs it to mix everyone else for us
+            if (isInputSilent) {
+                packetType = PACKET_TYPE_SILENT_AUDIO_FRAME;
+            }
+            
+            // the version says which codec our audio is in, the mixer answers in the same one
+            unsigned char* currentPacketPtr = dataPacket
+                + populateTypeAndVersion(dataPacket, packetType, _encoder.getCodec());
             
             // memcpy the three float positions
             memcpy(currentPacketPtr, &headPosition, sizeof(headPosition));
@@ -120,14 +135,16 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
             memcpy(currentPacketPtr, &headOrientation, sizeof(headOrientation));
             currentPacketPtr += sizeof(headOrientation);
             
-            // copy the audio data to the last BUFFER_LENGTH_BYTES bytes of the data packet
-            memcpy(currentPacketPtr, inputLeft, BUFFER_LENGTH_BYTES_PER_CHANNEL);
+            // encode the audio data into the rest of the data packet
+            int numAudioBytes = isInputSilent
+                ? 0
+                : _encoder.encode(inputLeft, BUFFER_LENGTH_SAMPLES_PER_CHANNEL, 1, currentPacketPtr);
             nodeList->getNodeSocket()->send(audioMixer->getActiveSocket(),
                                               dataPacket,
-                                              BUFFER_LENGTH_BYTES_PER_CHANNEL + leadingBytes);
+                                              numAudioBytes + leadingBytes);
 
             interface->getBandwidthMeter()->outputStream(BandwidthMeter::AUDIO)
-                    .updateValue(BUFFER_LENGTH_BYTES_PER_CHANNEL + leadingBytes);
+                    .updateValue(numAudioBytes + leadingBytes);
         }
         
     }
@@ -137,11 +154,20 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
     
     AudioRingBuffer* ringBuffer = &_ringBuffer;
     
+    // we're the ring buffer's reader, so anything that moves its next output happens here
+    if (_isResetPending) {
+        ringBuffer->reset();
+        _isResetPending = false;
+    }
+    
+    // if more arrived than we need for play out, drop what's been waiting longest
+    ringBuffer->trimToJitterBuffer();
+    
     // if there is anything in the ring buffer, decide what to do:
     
     if (ringBuffer->getEndOfLastWrite()) {
         if (!ringBuffer->isStarted() && ringBuffer->diffLastWriteNextOutput() <
-            (PACKET_LENGTH_SAMPLES + _jitterBufferSamples * (ringBuffer->isStereo() ? 2 : 1))) {
+            (PACKET_LENGTH_SAMPLES + ringBuffer->getJitterBufferSamples() * (ringBuffer->isStereo() ? 2 : 1))) {
             //
             //  If not enough audio has arrived to start playback, keep waiting
             //
@@ -150,16 +176,23 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
                      _packetsReceivedThisPlayback,
                      ringBuffer->diffLastWriteNextOutput(),
                      PACKET_LENGTH_SAMPLES,
-                     _jitterBufferSamples);
+                     ringBuffer->getJitterBufferSamples());
 #endif
+        } else if (ringBuffer->isStarted() && ringBuffer->diffLastWriteNextOutput() == 0
+                   && ringBuffer->concealMissingFrame(_concealedSamples)) {
+            //
+            //  The next packet is late or lost, play the last one again (quieter) rather than a gap
+            //
+            memcpy(outputLeft, _concealedSamples, PACKET_LENGTH_BYTES_PER_CHANNEL);
+            memcpy(outputRight, _concealedSamples + PACKET_LENGTH_SAMPLES_PER_CHANNEL, PACKET_LENGTH_BYTES_PER_CHANNEL);
+            
         } else if (ringBuffer->isStarted() && ringBuffer->diffLastWriteNextOutput() == 0) {
             //
             //  If we have started and now have run out of audio to send to the audio device, 
             //  this means we've starved and should restart.  
             //  
-            ringBuffer->setStarted(false);
+            ringBuffer->starve();
             
-            _numStarves++;
             _packetsReceivedThisPlayback = 0;
             _wasStarved = 10;          //   Frames for which to render the indication that the system was starved.
 #ifdef SHOW_AUDIO_DEBUG
@@ -176,7 +209,7 @@ inline void Audio::performIO(int16_t* inputLeft, int16_t* outputLeft, int16_t* o
 #ifdef SHOW_AUDIO_DEBUG
                 printLog("starting playback %0.1f msecs delayed, jitter = %d, pkts recvd: %d \n",
                          (usecTimestampNow() - usecTimestamp(&_firstPacketReceivedTime))/1000.0,
-                         _jitterBufferSamples,
+                         ringBuffer->getJitterBufferSamples(),
                          _packetsReceivedThisPlayback);
 #endif
             }
@@ -301,19 +334,20 @@ static void outputPortAudioError(PaError error) {
 
 void Audio::reset() {
     _packetsReceivedThisPlayback = 0;
-    _ringBuffer.reset();
+    _isResetPending = true;
 }
 
 Audio::Audio(Oscilloscope* scope, int16_t initialJitterBufferSamples) :
     _stream(NULL),
     _ringBuffer(true),
+    _isResetPending(false),
+    _encoder(AUDIO_CODEC_IMA_ADPCM),
     _scope(scope),
     _averagedLatency(0.0),
     _measuredJitter(0),
-    _jitterBufferSamples(initialJitterBufferSamples),
     _wasStarved(0),
-    _numStarves(0),
     _lastInputLoudness(0),
+    _numQuietInputFrames(0),
     _lastVelocity(0),
     _lastAcceleration(0),
     _totalPacketsReceived(0),
@@ -328,6 +362,8 @@ Audio::Audio(Oscilloscope* scope, int16_t initialJitterBufferSamples) :
     _flangeRate(0.0f),
     _flangeWeight(0.0f)
 {
+    _ringBuffer.setJitterBufferSamples(initialJitterBufferSamples);
+    
     outputPortAudioError(Pa_Initialize());
     
     //  NOTE:  Portaudio documentation is unclear as to whether it is safe to specify the
@@ -398,33 +434,13 @@ Audio::~Audio() {
 }
 
 void Audio::addReceivedAudioToBuffer(unsigned char* receivedData, int receivedBytes) {
-    const int NUM_INITIAL_PACKETS_DISCARD = 3;
-    const int STANDARD_DEVIATION_SAMPLE_COUNT = 500;
-    
     timeval currentReceiveTime;
     gettimeofday(&currentReceiveTime, NULL);
     _totalPacketsReceived++;
     
-    double timeDiff = diffclock(&_lastReceiveTime, &currentReceiveTime);
-    
-    //  Discard first few received packets for computing jitter (often they pile up on start)
-    if (_totalPacketsReceived > NUM_INITIAL_PACKETS_DISCARD) {
-        _stdev.addValue(timeDiff);
-    }
-    
-    if (_stdev.getSamples() > STANDARD_DEVIATION_SAMPLE_COUNT) {
-        _measuredJitter = _stdev.getStDev();
-        _stdev.reset();
-        //  Set jitter buffer to be a multiple of the measured standard deviation
-        const int MAX_JITTER_BUFFER_SAMPLES = RING_BUFFER_LENGTH_SAMPLES / 2;
-        const float NUM_STANDARD_DEVIATIONS = 3.f;
-        if (Application::getInstance()->shouldDynamicallySetJitterBuffer()) {
-            float newJitterBufferSamples = (NUM_STANDARD_DEVIATIONS * _measuredJitter)
-                                            / 1000.f
-                                            * SAMPLE_RATE;
-            setJitterBufferSamples(glm::clamp((int)newJitterBufferSamples, 0, MAX_JITTER_BUFFER_SAMPLES));
-        }
-    }
+    // the ring buffer works out how much jitter buffer we need, unless it's been set by hand
+    _ringBuffer.setAdaptiveJitterBuffer(Application::getInstance()->shouldDynamicallySetJitterBuffer());
+    _measuredJitter = _ringBuffer.getInterArrivalStDevMsecs();
     
     if (!_ringBuffer.isStarted()) {
         _packetsReceivedThisPlayback++;
@@ -434,24 +450,12 @@ void Audio::addReceivedAudioToBuffer(unsigned char* receivedData, int receivedBy
         gettimeofday(&_firstPacketReceivedTime, NULL);
     }
     
-    if (_ringBuffer.diffLastWriteNextOutput() + PACKET_LENGTH_SAMPLES >
-        PACKET_LENGTH_SAMPLES + (ceilf((float) (_jitterBufferSamples * 2) / PACKET_LENGTH_SAMPLES) * PACKET_LENGTH_SAMPLES)) {
-        // this packet would give us more than the required amount for play out
-        // discard the first packet in the buffer
-        
-        _ringBuffer.setNextOutput(_ringBuffer.getNextOutput() + PACKET_LENGTH_SAMPLES);
-        
-        if (_ringBuffer.getNextOutput() == _ringBuffer.getBuffer() + RING_BUFFER_LENGTH_SAMPLES) {
-            _ringBuffer.setNextOutput(_ringBuffer.getBuffer());
-        }
-    }
-    
     //printf("Got audio packet %d\n", _packetsReceivedThisPlayback);
     
     _ringBuffer.parseData((unsigned char*) receivedData, receivedBytes);
    
     Application::getInstance()->getBandwidthMeter()->inputStream(BandwidthMeter::AUDIO)
-            .updateValue(PACKET_LENGTH_BYTES + sizeof(PACKET_TYPE));
+            .updateValue(receivedBytes);
  
     _lastReceiveTime = currentReceiveTime;
 }
@@ -10,6 +10,7 @@
 #define __interface__Audio__
 
 #include <portaudio.h>
+#include <AudioCodec.h>
 #include <AudioRingBuffer.h>
 #include <StdDev.h>
 
@@ -39,8 +40,11 @@ public:
     void setLastAcceleration(glm::vec3 lastAcceleration) { _lastAcceleration = lastAcceleration; };
     void setLastVelocity(glm::vec3 lastVelocity) { _lastVelocity = lastVelocity; };
     
-    void setJitterBufferSamples(int samples) { _jitterBufferSamples = samples; };
-    int getJitterBufferSamples() { return _jitterBufferSamples; };
+    void setJitterBufferSamples(int samples) { _ringBuffer.setJitterBufferSamples(samples); };
+    
+    // the codec for our mic audio, and so for the mixed audio we get back
+    void setCodec(PACKET_VERSION codec) { _encoder.setCodec(codec); };
+    int getJitterBufferSamples() { return _ringBuffer.getJitterBufferSamples(); };
     
     void lowPassFilter(int16_t* inputBuffer);
 
@@ -54,17 +58,18 @@ public:
 
 private:    
     PaStream* _stream;
-    AudioRingBuffer _ringBuffer;
+    AudioRingBuffer _ringBuffer; // written by the network thread, read by the audio callback
+    volatile bool _isResetPending;
+    int16_t _concealedSamples[PACKET_LENGTH_SAMPLES];
+    AudioEncoder _encoder;
     Oscilloscope* _scope;
-    StDev _stdev;
     timeval _lastCallbackTime;
     timeval _lastReceiveTime;
     float _averagedLatency;
     float _measuredJitter;
-    int16_t _jitterBufferSamples;
     int _wasStarved;
-    int _numStarves;
     float _lastInputLoudness;
+    int _numQuietInputFrames;
     glm::vec3 _lastVelocity;
     glm::vec3 _lastAcceleration;
     int _totalPacketsReceived;
@@ -0,0 +1,167 @@
+//
+//  AudioCodec.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstring>
+
+#include "AudioCodec.h"
+
+// predictor, step index and a byte of padding
+const int IMA_ADPCM_CHANNEL_HEADER_BYTES = 4;
+
+const int IMA_ADPCM_MAX_STEP_INDEX = 88;
+
+static const int IMA_ADPCM_INDEX_TABLE[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int IMA_ADPCM_STEP_TABLE[IMA_ADPCM_MAX_STEP_INDEX + 1] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+    876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871,
+    5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623,
+    27086, 29794, 32767
+};
+
+// moves the predictor and step index on by one nibble, the same way in the encoder and the decoder
+static void applyImaAdpcmNibble(int nibble, int& predictor, int& stepIndex) {
+    int step = IMA_ADPCM_STEP_TABLE[stepIndex];
+    int delta = step >> 3;
+    if (nibble & 4) {
+        delta += step;
+    }
+    if (nibble & 2) {
+        delta += step >> 1;
+    }
+    if (nibble & 1) {
+        delta += step >> 2;
+    }
+
+    predictor += (nibble & 8) ? -delta : delta;
+    predictor = std::max(-32768, std::min(32767, predictor));
+    stepIndex = std::max(0, std::min(IMA_ADPCM_MAX_STEP_INDEX, stepIndex + IMA_ADPCM_INDEX_TABLE[nibble]));
+}
+
+static int encodeImaAdpcmSample(int sample, int& predictor, int& stepIndex) {
+    int step = IMA_ADPCM_STEP_TABLE[stepIndex];
+    int difference = sample - predictor;
+
+    int nibble = 0;
+    if (difference < 0) {
+        nibble = 8;
+        difference = -difference;
+    }
+    if (difference >= step) {
+        nibble |= 4;
+        difference -= step;
+    }
+    if (difference >= step >> 1) {
+        nibble |= 2;
+        difference -= step >> 1;
+    }
+    if (difference >= step >> 2) {
+        nibble |= 1;
+    }
+
+    applyImaAdpcmNibble(nibble, predictor, stepIndex);
+    return nibble;
+}
+
+int bytesForAudioFrame(PACKET_VERSION codec, int numSamplesPerChannel, int numChannels) {
+    switch (codec) {
+        case AUDIO_CODEC_PCM:
+            return numSamplesPerChannel * numChannels * sizeof(int16_t);
+        case AUDIO_CODEC_IMA_ADPCM:
+            return (IMA_ADPCM_CHANNEL_HEADER_BYTES + (numSamplesPerChannel + 1) / 2) * numChannels;
+        default:
+            return 0;
+    }
+}
+
+int decodeAudioFrame(PACKET_VERSION codec, const unsigned char* source, int numBytes,
+                     int16_t* samples, int numSamplesPerChannel, int numChannels) {
+    int frameBytes = bytesForAudioFrame(codec, numSamplesPerChannel, numChannels);
+    if (frameBytes == 0 || numBytes != frameBytes) {
+        return 0;
+    }
+
+    if (codec == AUDIO_CODEC_PCM) {
+        memcpy(samples, source, frameBytes);
+        return frameBytes;
+    }
+
+    const unsigned char* currentByte = source;
+    for (int channel = 0; channel < numChannels; channel++) {
+        int16_t firstPredictor;
+        memcpy(&firstPredictor, currentByte, sizeof(firstPredictor));
+        int predictor = firstPredictor;
+        int stepIndex = std::min((int) currentByte[sizeof(firstPredictor)], IMA_ADPCM_MAX_STEP_INDEX);
+        currentByte += IMA_ADPCM_CHANNEL_HEADER_BYTES;
+
+        int16_t* channelSamples = samples + channel * numSamplesPerChannel;
+        for (int i = 0; i < numSamplesPerChannel; i++) {
+            // two samples to a byte, the first in the low nibble
+            int nibble = (i % 2 == 0) ? (*currentByte & 0x0F) : (*(currentByte++) >> 4);
+            applyImaAdpcmNibble(nibble, predictor, stepIndex);
+            channelSamples[i] = predictor;
+        }
+        if (numSamplesPerChannel % 2) {
+            currentByte++;
+        }
+    }
+    return currentByte - source;
+}
+
+AudioEncoder::AudioEncoder(PACKET_VERSION codec) :
+    _codec(codec) {
+    setCodec(codec);
+}
+
+void AudioEncoder::setCodec(PACKET_VERSION codec) {
+    _codec = codec;
+    for (int i = 0; i < MAX_AUDIO_CODEC_CHANNELS; i++) {
+        _predictors[i] = 0;
+        _stepIndexes[i] = 0;
+    }
+}
+
+int AudioEncoder::encode(const int16_t* samples, int numSamplesPerChannel, int numChannels,
+                         unsigned char* destination) {
+    if (_codec != AUDIO_CODEC_IMA_ADPCM) {
+        int numBytes = numSamplesPerChannel * numChannels * sizeof(int16_t);
+        memcpy(destination, samples, numBytes);
+        return numBytes;
+    }
+
+    unsigned char* currentByte = destination;
+    for (int channel = 0; channel < numChannels; channel++) {
+        int& predictor = _predictors[channel];
+        int& stepIndex = _stepIndexes[channel];
+
+        // the decoder starts from where we are now, so it doesn't need the frames before this one
+        int16_t firstPredictor = predictor;
+        memcpy(currentByte, &firstPredictor, sizeof(firstPredictor));
+        currentByte[sizeof(firstPredictor)] = stepIndex;
+        currentByte[sizeof(firstPredictor) + 1] = 0;
+        currentByte += IMA_ADPCM_CHANNEL_HEADER_BYTES;
+
+        const int16_t* channelSamples = samples + channel * numSamplesPerChannel;
+        for (int i = 0; i < numSamplesPerChannel; i++) {
+            int nibble = encodeImaAdpcmSample(channelSamples[i], predictor, stepIndex);
+            if (i % 2 == 0) {
+                *currentByte = nibble;
+            } else {
+                *(currentByte++) |= nibble << 4;
+            }
+        }
+        if (numSamplesPerChannel % 2) {
+            currentByte++;
+        }
+    }
+    return currentByte - destination;
+}
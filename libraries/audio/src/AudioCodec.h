@@ -0,0 +1,51 @@
+//
+//  AudioCodec.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Encoding and decoding of the samples in audio packets. The codec a packet's samples are in is its version byte
+//  (AUDIO_CODEC_PCM, AUDIO_CODEC_IMA_ADPCM), so a receiver always knows how to read what it got, and the mixer
+//  answers each agent in whatever codec it sends its mic audio in.
+//
+//  IMA ADPCM takes 4 bits a sample. Each channel of an encoded frame starts with the predictor and step index the
+//  decoder needs, so a lost packet doesn't throw off the ones after it.
+//
+
+#ifndef __hifi__AudioCodec__
+#define __hifi__AudioCodec__
+
+#include <stdint.h>
+
+#include <PacketHeaders.h>
+
+const int MAX_AUDIO_CODEC_CHANNELS = 2;
+
+// the bytes a frame takes up in codec, or 0 if we don't know the codec
+int bytesForAudioFrame(PACKET_VERSION codec, int numSamplesPerChannel, int numChannels);
+
+// Reads a whole frame into samples, the channels one after the other as in AudioRingBuffer. Returns the bytes read,
+// or 0 if numBytes isn't the size of a frame in this codec.
+int decodeAudioFrame(PACKET_VERSION codec, const unsigned char* source, int numBytes,
+                     int16_t* samples, int numSamplesPerChannel, int numChannels);
+
+// encodes one stream, it carries the state of the stream from one frame to the next
+class AudioEncoder {
+public:
+    AudioEncoder(PACKET_VERSION codec = AUDIO_CODEC_PCM);
+
+    PACKET_VERSION getCodec() const { return _codec; }
+
+    // starts the stream over if the codec changes
+    void setCodec(PACKET_VERSION codec);
+
+    // samples are laid out as for decodeAudioFrame(), returns the bytes written to destination
+    int encode(const int16_t* samples, int numSamplesPerChannel, int numChannels, unsigned char* destination);
+
+private:
+    PACKET_VERSION _codec;
+    int _predictors[MAX_AUDIO_CODEC_CHANNELS];
+    int _stepIndexes[MAX_AUDIO_CODEC_CHANNELS];
+};
+
+#endif /* defined(__hifi__AudioCodec__) */
@@ -19,28 +19,32 @@
 UDPSocket* AudioInjectionManager::_injectorSocket = NULL;
 sockaddr AudioInjectionManager::_destinationSocket;
 bool AudioInjectionManager::_isDestinationSocketExplicit = false;
-AudioInjector* AudioInjectionManager::_injectors[50] = {};
+AudioInjector* AudioInjectionManager::_injectors[MAX_CONCURRENT_INJECTORS] = {};
+std::vector<AudioInjector*> AudioInjectionManager::_activeInjectors;
+bool AudioInjectionManager::_isSchedulerRunning = false;
+pthread_mutex_t AudioInjectionManager::_injectorsMutex = PTHREAD_MUTEX_INITIALIZER;
 
-AudioInjector* AudioInjectionManager::injectorWithSamplesFromFile(const char* filename) {
+AudioInjector* AudioInjectionManager::addInjector(AudioInjector* injector) {
+    pthread_mutex_lock(&_injectorsMutex);
     for (int i = 0; i < MAX_CONCURRENT_INJECTORS; i++) {
         if (!_injectors[i]) {
-            _injectors[i] = new AudioInjector(filename);
-            return _injectors[i];
+            _injectors[i] = injector;
+            pthread_mutex_unlock(&_injectorsMutex);
+            return injector;
         }
     }
+    pthread_mutex_unlock(&_injectorsMutex);
     
+    delete injector;
     return NULL;
 }
 
+AudioInjector* AudioInjectionManager::injectorWithSamplesFromFile(const char* filename) {
+    return addInjector(new AudioInjector(filename));
+}
+
 AudioInjector* AudioInjectionManager::injectorWithCapacity(int capacity) {
-    for (int i = 0; i < MAX_CONCURRENT_INJECTORS; i++) {
-        if (!_injectors[i]) {
-            _injectors[i] = new AudioInjector(capacity);
-            return _injectors[i];
-        }
-    }
-    
-    return NULL;
+    return addInjector(new AudioInjector(capacity));
 }
 
 void AudioInjectionManager::setDestinationSocket(sockaddr& destinationSocket) {
@@ -48,39 +52,92 @@ void AudioInjectionManager::setDestinationSocket(sockaddr& destinationSocket) {
     _isDestinationSocketExplicit = true;
 }
 
-void* AudioInjectionManager::injectAudioViaThread(void* args) {
-    AudioInjector* injector = (AudioInjector*) args;
+void AudioInjectionManager::threadInjector(AudioInjector* injector) {
+    pthread_mutex_lock(&_injectorsMutex);
     
+    // the scheduler finishes with an injector under the lock, so it can't still be sending this one
+    if (injector->isInjectingAudio() || !injector->startInjecting()) {
+        pthread_mutex_unlock(&_injectorsMutex);
+        return;
+    }
+    _activeInjectors.push_back(injector);
+    
+    if (!_isSchedulerRunning) {
+        _isSchedulerRunning = true;
+        
+        pthread_t schedulerThread;
+        pthread_create(&schedulerThread, NULL, runScheduler, NULL);
+        pthread_detach(schedulerThread);
+    }
+    pthread_mutex_unlock(&_injectorsMutex);
+}
+
+void* AudioInjectionManager::runScheduler(void* args) {
     // if we don't have an injectorSocket then grab the one from the node list
     if (!_injectorSocket) {
         _injectorSocket = NodeList::getInstance()->getNodeSocket();
     }
+    UDPSendBatch sendBatch(_injectorSocket);
+    
+    timeval startTime;
+    gettimeofday(&startTime, NULL);
+    int nextFrame = 0;
+    
+    while (true) {
+        pthread_mutex_lock(&_injectorsMutex);
+        if (_activeInjectors.empty()) {
+            _isSchedulerRunning = false;
+            pthread_mutex_unlock(&_injectorsMutex);
+            break;
+        }
+        queueNextFrames(sendBatch);
+        pthread_mutex_unlock(&_injectorsMutex);
+        
+        sendBatch.flush();
+        
+        int usecToSleep = usecTimestamp(&startTime) + (++nextFrame * INJECT_INTERVAL_USECS) - usecTimestampNow();
+        if (usecToSleep > 0) {
+            usleep(usecToSleep);
+        }
+    }
     
+    pthread_exit(0);
+}
+
+void AudioInjectionManager::queueNextFrames(UDPSendBatch& sendBatch) {
     // if we don't have an explicit destination socket then pull active socket for current audio mixer from node list
     if (!_isDestinationSocketExplicit) {
+        NodeListReadScope readScope(NodeList::getInstance());
         Node* audioMixer = NodeList::getInstance()->soloNodeOfType(NODE_TYPE_AUDIO_MIXER);
-        if (audioMixer) {
+        if (audioMixer && audioMixer->getActiveSocket()) {
             _destinationSocket = *audioMixer->getActiveSocket();
         }
     }
     
-    injector->injectAudio(_injectorSocket, &_destinationSocket);
+    unsigned char dataPacket[MAX_INJECT_PACKET_BYTES];
     
-    // if this an injector inside the injection manager's array we're responsible for deletion
-    for (int i = 0; i < MAX_CONCURRENT_INJECTORS; i++) {
-        if (_injectors[i] == injector) {
-            // pointer matched - delete this injector
-            delete injector;
-            
-            // set the pointer to NULL so we can reuse this spot
-            _injectors[i] = NULL;
+    for (int i = 0; i < _activeInjectors.size(); i++) {
+        AudioInjector* injector = _activeInjectors[i];
+        
+        int numPacketBytes = injector->writeNextPacket(dataPacket);
+        if (numPacketBytes) {
+            sendBatch.queue(&_destinationSocket, dataPacket, numPacketBytes);
+            continue;
+        }
+        
+        // this one's done, swap the last injector into its place
+        _activeInjectors[i--] = _activeInjectors.back();
+        _activeInjectors.pop_back();
+        
+        // if this an injector inside the injection manager's array we're responsible for deletion
+        for (int j = 0; j < MAX_CONCURRENT_INJECTORS; j++) {
+            if (_injectors[j] == injector) {
+                // pointer matched - delete this injector
+                delete injector;
+                
+                // set the pointer to NULL so we can reuse this spot
+                _injectors[j] = NULL;
+            }
         }
     }
-    
-    pthread_exit(0);
 }
-
-void AudioInjectionManager::threadInjector(AudioInjector* injector) {
-    pthread_t audioInjectThread;
-    pthread_create(&audioInjectThread, NULL, injectAudioViaThread, (void*) injector);
-}
\ No newline at end of file
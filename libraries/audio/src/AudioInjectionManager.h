@@ -10,28 +10,46 @@
 #define __hifi__AudioInjectionManager__
 
 #include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include "pthread.h"
+#else
+#include <pthread.h>
+#endif
 
 #include "UDPSocket.h"
 #include "AudioInjector.h"
 
-const int MAX_CONCURRENT_INJECTORS = 50;
+const int MAX_CONCURRENT_INJECTORS = 500;
 
+// Every injector that's injecting is driven by one scheduler thread. Each tick it sends the next frame of all of them
+// in one batch, so they share a clock and a socket rather than each having a thread sleeping on its own timing. The
+// thread is started by the first injector and exits once none are left.
 class AudioInjectionManager {
 public:
     static AudioInjector* injectorWithCapacity(int capacity);
     static AudioInjector* injectorWithSamplesFromFile(const char* filename);
     
+    // hands the injector to the scheduler, it's injecting as soon as this returns
     static void threadInjector(AudioInjector* injector);
     
     static void setInjectorSocket(UDPSocket* injectorSocket) { _injectorSocket = injectorSocket;}
     static void setDestinationSocket(sockaddr& destinationSocket);
 private:
-    static void* injectAudioViaThread(void* args);
+    static AudioInjector* addInjector(AudioInjector* injector);
+    static void* runScheduler(void* args);
+    static void queueNextFrames(UDPSendBatch& sendBatch);
     
     static UDPSocket* _injectorSocket;
     static sockaddr _destinationSocket;
     static bool _isDestinationSocketExplicit;
     static AudioInjector* _injectors[MAX_CONCURRENT_INJECTORS];
+    
+    // the injectors the scheduler is sending, and whether its thread is running, guarded by _injectorsMutex
+    static std::vector<AudioInjector*> _activeInjectors;
+    static bool _isSchedulerRunning;
+    static pthread_mutex_t _injectorsMutex;
 };
 
 #endif /* defined(__hifi__AudioInjectionManager__) */
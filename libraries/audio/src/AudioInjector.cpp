@@ -6,7 +6,7 @@
 //  Copyright (c) 2012 High Fidelity, Inc. All rights reserved.
 //
 
-#include <fstream>
+#include <algorithm>
 #include <cstring>
 
 #include <SharedUtil.h>
@@ -16,6 +16,9 @@
 #include "AudioInjector.h"
 
 AudioInjector::AudioInjector(const char* filename) :
+    _audioSampleArray(NULL),
+    _numTotalSamples(0),
+    _numSamplesInjected(0),
     _position(0.0f, 0.0f, 0.0f),
     _orientation(0.0f, 0.0f, 0.0f, 0.0f),
     _radius(0.0f),
@@ -25,27 +28,25 @@ AudioInjector::AudioInjector(const char* filename) :
 {
     loadRandomIdentifier(_streamIdentifier, STREAM_IDENTIFIER_NUM_BYTES);
     
-    std::fstream sourceFile;
+    _sourceFile = fopen(filename, "rb");
     
-    sourceFile.open(filename, std::ios::in | std::ios::binary);
-    sourceFile.seekg(0, std::ios::end);
-    
-    int totalBytes = sourceFile.tellg();
-    if (totalBytes == -1) {
+    if (!_sourceFile || fseek(_sourceFile, 0, SEEK_END) != 0 || ftell(_sourceFile) == -1) {
         printf("Error reading audio data from file %s\n", filename);
-        _audioSampleArray = NULL;
+        if (_sourceFile) {
+            fclose(_sourceFile);
+            _sourceFile = NULL;
+        }
     } else {
-        printf("Read %d bytes from audio file\n", totalBytes);
-        sourceFile.seekg(0, std::ios::beg);
-        _numTotalSamples = totalBytes / 2;
-        _audioSampleArray = new int16_t[_numTotalSamples];
-        
-        sourceFile.read((char *)_audioSampleArray, totalBytes);
+        int totalBytes = ftell(_sourceFile);
+        printf("Streaming %d bytes from audio file\n", totalBytes);
+        _numTotalSamples = totalBytes / sizeof(int16_t);
     }
 }
 
 AudioInjector::AudioInjector(int maxNumSamples) :
+    _sourceFile(NULL),
     _numTotalSamples(maxNumSamples),
+    _numSamplesInjected(0),
     _position(0.0f, 0.0f, 0.0f),
     _orientation(),
     _radius(0.0f),
@@ -60,68 +61,90 @@ AudioInjector::AudioInjector(int maxNumSamples) :
 }
 
 AudioInjector::~AudioInjector() {
+    if (_sourceFile) {
+        fclose(_sourceFile);
+    }
     delete[] _audioSampleArray;
 }
 
 void AudioInjector::injectAudio(UDPSocket* injectorSocket, sockaddr* destinationSocket) {
-    if (_audioSampleArray) {
-        _isInjectingAudio = true;
-        
+    if (startInjecting()) {
         timeval startTime;
-        
-        // calculate the number of bytes required for additional data
-        int leadingBytes = numBytesForPacketHeader((unsigned char*) &PACKET_TYPE_INJECT_AUDIO)
-            + sizeof(_streamIdentifier)
-            + sizeof(_position)
-            + sizeof(_orientation)
-            + sizeof(_radius)
-            + sizeof(_volume);
-        
-        unsigned char dataPacket[(BUFFER_LENGTH_SAMPLES_PER_CHANNEL * sizeof(int16_t)) + leadingBytes];
-        
-        unsigned char* currentPacketPtr = dataPacket + populateTypeAndVersion(dataPacket, PACKET_TYPE_INJECT_AUDIO);
-        
-        // copy the identifier for this injector
-        memcpy(currentPacketPtr, &_streamIdentifier, sizeof(_streamIdentifier));
-        currentPacketPtr += sizeof(_streamIdentifier);
-        
-        memcpy(currentPacketPtr, &_position, sizeof(_position));
-        currentPacketPtr += sizeof(_position);
-        
-        memcpy(currentPacketPtr, &_orientation, sizeof(_orientation));
-        currentPacketPtr += sizeof(_orientation);
-        
-        memcpy(currentPacketPtr, &_radius, sizeof(_radius));
-        currentPacketPtr += sizeof(_radius);
-        
-        *currentPacketPtr = _volume;
-        currentPacketPtr++;        
-        
         gettimeofday(&startTime, NULL);
         int nextFrame = 0;
         
-        for (int i = 0; i < _numTotalSamples; i += BUFFER_LENGTH_SAMPLES_PER_CHANNEL) {
-            int numSamplesToCopy = BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
-            
-            if (_numTotalSamples - i < BUFFER_LENGTH_SAMPLES_PER_CHANNEL) {
-                numSamplesToCopy = _numTotalSamples - i;
-                memset(currentPacketPtr + numSamplesToCopy,
-                       0,
-                       BUFFER_LENGTH_BYTES_PER_CHANNEL - (numSamplesToCopy * sizeof(int16_t)));
-            }
-            
-            memcpy(currentPacketPtr, _audioSampleArray + i, numSamplesToCopy * sizeof(int16_t));
-            
-            injectorSocket->send(destinationSocket, dataPacket, sizeof(dataPacket));
+        unsigned char dataPacket[MAX_INJECT_PACKET_BYTES];
+        int numPacketBytes;
+        
+        while ((numPacketBytes = writeNextPacket(dataPacket))) {
+            injectorSocket->send(destinationSocket, dataPacket, numPacketBytes);
             
             int usecToSleep = usecTimestamp(&startTime) + (++nextFrame * INJECT_INTERVAL_USECS) - usecTimestampNow();
             if (usecToSleep > 0) {
                 usleep(usecToSleep);
             }
         }
-        
+    }
+}
+
+bool AudioInjector::startInjecting() {
+    _numSamplesInjected = 0;
+    
+    if (_sourceFile) {
+        fseek(_sourceFile, 0, SEEK_SET);
+    } else if (!_audioSampleArray) {
         _isInjectingAudio = false;
+        return false;
     }
+    
+    _isInjectingAudio = true;
+    return true;
+}
+
+int AudioInjector::writeNextPacket(unsigned char* dataPacket) {
+    if (_numSamplesInjected >= _numTotalSamples) {
+        _isInjectingAudio = false;
+        return 0;
+    }
+    
+    unsigned char* currentPacketPtr = dataPacket + populateTypeAndVersion(dataPacket, PACKET_TYPE_INJECT_AUDIO);
+    
+    // copy the identifier for this injector
+    memcpy(currentPacketPtr, &_streamIdentifier, sizeof(_streamIdentifier));
+    currentPacketPtr += sizeof(_streamIdentifier);
+    
+    memcpy(currentPacketPtr, &_position, sizeof(_position));
+    currentPacketPtr += sizeof(_position);
+    
+    memcpy(currentPacketPtr, &_orientation, sizeof(_orientation));
+    currentPacketPtr += sizeof(_orientation);
+    
+    memcpy(currentPacketPtr, &_radius, sizeof(_radius));
+    currentPacketPtr += sizeof(_radius);
+    
+    *currentPacketPtr = _volume;
+    currentPacketPtr++;
+    
+    int numSamplesToCopy = std::min(BUFFER_LENGTH_SAMPLES_PER_CHANNEL, _numTotalSamples - _numSamplesInjected);
+    
+    if (_sourceFile) {
+        numSamplesToCopy = fread(currentPacketPtr, sizeof(int16_t), numSamplesToCopy, _sourceFile);
+        if (numSamplesToCopy == 0) {
+            // the file got shorter since we opened it
+            _isInjectingAudio = false;
+            return 0;
+        }
+    } else {
+        memcpy(currentPacketPtr, _audioSampleArray + _numSamplesInjected, numSamplesToCopy * sizeof(int16_t));
+    }
+    _numSamplesInjected += numSamplesToCopy;
+    
+    // the last frame is padded out with silence
+    memset(currentPacketPtr + numSamplesToCopy * sizeof(int16_t),
+           0,
+           BUFFER_LENGTH_BYTES_PER_CHANNEL - (numSamplesToCopy * sizeof(int16_t)));
+    
+    return currentPacketPtr + BUFFER_LENGTH_BYTES_PER_CHANNEL - dataPacket;
 }
 
 void AudioInjector::addSample(const int16_t sample) {
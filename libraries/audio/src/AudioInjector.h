@@ -9,6 +9,8 @@
 #ifndef __hifi__AudioInjector__
 #define __hifi__AudioInjector__
 
+#include <cstdio>
+
 #include <glm/glm.hpp>
 #include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/component_wise.hpp>
@@ -23,14 +25,27 @@ const int MAX_INJECTOR_VOLUME = 0xFF;
 
 const int INJECT_INTERVAL_USECS = floorf((BUFFER_LENGTH_SAMPLES_PER_CHANNEL / SAMPLE_RATE) * 1000000);
 
+// packet header, stream identifier, position, orientation, radius, volume and a frame of samples
+const int MAX_INJECT_PACKET_BYTES = MAX_PACKET_HEADER_BYTES + STREAM_IDENTIFIER_NUM_BYTES + sizeof(glm::vec3)
+    + sizeof(glm::quat) + sizeof(float) + sizeof(unsigned char) + BUFFER_LENGTH_BYTES_PER_CHANNEL;
+
 class AudioInjector {
 public:
+    // the file stays open and is read a frame at a time as it's injected, rather than all up front
     AudioInjector(const char* filename);
     AudioInjector(int maxNumSamples);
     ~AudioInjector();
 
+    // sends the whole injection from this thread, sleeping between frames
     void injectAudio(UDPSocket* injectorSocket, sockaddr* destinationSocket);
     
+    // starts the injection over from the first sample, returns false if there's nothing to inject
+    bool startInjecting();
+    
+    // Writes the next frame's PACKET_TYPE_INJECT_AUDIO packet to dataPacket, which needs room for
+    // MAX_INJECT_PACKET_BYTES, and returns its size. Returns 0 and stops injecting once every sample has been sent.
+    int writeNextPacket(unsigned char* dataPacket);
+    
     bool isInjectingAudio() const { return _isInjectingAudio; }
     
     unsigned char getVolume() const  { return _volume; }
@@ -49,14 +64,16 @@ public:
     void addSamples(int16_t* sampleBuffer, int numSamples);
 private:
     unsigned char _streamIdentifier[STREAM_IDENTIFIER_NUM_BYTES];
+    FILE* _sourceFile;
     int16_t* _audioSampleArray;
     int _numTotalSamples;
+    int _numSamplesInjected;
     glm::vec3 _position;
     glm::quat _orientation;
     float _radius;
     unsigned char _volume;
     int _indexOfNextSlot;
-    bool _isInjectingAudio;
+    volatile bool _isInjectingAudio;
 };
 
 #endif /* defined(__hifi__AudioInjector__) */
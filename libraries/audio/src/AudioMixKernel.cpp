@@ -0,0 +1,198 @@
+//
+//  AudioMixKernel.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HAVE_SSE2_MIX_KERNEL
+#include <emmintrin.h>
+#endif
+
+// the AVX versions are compiled for AVX on their own, and only called if the CPU turns out to have it
+#if defined(HAVE_SSE2_MIX_KERNEL) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX_MIX_KERNEL
+#include <immintrin.h>
+#define AVX_FUNCTION __attribute__((target("avx")))
+#endif
+
+#include "AudioMixKernel.h"
+
+const float MAX_SAMPLE_VALUE = std::numeric_limits<int16_t>::max();
+const float MIN_SAMPLE_VALUE = std::numeric_limits<int16_t>::min();
+
+typedef void (*AudioMixAddFunction)(float* destination, const float* source, float gain, int numSamples);
+typedef void (*AudioMixInt16ToFloatFunction)(const int16_t* source, float* destination, int numSamples);
+typedef void (*AudioMixFloatToInt16Function)(const float* source, int16_t* destination, int numSamples);
+
+static void scalarMixAdd(float* destination, const float* source, float gain, int numSamples) {
+    for (int i = 0; i < numSamples; i++) {
+        destination[i] += source[i] * gain;
+    }
+}
+
+static void scalarInt16ToFloat(const int16_t* source, float* destination, int numSamples) {
+    for (int i = 0; i < numSamples; i++) {
+        destination[i] = source[i];
+    }
+}
+
+static void scalarFloatToInt16(const float* source, int16_t* destination, int numSamples) {
+    for (int i = 0; i < numSamples; i++) {
+        float sample = std::max(MIN_SAMPLE_VALUE, std::min(MAX_SAMPLE_VALUE, source[i]));
+        destination[i] = (int16_t) floorf(sample + 0.5f);
+    }
+}
+
+#ifdef HAVE_SSE2_MIX_KERNEL
+static void sse2MixAdd(float* destination, const float* source, float gain, int numSamples) {
+    __m128 gains = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= numSamples; i += 4) {
+        __m128 sum = _mm_add_ps(_mm_loadu_ps(destination + i), _mm_mul_ps(_mm_loadu_ps(source + i), gains));
+        _mm_storeu_ps(destination + i, sum);
+    }
+    scalarMixAdd(destination + i, source + i, gain, numSamples - i);
+}
+
+static void sse2Int16ToFloat(const int16_t* source, float* destination, int numSamples) {
+    int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        __m128i samples = _mm_loadu_si128((const __m128i*) (source + i));
+
+        // put each sample in the top half of a 32 bit lane, then shift it down to sign extend it
+        __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(samples, samples), 16);
+        __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(samples, samples), 16);
+        _mm_storeu_ps(destination + i, _mm_cvtepi32_ps(low));
+        _mm_storeu_ps(destination + i + 4, _mm_cvtepi32_ps(high));
+    }
+    scalarInt16ToFloat(source + i, destination + i, numSamples - i);
+}
+
+static void sse2FloatToInt16(const float* source, int16_t* destination, int numSamples) {
+    // clamp before converting, anything out of the 32 bit range would come back as INT_MIN
+    __m128 maxSample = _mm_set1_ps(MAX_SAMPLE_VALUE);
+    __m128 minSample = _mm_set1_ps(MIN_SAMPLE_VALUE);
+    int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        __m128 low = _mm_max_ps(minSample, _mm_min_ps(maxSample, _mm_loadu_ps(source + i)));
+        __m128 high = _mm_max_ps(minSample, _mm_min_ps(maxSample, _mm_loadu_ps(source + i + 4)));
+        __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high));
+        _mm_storeu_si128((__m128i*) (destination + i), packed);
+    }
+    scalarFloatToInt16(source + i, destination + i, numSamples - i);
+}
+#endif
+
+#ifdef HAVE_AVX_MIX_KERNEL
+AVX_FUNCTION static void avxMixAdd(float* destination, const float* source, float gain, int numSamples) {
+    __m256 gains = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        __m256 sum = _mm256_add_ps(_mm256_loadu_ps(destination + i), _mm256_mul_ps(_mm256_loadu_ps(source + i), gains));
+        _mm256_storeu_ps(destination + i, sum);
+    }
+    scalarMixAdd(destination + i, source + i, gain, numSamples - i);
+}
+
+static bool cpuHasAVX() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx");
+}
+#endif
+
+class AudioMixKernel {
+public:
+    AudioMixKernel() :
+        name("scalar"),
+        mixAdd(scalarMixAdd),
+        int16ToFloat(scalarInt16ToFloat),
+        floatToInt16(scalarFloatToInt16) {
+#ifdef HAVE_SSE2_MIX_KERNEL
+        name = "sse2";
+        mixAdd = sse2MixAdd;
+        int16ToFloat = sse2Int16ToFloat;
+        floatToInt16 = sse2FloatToInt16;
+#endif
+#ifdef HAVE_AVX_MIX_KERNEL
+        // the conversions are only done once per source, so they stay on SSE2
+        if (cpuHasAVX()) {
+            name = "avx";
+            mixAdd = avxMixAdd;
+        }
+#endif
+    }
+
+    const char* name;
+    AudioMixAddFunction mixAdd;
+    AudioMixInt16ToFloatFunction int16ToFloat;
+    AudioMixFloatToInt16Function floatToInt16;
+};
+
+// picked before main(), so every thread sees the same kernel without any locking
+static AudioMixKernel kernel;
+
+void audioMixAdd(float* destination, const float* source, float gain, int numSamples) {
+    kernel.mixAdd(destination, source, gain, numSamples);
+}
+
+void audioMixInt16ToFloat(const int16_t* source, float* destination, int numSamples) {
+    kernel.int16ToFloat(source, destination, numSamples);
+}
+
+void audioMixFloatToInt16(const float* source, int16_t* destination, int numSamples) {
+    kernel.floatToInt16(source, destination, numSamples);
+}
+
+const char* getAudioMixKernelName() {
+    return kernel.name;
+}
+
+void audioMixAddScalar(float* destination, const float* source, float gain, int numSamples) {
+    scalarMixAdd(destination, source, gain, numSamples);
+}
+
+void audioMixFloatToInt16Scalar(const float* source, int16_t* destination, int numSamples) {
+    scalarFloatToInt16(source, destination, numSamples);
+}
+
+AudioTwoPole::AudioTwoPole(float sampleRate) :
+    _sampleRate(sampleRate),
+    _b0(1.0f),
+    _a1(0.0f),
+    _a2(0.0f),
+    _lastOutput(0.0f),
+    _secondLastOutput(0.0f) {
+}
+
+void AudioTwoPole::setResonance(float frequency, float radius, bool normalize) {
+    const float TWO_PI = 2.0f * 3.14159265358979f;
+    _a2 = radius * radius;
+    _a1 = -2.0f * radius * cosf(TWO_PI * frequency / _sampleRate);
+
+    if (normalize) {
+        // unity gain at the resonance
+        float real = 1.0f - radius + (_a2 - radius) * cosf(TWO_PI * 2.0f * frequency / _sampleRate);
+        float imaginary = (_a2 - radius) * sinf(TWO_PI * 2.0f * frequency / _sampleRate);
+        _b0 = sqrtf(real * real + imaginary * imaginary);
+    }
+}
+
+void AudioTwoPole::process(const float* input, float* output, int numSamples) {
+    // each output depends on the last two, so this one can't be split across SIMD lanes
+    float lastOutput = _lastOutput;
+    float secondLastOutput = _secondLastOutput;
+    for (int i = 0; i < numSamples; i++) {
+        float sample = _b0 * input[i] - _a1 * lastOutput - _a2 * secondLastOutput;
+        secondLastOutput = lastOutput;
+        lastOutput = sample;
+        output[i] = sample;
+    }
+    _lastOutput = lastOutput;
+    _secondLastOutput = secondLastOutput;
+}
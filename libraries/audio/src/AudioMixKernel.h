@@ -0,0 +1,52 @@
+//
+//  AudioMixKernel.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Building blocks for mixing many sources into one stereo buffer. Mixes are accumulated in float, so sources can
+//  be added in any order and the result is only saturated back to int16_t once, at the end. The loops that run once
+//  per source use SSE2 or AVX when the CPU we're running on has them, the choice is made once at startup.
+//
+
+#ifndef __hifi__AudioMixKernel__
+#define __hifi__AudioMixKernel__
+
+#include <stdint.h>
+
+// destination[i] += source[i] * gain
+void audioMixAdd(float* destination, const float* source, float gain, int numSamples);
+
+void audioMixInt16ToFloat(const int16_t* source, float* destination, int numSamples);
+
+// rounds and saturates each sample to the int16_t range
+void audioMixFloatToInt16(const float* source, int16_t* destination, int numSamples);
+
+// "avx", "sse2" or "scalar", whichever the functions above ended up using
+const char* getAudioMixKernelName();
+
+// the plain versions, which the SIMD ones finish off with, to check and time the SIMD ones against
+void audioMixAddScalar(float* destination, const float* source, float gain, int numSamples);
+void audioMixFloatToInt16Scalar(const float* source, int16_t* destination, int numSamples);
+
+// The same two pole resonance filter as stk::TwoPole, but in float and a block at a time
+class AudioTwoPole {
+public:
+    AudioTwoPole(float sampleRate);
+
+    // see stk::TwoPole::setResonance()
+    void setResonance(float frequency, float radius, bool normalize);
+
+    // output can be the same buffer as input
+    void process(const float* input, float* output, int numSamples);
+
+private:
+    float _sampleRate;
+    float _b0;
+    float _a1;
+    float _a2;
+    float _lastOutput;
+    float _secondLastOutput;
+};
+
+#endif /* defined(__hifi__AudioMixKernel__) */
@@ -9,15 +9,43 @@
 #include <cstring>
 #include <math.h>
 
+#include <glm/glm.hpp>
+
+#include "AudioCodec.h"
 #include "PacketHeaders.h"
+#include "SharedUtil.h"
 
 #include "AudioRingBuffer.h"
 
+// frames of arrival times the jitter buffer looks at each time it adapts, a couple of seconds
+const int JITTER_STATS_FRAMES = 200;
+const float NUM_JITTER_STANDARD_DEVIATIONS = 3.0f;
+
+// in _manualJitterBufferSamples when there isn't one waiting for the writer
+const int NO_MANUAL_JITTER_BUFFER_SAMPLES = -1;
+
+// each frame concealed in a row is this much quieter than the one before
+const float CONCEALED_FRAME_FADE = 0.5f;
+
 AudioRingBuffer::AudioRingBuffer(bool isStereo) :
     NodeData(NULL),
+    _isStereo(isStereo),
+    _isJitterBufferAdaptive(true),
+    _jitterBufferSamples(0),
+    _manualJitterBufferSamples(NO_MANUAL_JITTER_BUFFER_SAMPLES),
     _endOfLastWrite(NULL),
+    _codec(AUDIO_CODEC_PCM),
+    _lastFrameArrivalUsecs(0),
+    _interArrivalStDevMsecs(0.0f),
+    _numFramesArrived(0),
+    _numStarvesAtLastAdapt(0),
+    _numOverflowedFrames(0),
     _isStarted(false),
-    _isStereo(isStereo)
+    _numConcealedFramesInARow(0),
+    _numFramesArrivedAtLastConceal(0),
+    _numStarves(0),
+    _numConcealedFrames(0),
+    _numTrimmedFrames(0)
 {
     _buffer = new int16_t[RING_BUFFER_LENGTH_SAMPLES];
     _nextOutput = _buffer;
@@ -28,50 +56,183 @@ AudioRingBuffer::~AudioRingBuffer() {
 }
 
 void AudioRingBuffer::reset() {
-    _endOfLastWrite = _buffer;
-    _nextOutput = _buffer;
-    _isStarted = false;
+    // only the writer moves the end of the last write, so catch up to it rather than starting both over
+    int16_t* endOfLastWrite = getEndOfLastWrite();
+    if (endOfLastWrite) {
+        setNextOutput(endOfLastWrite);
+    }
+    setStarted(false);
 }
 
 int AudioRingBuffer::parseData(unsigned char* sourceBuffer, int numBytes) {
     int numBytesPacketHeader = numBytesForPacketHeader(sourceBuffer);
+    _codec = sourceBuffer[1];
+    
+    if (sourceBuffer[0] == PACKET_TYPE_SILENT_AUDIO_FRAME) {
+        addSilentFrame();
+        return numBytesPacketHeader;
+    }
+    
     return parseAudioSamples(sourceBuffer + numBytesPacketHeader, numBytes - numBytesPacketHeader);
 }
 
 int AudioRingBuffer::parseAudioSamples(unsigned char* sourceBuffer, int numBytes) {
     // make sure we have enough bytes left for this to be the right amount of audio
     // otherwise we should not copy that data, and leave the buffer pointers where they are
-    int samplesToCopy = BUFFER_LENGTH_SAMPLES_PER_CHANNEL * (_isStereo ? 2 : 1);
+    int16_t samples[BUFFER_LENGTH_SAMPLES_PER_CHANNEL * 2];
+    int numBytesRead = decodeAudioFrame(_codec, sourceBuffer, numBytes,
+                                        samples, BUFFER_LENGTH_SAMPLES_PER_CHANNEL, _isStereo ? 2 : 1);
+    if (numBytesRead) {
+        timeFrameArrival();
+        writeFrame(samples);
+    }
+    return numBytesRead;
+}
+
+void AudioRingBuffer::addSilentFrame() {
+    timeFrameArrival();
+    writeFrame(NULL);
+}
+
+void AudioRingBuffer::timeFrameArrival() {
+    uint64_t now = usecTimestampNow();
+    if (_lastFrameArrivalUsecs) {
+        const float USECS_PER_MSEC = 1000.0f;
+        _interArrivalStats.addValue((now - _lastFrameArrivalUsecs) / USECS_PER_MSEC);
+    }
+    _lastFrameArrivalUsecs = now;
+    atomicStoreRelease(&_numFramesArrived, _numFramesArrived + 1);
     
-    if (numBytes == samplesToCopy * sizeof(int16_t)) {
+    if (_interArrivalStats.getSamples() >= JITTER_STATS_FRAMES) {
+        float interArrivalStDevMsecs = _interArrivalStats.getStDev();
+        atomicStoreRelease(&_interArrivalStDevMsecs, interArrivalStDevMsecs);
+        _interArrivalStats.reset();
         
-        if (!_endOfLastWrite) {
-            _endOfLastWrite = _buffer;
-        } else if (diffLastWriteNextOutput() > RING_BUFFER_LENGTH_SAMPLES - samplesToCopy) {
-            _endOfLastWrite = _buffer;
-            _nextOutput = _buffer;
-            _isStarted = false;
+        if (atomicLoadAcquire(&_isJitterBufferAdaptive)) {
+            // this is also how the buffer shrinks again after a starve, once the link has settled down
+            const float MSECS_PER_SECOND = 1000.0f;
+            int jitterBufferSamples = NUM_JITTER_STANDARD_DEVIATIONS * interArrivalStDevMsecs / MSECS_PER_SECOND
+                * SAMPLE_RATE;
+            applyJitterBufferSamples(jitterBufferSamples);
         }
-        
-        memcpy(_endOfLastWrite, sourceBuffer, numBytes);
-        
-        _endOfLastWrite += samplesToCopy;
-        
-        if (_endOfLastWrite >= _buffer + RING_BUFFER_LENGTH_SAMPLES) {
-            _endOfLastWrite = _buffer;
+    }
+    
+    // after adapting, so one set by hand holds until the buffer next adapts
+    int manualJitterBufferSamples = atomicExchange(&_manualJitterBufferSamples, NO_MANUAL_JITTER_BUFFER_SAMPLES);
+    if (manualJitterBufferSamples != NO_MANUAL_JITTER_BUFFER_SAMPLES) {
+        applyJitterBufferSamples(manualJitterBufferSamples);
+    }
+}
+
+int AudioRingBuffer::getMaxJitterBufferSamples() const {
+    // half of what's left besides the frame being played and one coming in, so there's room to trim back down
+    return (RING_BUFFER_LENGTH_SAMPLES / getSamplesPerFrame() - 2) / 2 * BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
+}
+
+int AudioRingBuffer::getJitterBufferSamples() const {
+    // one set by hand counts from when it's set, even if no frame has come in to take it yet
+    int jitterBufferSamples = atomicLoadAcquire(&_manualJitterBufferSamples);
+    if (jitterBufferSamples != NO_MANUAL_JITTER_BUFFER_SAMPLES) {
+        return glm::clamp(jitterBufferSamples, 0, getMaxJitterBufferSamples());
+    }
+    
+    jitterBufferSamples = atomicLoadAcquire(&_jitterBufferSamples);
+    if (atomicLoadAcquire(&_isJitterBufferAdaptive)) {
+        // the reader can't change what the writer adapts, so the starves since then are added on here
+        int numStarvesSinceAdapt = atomicLoadAcquire(&_numStarves) - atomicLoadAcquire(&_numStarvesAtLastAdapt);
+        jitterBufferSamples += numStarvesSinceAdapt * BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
+    }
+    return glm::clamp(jitterBufferSamples, 0, getMaxJitterBufferSamples());
+}
+
+void AudioRingBuffer::setJitterBufferSamples(int jitterBufferSamples) {
+    atomicStoreRelease(&_manualJitterBufferSamples, glm::max(0, jitterBufferSamples));
+}
+
+void AudioRingBuffer::applyJitterBufferSamples(int jitterBufferSamples) {
+    atomicStoreRelease(&_numStarvesAtLastAdapt, atomicLoadAcquire(&_numStarves));
+    atomicStoreRelease(&_jitterBufferSamples, glm::clamp(jitterBufferSamples, 0, getMaxJitterBufferSamples()));
+}
+
+void AudioRingBuffer::trimToJitterBuffer() {
+    int channels = _isStereo ? 2 : 1;
+    int maxBufferedSamples = 2 * getSamplesPerFrame() + getJitterBufferSamples() * channels;
+    while (_isStarted && diffLastWriteNextOutput() > maxBufferedSamples) {
+        int16_t* nextOutput = _nextOutput + getSamplesPerFrame();
+        if (nextOutput >= _buffer + RING_BUFFER_LENGTH_SAMPLES) {
+            nextOutput = _buffer;
         }
-        
-        return numBytes;
+        setNextOutput(nextOutput);
+        atomicStoreRelease(&_numTrimmedFrames, _numTrimmedFrames + 1);
+    }
+}
+
+bool AudioRingBuffer::concealMissingFrame(int16_t* destination) {
+    int numFramesArrived = atomicLoadAcquire(&_numFramesArrived);
+    if (numFramesArrived != _numFramesArrivedAtLastConceal) {
+        // something has come in since we last covered for a frame, so this is the first of a new run
+        _numFramesArrivedAtLastConceal = numFramesArrived;
+        _numConcealedFramesInARow = 0;
+    }
+    
+    if (!getEndOfLastWrite() || _numConcealedFramesInARow >= MAX_CONCEALED_FRAMES) {
+        return false;
+    }
+    _numConcealedFramesInARow++;
+    atomicStoreRelease(&_numConcealedFrames, _numConcealedFrames + 1);
+    
+    // the frame last played is still there, right before the next output
+    const int16_t* lastFrame = (_nextOutput == _buffer)
+        ? _buffer + RING_BUFFER_LENGTH_SAMPLES - getSamplesPerFrame()
+        : _nextOutput - getSamplesPerFrame();
+    
+    float fade = powf(CONCEALED_FRAME_FADE, _numConcealedFramesInARow);
+    for (int i = 0; i < getSamplesPerFrame(); i++) {
+        destination[i] = lastFrame[i] * fade;
+    }
+    return true;
+}
+
+void AudioRingBuffer::starve() {
+    // getJitterBufferSamples() gives the buffer the extra frame for this
+    setStarted(false);
+    atomicStoreRelease(&_numStarves, _numStarves + 1);
+}
+
+void AudioRingBuffer::writeFrame(const int16_t* samples) {
+    int samplesToCopy = getSamplesPerFrame();
+    
+    int16_t* endOfLastWrite = _endOfLastWrite;
+    if (!endOfLastWrite) {
+        endOfLastWrite = _buffer;
+    } else if (diffLastWriteNextOutput() > RING_BUFFER_LENGTH_SAMPLES - 2 * samplesToCopy) {
+        // full, the next frame along is the one the reader last played out
+        atomicStoreRelease(&_numOverflowedFrames, _numOverflowedFrames + 1);
+        return;
+    }
+    
+    if (samples) {
+        memcpy(endOfLastWrite, samples, samplesToCopy * sizeof(int16_t));
     } else {
-        return 0;
-    }    
+        memset(endOfLastWrite, 0, samplesToCopy * sizeof(int16_t));
+    }
+    
+    endOfLastWrite += samplesToCopy;
+    
+    if (endOfLastWrite >= _buffer + RING_BUFFER_LENGTH_SAMPLES) {
+        endOfLastWrite = _buffer;
+    }
+    
+    // the reader can have the frame now it's all there
+    atomicStoreRelease(&_endOfLastWrite, endOfLastWrite);
 }
 
 int AudioRingBuffer::diffLastWriteNextOutput() const {
-    if (!_endOfLastWrite) {
+    int16_t* endOfLastWrite = getEndOfLastWrite();
+    if (!endOfLastWrite) {
         return 0;
     } else {
-        int sampleDifference = _endOfLastWrite - _nextOutput;
+        int sampleDifference = endOfLastWrite - getNextOutput();
         
         if (sampleDifference < 0) {
             sampleDifference += RING_BUFFER_LENGTH_SAMPLES;
@@ -14,7 +14,10 @@
 
 #include <glm/glm.hpp>
 
+#include "AtomicUtil.h"
 #include "NodeData.h"
+#include "PacketHeaders.h"
+#include "StdDev.h"
 
 const float SAMPLE_RATE = 22050.0;
 
@@ -25,41 +28,119 @@ const int BUFFER_LENGTH_SAMPLES_PER_CHANNEL = BUFFER_LENGTH_BYTES_PER_CHANNEL /
 const short RING_BUFFER_LENGTH_FRAMES = 20;
 const short RING_BUFFER_LENGTH_SAMPLES = RING_BUFFER_LENGTH_FRAMES * BUFFER_LENGTH_SAMPLES_PER_CHANNEL;
 
+// how many frames in a row a missing frame is papered over with the one before it, before we let the buffer starve
+const int MAX_CONCEALED_FRAMES = 3;
+
+// A single producer, single consumer ring of frames. One thread (the writer) parses packets into it while another
+// (the reader) plays it out, and neither ever waits on the other: each side only moves its own end of the buffer, and
+// publishes it with a release store once the samples it covers are written or done with. Everything marked as the
+// reader's below is only to be called from the reading thread, everything else that changes the buffer only from the
+// writing one. When the buffer is full the frame coming in is dropped, the frame last played out is never written
+// over since concealment and the effects that look back a frame still read it.
 class AudioRingBuffer : public NodeData {
 public:
     AudioRingBuffer(bool isStereo);
     ~AudioRingBuffer();
 
+    // reader: drops whatever is buffered and waits for the jitter buffer to fill again
     void reset();
 
+    // writer
     int parseData(unsigned char* sourceBuffer, int numBytes);
+    // writer: reads a frame in whatever codec the last packet parsed said it's in
     int parseAudioSamples(unsigned char* sourceBuffer, int numBytes);
+    
+    // writer: what a PACKET_TYPE_SILENT_AUDIO_FRAME stands for, keeps the buffer going without a packet full of zeros
+    void addSilentFrame();
 
-    int16_t* getNextOutput() const { return _nextOutput; }
-    void setNextOutput(int16_t* nextOutput) { _nextOutput = nextOutput; }
+    // reader: the frame after the one last played out, samples before the end of the last write are safe to read
+    int16_t* getNextOutput() const { return atomicLoadAcquire(&_nextOutput); }
+    void setNextOutput(int16_t* nextOutput) { atomicStoreRelease(&_nextOutput, nextOutput); }
     
-    int16_t* getEndOfLastWrite() const { return _endOfLastWrite; }
-    void setEndOfLastWrite(int16_t* endOfLastWrite) { _endOfLastWrite = endOfLastWrite; }
+    int16_t* getEndOfLastWrite() const { return atomicLoadAcquire(&_endOfLastWrite); }
     
     int16_t* getBuffer() const { return _buffer; }
     
-    bool isStarted() const { return _isStarted; }
-    void setStarted(bool isStarted) { _isStarted = isStarted; }
+    bool isStarted() const { return atomicLoadAcquire(&_isStarted); }
+    void setStarted(bool isStarted) { atomicStoreRelease(&_isStarted, isStarted); }
     
     int diffLastWriteNextOutput() const;
     
     bool isStereo() const { return _isStereo; }
     
+    // Samples per channel we want buffered past the frame being played. Unless it's set by hand it adapts to the
+    // stream, to a few standard deviations of the time between its frames arriving, and a frame more each starve.
+    // Both can be called from any thread. A value set by hand is handed to the writer, which takes it in with the
+    // next frame, so the writer is the only one that ever changes the jitter buffer.
+    int getJitterBufferSamples() const;
+    void setJitterBufferSamples(int jitterBufferSamples);
+    void setAdaptiveJitterBuffer(bool isAdaptive) { atomicStoreRelease(&_isJitterBufferAdaptive, isAdaptive); }
+    
+    // reader: drops frames from the front of the buffer while there's more than a frame beyond the jitter buffer
+    void trimToJitterBuffer();
+    
+    // reader: packet loss concealment, for when the next frame should be played but hasn't arrived. Fills destination
+    // with the last frame played at a lower volume, or returns false once we've done that MAX_CONCEALED_FRAMES
+    // times in a row and the buffer should starve.
+    bool concealMissingFrame(int16_t* destination);
+    
+    // reader: we ran out of samples, so wait for the buffer to fill back up and give it more room next time
+    void starve();
+    
+    float getInterArrivalStDevMsecs() const { return atomicLoadAcquire(&_interArrivalStDevMsecs); }
+    int getNumStarves() const { return atomicLoadAcquire(&_numStarves); }
+    int getNumConcealedFrames() const { return atomicLoadAcquire(&_numConcealedFrames); }
+    int getNumDroppedFrames() const {
+        return atomicLoadAcquire(&_numOverflowedFrames) + atomicLoadAcquire(&_numTrimmedFrames);
+    }
+    
+    // the codec the stream's packets are in
+    PACKET_VERSION getCodec() const { return _codec; }
+    
 protected:
     // disallow copying of AudioRingBuffer objects
     AudioRingBuffer(const AudioRingBuffer&);
     AudioRingBuffer& operator= (const AudioRingBuffer&);
     
-    int16_t* _nextOutput;
-    int16_t* _endOfLastWrite;
+    // writer: writes a frame of samples, or of silence if samples is NULL, unless the buffer is full
+    void writeFrame(const int16_t* samples);
+    
+    // writer: keeps the statistics for the adaptive jitter buffer, for each frame that comes in
+    void timeFrameArrival();
+    
+    // writer: the jitter buffer starts over from jitterBufferSamples
+    void applyJitterBufferSamples(int jitterBufferSamples);
+    
+    int getSamplesPerFrame() const { return BUFFER_LENGTH_SAMPLES_PER_CHANNEL * (_isStereo ? 2 : 1); }
+    int getMaxJitterBufferSamples() const;
+    
     int16_t* _buffer;
-    bool _isStarted;
     bool _isStereo;
+    bool _isJitterBufferAdaptive;
+    int _jitterBufferSamples; // as last adapted by the writer, or set by hand
+    int _manualJitterBufferSamples; // set by hand and not yet taken in by the writer, if it isn't negative
+    
+    // the writer's
+    char _writerPadding[CACHE_LINE_BYTES];
+    int16_t* _endOfLastWrite;
+    PACKET_VERSION _codec;
+    StDev _interArrivalStats;
+    uint64_t _lastFrameArrivalUsecs;
+    float _interArrivalStDevMsecs;
+    int _numFramesArrived;
+    int _numStarvesAtLastAdapt;
+    int _numOverflowedFrames;
+    
+    // the reader's
+    char _readerPadding[CACHE_LINE_BYTES];
+    int16_t* _nextOutput;
+    bool _isStarted;
+    int _numConcealedFramesInARow;
+    int _numFramesArrivedAtLastConceal;
+    int _numStarves;
+    int _numConcealedFrames;
+    int _numTrimmedFrames;
+    char _endPadding[CACHE_LINE_BYTES];
 };
 
 #endif /* defined(__interface__AudioRingBuffer__) */
@@ -17,6 +17,7 @@
 #include <glm/gtc/quaternion.hpp>
 
 #include <NodeData.h>
+#include "AvatarStateStream.h"
 #include "HeadData.h"
 #include "HandData.h"
 
@@ -104,6 +105,9 @@ public:
     void setHeadData(HeadData* headData) { _headData = headData; }
     void setHandData(HandData* handData) { _handData = handData; }
     
+    // the states of this avatar that came from the avatar mixer, for it to send the next ones against
+    AvatarStateHistory& getReceivedStates() { return _receivedStates; }
+    
 protected:
     glm::vec3 _position;
     glm::vec3 _handPosition;
@@ -141,6 +145,8 @@ protected:
     HeadData* _headData;
     HandData* _handData;
     
+    AvatarStateHistory _receivedStates;
+    
 private:
     // privatize the copy constructor and assignment operator so they cannot be called
     AvatarData(const AvatarData&);
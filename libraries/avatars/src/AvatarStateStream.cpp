@@ -0,0 +1,393 @@
+//
+//  AvatarStateStream.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include <NodeList.h>
+#include <NodeTypes.h>
+#include <PacketHeaders.h>
+#include <SharedUtil.h>
+
+#include "AvatarData.h"
+#include "AvatarStateStream.h"
+
+// the fields of getBroadcastData(), in the order it writes them
+enum AvatarStateField {
+    POSITION_FIELD = 0,
+    BODY_ROTATION_FIELD,
+    HEAD_ROTATION_FIELD,
+    HEAD_LEAN_FIELD,
+    HAND_POSITION_FIELD,
+    LOOK_AT_POSITION_FIELD,
+    AUDIO_LOUDNESS_FIELD,
+    CAMERA_FIELD,
+    CHAT_MESSAGE_FIELD,
+    BIT_ITEMS_FIELD,
+    FINGERS_FIELD,
+    JOINTS_FIELD,
+    NUM_AVATAR_STATE_FIELDS
+};
+
+// the bytes in each field that's always the same size, 0 for the ones that start with a count
+static const int FIXED_FIELD_BYTES[NUM_AVATAR_STATE_FIELDS] = { 12, 6, 6, 8, 12, 12, 4, 28, 0, 1, 0, 0 };
+
+// the field mask has a bit for each field that's in the packed state, and these two flags
+const uint16_t ALL_FIELDS_MASK = (1 << NUM_AVATAR_STATE_FIELDS) - 1;
+const uint16_t POSITION_OFFSET_BIT = 1 << 14;
+const uint16_t HAS_BASELINE_BIT = 1 << 15;
+
+// an offset from the baseline's position is sent as 8.8 fixed point, to about 4mm and up to just under 128m
+const int POSITION_OFFSET_RADIX = 8;
+const float MAX_POSITION_OFFSET = 127.0f;
+const int PACKED_POSITION_OFFSET_BYTES = 3 * sizeof(int16_t);
+
+// the bytes in the field that starts at fieldStart, or 0 if there aren't that many left
+static int bytesForField(int field, const unsigned char* fieldStart, int bytesLeft) {
+    int numBytes = FIXED_FIELD_BYTES[field];
+    if (numBytes == 0 && bytesLeft > 0) {
+        switch (field) {
+            case CHAT_MESSAGE_FIELD:
+                numBytes = 1 + fieldStart[0];
+                break;
+            case FINGERS_FIELD:
+                numBytes = 1 + fieldStart[0] * 3 * sizeof(int16_t);
+                break;
+            case JOINTS_FIELD:
+                numBytes = 1 + fieldStart[0] * (1 + 4 * sizeof(uint16_t));
+                break;
+        }
+    }
+    return (numBytes > 0 && numBytes <= bytesLeft) ? numBytes : 0;
+}
+
+// fills fieldOffsets with where each field starts plus where the last one ends, false if they don't add up
+static bool findFields(const unsigned char* broadcastData, int numBytes, int* fieldOffsets) {
+    int offset = 0;
+    for (int field = 0; field < NUM_AVATAR_STATE_FIELDS; field++) {
+        fieldOffsets[field] = offset;
+        int fieldBytes = bytesForField(field, broadcastData + offset, numBytes - offset);
+        if (fieldBytes == 0) {
+            return false;
+        }
+        offset += fieldBytes;
+    }
+    fieldOffsets[NUM_AVATAR_STATE_FIELDS] = offset;
+    return offset == numBytes;
+}
+
+bool AvatarState::setBroadcastData(const unsigned char* broadcastData, int numBytes) {
+    int fieldOffsets[NUM_AVATAR_STATE_FIELDS + 1];
+    if (!findFields(broadcastData, numBytes, fieldOffsets)) {
+        return false;
+    }
+    _broadcastData.assign(broadcastData, broadcastData + numBytes);
+    return true;
+}
+
+AvatarStateHistory::AvatarStateHistory() :
+    _oldestIndex(0) {
+}
+
+void AvatarStateHistory::add(uint16_t sequence, const AvatarState& state) {
+    for (int i = 0; i < _sequences.size(); i++) {
+        if (_sequences[i] == sequence) {
+            _states[i] = state;
+            return;
+        }
+    }
+
+    if (_sequences.size() < AVATAR_STATE_HISTORY) {
+        _sequences.push_back(sequence);
+        _states.push_back(state);
+    } else {
+        _sequences[_oldestIndex] = sequence;
+        _states[_oldestIndex] = state;
+        _oldestIndex = (_oldestIndex + 1) % AVATAR_STATE_HISTORY;
+    }
+}
+
+const AvatarState* AvatarStateHistory::find(uint16_t sequence) const {
+    for (int i = 0; i < _sequences.size(); i++) {
+        if (_sequences[i] == sequence) {
+            return &_states[i];
+        }
+    }
+    return NULL;
+}
+
+int packAvatarState(const AvatarState& state, uint16_t sequence, const AvatarState* baseline,
+                    uint16_t baselineSequence, unsigned char* destination, AvatarState& sentState) {
+    int fieldOffsets[NUM_AVATAR_STATE_FIELDS + 1];
+    findFields(state.getBroadcastData(), state.getNumBytes(), fieldOffsets);
+
+    int baselineFieldOffsets[NUM_AVATAR_STATE_FIELDS + 1];
+    if (baseline) {
+        findFields(baseline->getBroadcastData(), baseline->getNumBytes(), baselineFieldOffsets);
+    }
+
+    unsigned char* destinationStart = destination;
+    memcpy(destination, &sequence, sizeof(sequence));
+    destination += sizeof(sequence);
+
+    // the mask goes in once we know what's in it
+    unsigned char* fieldMaskPosition = destination;
+    destination += sizeof(uint16_t);
+    uint16_t fieldMask = 0;
+
+    if (baseline) {
+        fieldMask |= HAS_BASELINE_BIT;
+        memcpy(destination, &baselineSequence, sizeof(baselineSequence));
+        destination += sizeof(baselineSequence);
+    }
+
+    // the receiver's copy of the state, built up alongside
+    unsigned char sentBytes[MAX_AVATAR_BROADCAST_BYTES];
+    unsigned char* sentPosition = sentBytes;
+
+    for (int field = 0; field < NUM_AVATAR_STATE_FIELDS; field++) {
+        const unsigned char* fieldData = state.getBroadcastData() + fieldOffsets[field];
+        int fieldBytes = fieldOffsets[field + 1] - fieldOffsets[field];
+
+        if (baseline) {
+            const unsigned char* baselineFieldData = baseline->getBroadcastData() + baselineFieldOffsets[field];
+            int baselineFieldBytes = baselineFieldOffsets[field + 1] - baselineFieldOffsets[field];
+
+            bool isUnchanged = fieldBytes == baselineFieldBytes &&
+                memcmp(fieldData, baselineFieldData, fieldBytes) == 0;
+
+            if (!isUnchanged && field == POSITION_FIELD) {
+                glm::vec3 position, baselinePosition;
+                memcpy(&position, fieldData, sizeof(position));
+                memcpy(&baselinePosition, baselineFieldData, sizeof(baselinePosition));
+                glm::vec3 offset = position - baselinePosition;
+
+                // this is false for a NaN too, which goes as it is
+                if (fabsf(offset.x) < MAX_POSITION_OFFSET && fabsf(offset.y) < MAX_POSITION_OFFSET &&
+                    fabsf(offset.z) < MAX_POSITION_OFFSET) {
+
+                    unsigned char* packedOffset = destination;
+                    packFloatScalarToSignedTwoByteFixed(packedOffset, offset.x, POSITION_OFFSET_RADIX);
+                    packFloatScalarToSignedTwoByteFixed(packedOffset + 2, offset.y, POSITION_OFFSET_RADIX);
+                    packFloatScalarToSignedTwoByteFixed(packedOffset + 4, offset.z, POSITION_OFFSET_RADIX);
+
+                    glm::vec3 sentOffset;
+                    unpackFloatScalarFromSignedTwoByteFixed((int16_t*) packedOffset, &sentOffset.x,
+                                                            POSITION_OFFSET_RADIX);
+                    unpackFloatScalarFromSignedTwoByteFixed((int16_t*) (packedOffset + 2), &sentOffset.y,
+                                                            POSITION_OFFSET_RADIX);
+                    unpackFloatScalarFromSignedTwoByteFixed((int16_t*) (packedOffset + 4), &sentOffset.z,
+                                                            POSITION_OFFSET_RADIX);
+
+                    // moving less than the offset can show isn't moving as far as the receiver's concerned
+                    if (sentOffset != glm::vec3(0.0f, 0.0f, 0.0f)) {
+                        glm::vec3 sentPositionValue = baselinePosition + sentOffset;
+                        memcpy(sentPosition, &sentPositionValue, sizeof(sentPositionValue));
+                        sentPosition += sizeof(sentPositionValue);
+
+                        destination += PACKED_POSITION_OFFSET_BYTES;
+                        fieldMask |= (1 << field) | POSITION_OFFSET_BIT;
+                        continue;
+                    }
+                    isUnchanged = true;
+                }
+            }
+
+            if (isUnchanged) {
+                memcpy(sentPosition, baselineFieldData, baselineFieldBytes);
+                sentPosition += baselineFieldBytes;
+                continue;
+            }
+        }
+
+        memcpy(destination, fieldData, fieldBytes);
+        destination += fieldBytes;
+        fieldMask |= 1 << field;
+
+        memcpy(sentPosition, fieldData, fieldBytes);
+        sentPosition += fieldBytes;
+    }
+
+    memcpy(fieldMaskPosition, &fieldMask, sizeof(fieldMask));
+    sentState.setBroadcastData(sentBytes, sentPosition - sentBytes);
+
+    return destination - destinationStart;
+}
+
+int unpackAvatarState(const unsigned char* source, int numBytes, const AvatarStateHistory& history,
+                      uint16_t& sequence, AvatarState& state, bool& hasBaseline) {
+    const unsigned char* sourceStart = source;
+    const unsigned char* sourceEnd = source + numBytes;
+
+    uint16_t fieldMask;
+    if (numBytes < sizeof(sequence) + sizeof(fieldMask)) {
+        return 0;
+    }
+    memcpy(&sequence, source, sizeof(sequence));
+    source += sizeof(sequence);
+    memcpy(&fieldMask, source, sizeof(fieldMask));
+    source += sizeof(fieldMask);
+
+    const AvatarState* baseline = NULL;
+    int baselineFieldOffsets[NUM_AVATAR_STATE_FIELDS + 1];
+
+    if (fieldMask & HAS_BASELINE_BIT) {
+        uint16_t baselineSequence;
+        if (sourceEnd - source < sizeof(baselineSequence)) {
+            return 0;
+        }
+        memcpy(&baselineSequence, source, sizeof(baselineSequence));
+        source += sizeof(baselineSequence);
+
+        baseline = history.find(baselineSequence);
+        if (baseline) {
+            findFields(baseline->getBroadcastData(), baseline->getNumBytes(), baselineFieldOffsets);
+        }
+    } else if ((fieldMask & ALL_FIELDS_MASK) != ALL_FIELDS_MASK) {
+        // without a baseline every field has to be there
+        return 0;
+    }
+    hasBaseline = baseline || !(fieldMask & HAS_BASELINE_BIT);
+
+    unsigned char stateBytes[MAX_AVATAR_BROADCAST_BYTES];
+    unsigned char* statePosition = stateBytes;
+
+    for (int field = 0; field < NUM_AVATAR_STATE_FIELDS; field++) {
+        if (!(fieldMask & (1 << field))) {
+            if (baseline) {
+                int baselineFieldBytes = baselineFieldOffsets[field + 1] - baselineFieldOffsets[field];
+                memcpy(statePosition, baseline->getBroadcastData() + baselineFieldOffsets[field], baselineFieldBytes);
+                statePosition += baselineFieldBytes;
+            }
+            continue;
+        }
+
+        if (field == POSITION_FIELD && (fieldMask & POSITION_OFFSET_BIT)) {
+            if (sourceEnd - source < PACKED_POSITION_OFFSET_BYTES) {
+                return 0;
+            }
+
+            glm::vec3 offset;
+            source += unpackFloatScalarFromSignedTwoByteFixed((int16_t*) source, &offset.x, POSITION_OFFSET_RADIX);
+            source += unpackFloatScalarFromSignedTwoByteFixed((int16_t*) source, &offset.y, POSITION_OFFSET_RADIX);
+            source += unpackFloatScalarFromSignedTwoByteFixed((int16_t*) source, &offset.z, POSITION_OFFSET_RADIX);
+
+            if (baseline) {
+                glm::vec3 position;
+                memcpy(&position, baseline->getBroadcastData() + baselineFieldOffsets[field], sizeof(position));
+                position += offset;
+                memcpy(statePosition, &position, sizeof(position));
+                statePosition += sizeof(position);
+            }
+            continue;
+        }
+
+        int fieldBytes = bytesForField(field, source, sourceEnd - source);
+        if (fieldBytes == 0) {
+            return 0;
+        }
+        memcpy(statePosition, source, fieldBytes);
+        statePosition += fieldBytes;
+        source += fieldBytes;
+    }
+
+    if (hasBaseline) {
+        state.setBroadcastData(stateBytes, statePosition - stateBytes);
+    }
+    return source - sourceStart;
+}
+
+void processBulkAvatarData(sockaddr* senderAddress, unsigned char* packetData, int numTotalBytes) {
+    NodeList* nodeList = NodeList::getInstance();
+
+    // the lock keeps the nodes' linked data ours to change, the scope keeps the index buckets we look them up in around
+    NodeListReadScope readScope(nodeList);
+    nodeList->lock();
+
+    // find the avatar mixer in our node list and update the lastRecvTime from it
+    Node* bulkSendNode = nodeList->nodeWithAddress(senderAddress);
+
+    if (bulkSendNode) {
+        bulkSendNode->setLastHeardMicrostamp(usecTimestampNow());
+        bulkSendNode->recordBytesReceived(numTotalBytes);
+    }
+
+    unsigned char* currentPosition = packetData + numBytesForPacketHeader(packetData);
+    unsigned char* endPosition = packetData + numTotalBytes;
+
+    uint16_t packetSequence;
+    if (endPosition - currentPosition < sizeof(packetSequence)) {
+        nodeList->unlock();
+        return;
+    }
+    memcpy(&packetSequence, currentPosition, sizeof(packetSequence));
+    currentPosition += sizeof(packetSequence);
+
+    // each avatar goes to its node as head data, which is a header, the node ID and the broadcast data
+    unsigned char packetHolder[MAX_PACKET_HEADER_BYTES + sizeof(uint16_t) + MAX_AVATAR_BROADCAST_BYTES];
+    int numBytesPacketHeader = populateTypeAndVersion(packetHolder, PACKET_TYPE_HEAD_DATA);
+
+    AvatarStateHistory emptyHistory;
+    AvatarState state;
+    bool hasEveryState = true;
+
+    while (endPosition - currentPosition >= sizeof(uint16_t)) {
+        uint16_t nodeID;
+        currentPosition += unpackNodeId(currentPosition, &nodeID);
+
+        Node* matchingNode = nodeList->nodeWithID(nodeID);
+
+        if (!matchingNode) {
+            // we're missing this node, we need to add it to the list
+            matchingNode = nodeList->addOrUpdateNode(NULL, NULL, NODE_TYPE_AGENT, nodeID);
+        }
+
+        if (!matchingNode->getLinkedData() && nodeList->linkedDataCreateCallback) {
+            nodeList->linkedDataCreateCallback(matchingNode);
+        }
+        AvatarData* avatarData = (AvatarData*) matchingNode->getLinkedData();
+
+        uint16_t stateSequence;
+        bool hasBaseline;
+        int numStateBytes = unpackAvatarState(currentPosition, endPosition - currentPosition,
+                                              avatarData ? avatarData->getReceivedStates() : emptyHistory,
+                                              stateSequence, state, hasBaseline);
+        if (numStateBytes == 0) {
+            // the rest of the packet can't be read
+            hasEveryState = false;
+            break;
+        }
+        currentPosition += numStateBytes;
+
+        if (!hasBaseline || !avatarData) {
+            hasEveryState = false;
+            continue;
+        }
+        avatarData->getReceivedStates().add(stateSequence, state);
+
+        unsigned char* holderPosition = packetHolder + numBytesPacketHeader;
+        holderPosition += packNodeId(holderPosition, nodeID);
+        memcpy(holderPosition, state.getBroadcastData(), state.getNumBytes());
+        holderPosition += state.getNumBytes();
+
+        nodeList->updateNodeWithData(matchingNode, packetHolder, holderPosition - packetHolder);
+    }
+
+    nodeList->unlock();
+
+    // only ack a packet we could read all of, its states are the baselines the mixer sends the next ones against
+    if (hasEveryState) {
+        unsigned char ackPacket[MAX_PACKET_HEADER_BYTES + sizeof(packetSequence)];
+        int numAckBytes = populateTypeAndVersion(ackPacket, PACKET_TYPE_BULK_AVATAR_DATA_ACK);
+        memcpy(ackPacket + numAckBytes, &packetSequence, sizeof(packetSequence));
+        numAckBytes += sizeof(packetSequence);
+
+        nodeList->getNodeSocket()->send(senderAddress, ackPacket, numAckBytes);
+    }
+}
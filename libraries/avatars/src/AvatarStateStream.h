@@ -0,0 +1,73 @@
+//
+//  AvatarStateStream.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  The avatar mixer sends each agent the other avatars as a stream of states, most of them only the fields that
+//  changed since a state the agent has said it got. Every bulk avatar packet has a sequence number, and the agent
+//  acks each one it could read all of with a PACKET_TYPE_BULK_AVATAR_DATA_ACK. The states in an acked packet can be
+//  used as baselines from then on, until AVATAR_STATE_HISTORY newer ones have been sent and the agent could have
+//  dropped it. Without a baseline the whole state is sent.
+//
+//  A state is the output of AvatarData::getBroadcastData(), in fields that are either sent whole or not at all. The
+//  position is sent as a fixed point offset from the baseline's when it's close enough.
+//
+
+#ifndef __hifi__AvatarStateStream__
+#define __hifi__AvatarStateStream__
+
+#include <stdint.h>
+#include <vector>
+
+#include <UDPSocket.h>
+
+// more than getBroadcastData() can write for one avatar, even with a full chat message, fingers and every joint
+const int MAX_AVATAR_BROADCAST_BYTES = 4608;
+
+// how many states of each avatar both ends hold on to, to be baselines
+const int AVATAR_STATE_HISTORY = 8;
+
+class AvatarState {
+public:
+    // takes the output of AvatarData::getBroadcastData(), returns false if it's cut short
+    bool setBroadcastData(const unsigned char* broadcastData, int numBytes);
+
+    const unsigned char* getBroadcastData() const { return &_broadcastData[0]; }
+    int getNumBytes() const { return _broadcastData.size(); }
+
+private:
+    std::vector<unsigned char> _broadcastData;
+};
+
+// the last AVATAR_STATE_HISTORY states added, by their sequence number
+class AvatarStateHistory {
+public:
+    AvatarStateHistory();
+
+    void add(uint16_t sequence, const AvatarState& state);
+    const AvatarState* find(uint16_t sequence) const; // NULL if it isn't one of them
+
+private:
+    std::vector<uint16_t> _sequences;
+    std::vector<AvatarState> _states;
+    int _oldestIndex;
+};
+
+// Writes state, only the fields that differ from baseline's if there is one. sentState is left as the state the
+// receiver ends up with, which with a quantized position isn't quite state, so that's what to keep as a baseline.
+// Returns the bytes written, which is never more than the bytes in the state plus 6.
+int packAvatarState(const AvatarState& state, uint16_t sequence, const AvatarState* baseline,
+                    uint16_t baselineSequence, unsigned char* destination, AvatarState& sentState);
+
+// Reads a state written by packAvatarState(), its baseline out of history. Returns the bytes read, or 0 if it isn't
+// a whole state. If its baseline isn't in history the bytes are still read, but hasBaseline is false and state isn't
+// set.
+int unpackAvatarState(const unsigned char* source, int numBytes, const AvatarStateHistory& history,
+                      uint16_t& sequence, AvatarState& state, bool& hasBaseline);
+
+// Hands each avatar in a PACKET_TYPE_BULK_AVATAR_DATA to its node, as though it was head data from the avatar
+// itself, then acks the packet to the avatar mixer if every avatar in it could be read.
+void processBulkAvatarData(sockaddr* senderAddress, unsigned char* packetData, int numTotalBytes);
+
+#endif /* defined(__hifi__AvatarStateStream__) */
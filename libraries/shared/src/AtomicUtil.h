@@ -0,0 +1,72 @@
+//
+//  AtomicUtil.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Loads and stores for values one thread writes and another reads without taking a lock. Everything a thread wrote
+//  before a release store is visible to a thread that sees the stored value with an acquire load. Only for things
+//  the size of a pointer or smaller, and atomicExchange() only for things the size of a long. Two threads that each
+//  store something and then load what the other stored need atomicFullBarrier() between the two, or both can miss
+//  the other's store.
+//
+
+#ifndef __hifi__AtomicUtil__
+#define __hifi__AtomicUtil__
+
+#ifdef _WIN32
+#include <intrin.h>
+#endif
+
+// fields written by different threads are kept at least this far apart, so they don't share a cache line
+const int CACHE_LINE_BYTES = 64;
+
+#ifdef _WIN32
+
+// plain volatile accesses are already acquire and release on x86, this just keeps the compiler from reordering
+template<typename T> inline T atomicLoadAcquire(const T* address) {
+    T value = *static_cast<const volatile T*>(address);
+    _ReadWriteBarrier();
+    return value;
+}
+
+template<typename T> inline void atomicStoreRelease(T* address, T value) {
+    _ReadWriteBarrier();
+    *static_cast<volatile T*>(address) = value;
+}
+
+template<typename T> inline T atomicExchange(T* address, T value) {
+    return (T) _InterlockedExchange(reinterpret_cast<volatile long*>(address), (long) value);
+}
+
+inline void atomicFullBarrier() {
+    _ReadWriteBarrier();
+    _mm_mfence();
+}
+
+#else
+
+template<typename T> inline T atomicLoadAcquire(const T* address) {
+    T value;
+    __atomic_load(address, &value, __ATOMIC_ACQUIRE);
+    return value;
+}
+
+template<typename T> inline void atomicStoreRelease(T* address, T value) {
+    __atomic_store(address, &value, __ATOMIC_RELEASE);
+}
+
+// stores value and returns the one it replaced in a single step, with both acquire and release ordering
+template<typename T> inline T atomicExchange(T* address, T value) {
+    T oldValue;
+    __atomic_exchange(address, &value, &oldValue, __ATOMIC_ACQ_REL);
+    return oldValue;
+}
+
+inline void atomicFullBarrier() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+#endif
+
+#endif /* defined(__hifi__AtomicUtil__) */
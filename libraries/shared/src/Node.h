@@ -18,6 +18,7 @@
 #include <sys/socket.h>
 #endif
 
+#include "AtomicUtil.h"
 #include "SimpleMovingAverage.h"
 #include "NodeData.h"
 
@@ -56,8 +57,9 @@ public:
     NodeData* getLinkedData() const { return _linkedData; }
     void setLinkedData(NodeData* linkedData) { _linkedData = linkedData; }
     
-    bool isAlive() const { return _isAlive; };
-    void setAlive(bool isAlive) { _isAlive = isAlive; };
+    // read and written without a lock, from whichever threads are iterating the NodeList
+    bool isAlive() const { return atomicLoadAcquire(&_isAlive); };
+    void setAlive(bool isAlive) { atomicStoreRelease(&_isAlive, isAlive); };
     
     void  recordBytesReceived(int bytesReceived);
     float getAverageKilobitsPerSecond();
@@ -7,6 +7,7 @@
 //
 
 #include <pthread.h>
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 #include <cstdio>
@@ -59,12 +60,17 @@ NodeList* NodeList::getInstance() {
 NodeList::NodeList(char newOwnerType, unsigned int newSocketListenPort) :
     _nodeBuckets(),
     _numNodes(0),
+    _nodesByAddress(),
+    _nodesByID(),
+    _epoch(0),
+    _readers(),
     _nodeSocket(newSocketListenPort),
     _ownerType(newOwnerType),
     _nodeTypesOfInterest(NULL),
     _ownerID(UNKNOWN_NODE_ID),
     _lastNodeID(0) {
     pthread_mutex_init(&mutex, 0);
+    pthread_mutex_init(&_indexMutex, 0);
 }
 
 NodeList::~NodeList() {
@@ -74,13 +80,16 @@ NodeList::~NodeList() {
     stopSilentNodeRemovalThread();
     
     pthread_mutex_destroy(&mutex);
+    pthread_mutex_destroy(&_indexMutex);
 }
 
 void NodeList::timePingReply(sockaddr *nodeAddress, unsigned char *packetData) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (socketMatch(node->getPublicSocket(), nodeAddress) || 
-            socketMatch(node->getLocalSocket(), nodeAddress)) {     
-
+    const NodeIndexBucket* indexBucket = atomicLoadAcquire(indexBucketForAddress(nodeAddress));
+    for (int i = 0; indexBucket && i < indexBucket->size(); i++) {
+        Node* node = (*indexBucket)[i];
+        if (node->isAlive() && (socketMatch(node->getPublicSocket(), nodeAddress) ||
+                                socketMatch(node->getLocalSocket(), nodeAddress))) {
+            
             int pingTime = usecTimestampNow() - *(uint64_t*)(packetData + numBytesForPacketHeader(packetData));
             
             node->setPingMs(pingTime / 1000);
@@ -109,49 +118,6 @@ void NodeList::processNodeData(sockaddr* senderAddress, unsigned char* packetDat
     }
 }
 
-void NodeList::processBulkNodeData(sockaddr *senderAddress, unsigned char *packetData, int numTotalBytes) {
-    lock();
-    
-    // find the avatar mixer in our node list and update the lastRecvTime from it
-    Node* bulkSendNode = nodeWithAddress(senderAddress);
-
-    if (bulkSendNode) {
-        bulkSendNode->setLastHeardMicrostamp(usecTimestampNow());
-        bulkSendNode->recordBytesReceived(numTotalBytes);
-    }
-    
-    int numBytesPacketHeader = numBytesForPacketHeader(packetData);
-    
-    unsigned char *startPosition = packetData;
-    unsigned char *currentPosition = startPosition + numBytesPacketHeader;
-    unsigned char packetHolder[numTotalBytes];
-    
-    // we've already verified packet version for the bulk packet, so all head data in the packet is also up to date
-    populateTypeAndVersion(packetHolder, PACKET_TYPE_HEAD_DATA);
-    
-    uint16_t nodeID = -1;
-    
-    while ((currentPosition - startPosition) < numTotalBytes) {
-        unpackNodeId(currentPosition, &nodeID);
-        memcpy(packetHolder + numBytesPacketHeader,
-               currentPosition,
-               numTotalBytes - (currentPosition - startPosition));
-        
-        Node* matchingNode = nodeWithID(nodeID);
-        
-        if (!matchingNode) {
-            // we're missing this node, we need to add it to the list
-            matchingNode = addOrUpdateNode(NULL, NULL, NODE_TYPE_AGENT, nodeID);
-        }
-        
-        currentPosition += updateNodeWithData(matchingNode,
-                                              packetHolder,
-                                              numTotalBytes - (currentPosition - startPosition));
-    }
-    
-    unlock();
-}
-
 int NodeList::updateNodeWithData(sockaddr *senderAddress, unsigned char *packetData, size_t dataBytes) {
     // find the node by the sockaddr
     Node* matchingNode = nodeWithAddress(senderAddress);
@@ -178,9 +144,11 @@ int NodeList::updateNodeWithData(Node *node, unsigned char *packetData, int data
 }
 
 Node* NodeList::nodeWithAddress(sockaddr *senderAddress) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (node->getActiveSocket() && socketMatch(node->getActiveSocket(), senderAddress)) {
-            return &(*node);
+    const NodeIndexBucket* indexBucket = atomicLoadAcquire(indexBucketForAddress(senderAddress));
+    for (int i = 0; indexBucket && i < indexBucket->size(); i++) {
+        Node* node = (*indexBucket)[i];
+        if (node->isAlive() && node->getActiveSocket() && socketMatch(node->getActiveSocket(), senderAddress)) {
+            return node;
         }
     }
     
@@ -188,16 +156,86 @@ Node* NodeList::nodeWithAddress(sockaddr *senderAddress) {
 }
 
 Node* NodeList::nodeWithID(uint16_t nodeID) {
-    for(NodeList::iterator node = begin(); node != end(); node++) {
-        if (node->getNodeID() == nodeID) {
-            return &(*node);
+    const NodeIndexBucket* indexBucket = atomicLoadAcquire(indexBucketForID(nodeID));
+    for (int i = 0; indexBucket && i < indexBucket->size(); i++) {
+        Node* node = (*indexBucket)[i];
+        if (node->isAlive() && node->getNodeID() == nodeID) {
+            return node;
         }
     }
-
+    
     return NULL;
 }
 
+const NodeList::NodeIndexBucket** NodeList::indexBucketForAddress(const sockaddr* address) {
+    // only IPv4 for now, like socketMatch()
+    const sockaddr_in* addressIn = (const sockaddr_in*) address;
+    uint32_t key = addressIn->sin_addr.s_addr ^ ((uint32_t) addressIn->sin_port << 16);
+    
+    // Knuth's multiplicative hash, the high bits of the product are the best mixed
+    const uint32_t GOLDEN_RATIO_MULTIPLIER = 2654435761u;
+    return &_nodesByAddress[((key * GOLDEN_RATIO_MULTIPLIER) >> 16) & (NODE_INDEX_BUCKETS - 1)];
+}
+
+const NodeList::NodeIndexBucket** NodeList::indexBucketForID(uint16_t nodeID) {
+    // IDs are handed out in order, so they spread themselves over the buckets
+    return &_nodesByID[nodeID & (NODE_INDEX_BUCKETS - 1)];
+}
+
+void NodeList::addToIndexBucket(const NodeIndexBucket** indexBucket, Node* node) {
+    NodeIndexBucket* newBucket = *indexBucket ? new NodeIndexBucket(**indexBucket) : new NodeIndexBucket();
+    newBucket->push_back(node);
+    
+    if (*indexBucket) {
+        RetiredIndexBucket retiredBucket = { *indexBucket, _epoch };
+        _retiredIndexBuckets.push_back(retiredBucket);
+    }
+    atomicStoreRelease(indexBucket, (const NodeIndexBucket*) newBucket);
+}
+
+void NodeList::removeFromIndexBucket(const NodeIndexBucket** indexBucket, Node* node) {
+    if (!*indexBucket || std::find((*indexBucket)->begin(), (*indexBucket)->end(), node) == (*indexBucket)->end()) {
+        return;
+    }
+    
+    NodeIndexBucket* newBucket = new NodeIndexBucket();
+    for (int i = 0; i < (*indexBucket)->size(); i++) {
+        if ((**indexBucket)[i] != node) {
+            newBucket->push_back((**indexBucket)[i]);
+        }
+    }
+    
+    RetiredIndexBucket retiredBucket = { *indexBucket, _epoch };
+    _retiredIndexBuckets.push_back(retiredBucket);
+    if (newBucket->empty()) {
+        delete newBucket;
+        newBucket = NULL;
+    }
+    atomicStoreRelease(indexBucket, (const NodeIndexBucket*) newBucket);
+}
+
+void NodeList::addNodeToIndexes(Node* node) {
+    if (node->getPublicSocket()) {
+        addToIndexBucket(indexBucketForAddress(node->getPublicSocket()), node);
+    }
+    if (node->getLocalSocket() && !socketMatch(node->getPublicSocket(), node->getLocalSocket())) {
+        addToIndexBucket(indexBucketForAddress(node->getLocalSocket()), node);
+    }
+    addToIndexBucket(indexBucketForID(node->getNodeID()), node);
+}
+
+void NodeList::removeNodeFromIndexes(Node* node) {
+    if (node->getPublicSocket()) {
+        removeFromIndexBucket(indexBucketForAddress(node->getPublicSocket()), node);
+    }
+    if (node->getLocalSocket()) {
+        removeFromIndexBucket(indexBucketForAddress(node->getLocalSocket()), node);
+    }
+    removeFromIndexBucket(indexBucketForID(node->getNodeID()), node);
+}
+
 int NodeList::getNumAliveNodes() const {
+    NodeListReadScope readScope(this);
     int numAliveNodes = 0;
     
     for (NodeList::iterator node = begin(); node != end(); node++) {
@@ -313,18 +351,20 @@ int NodeList::processDomainServerList(unsigned char* packetData, size_t dataByte
 }
 
 Node* NodeList::addOrUpdateNode(sockaddr* publicSocket, sockaddr* localSocket, char nodeType, uint16_t nodeId) {
-    NodeList::iterator node = end();
+    Node* node = NULL;
     
     if (publicSocket) {
-        for (node = begin(); node != end(); node++) {
-            if (node->matches(publicSocket, localSocket, nodeType)) {
+        const NodeIndexBucket* indexBucket = atomicLoadAcquire(indexBucketForAddress(publicSocket));
+        for (int i = 0; indexBucket && i < indexBucket->size(); i++) {
+            if ((*indexBucket)[i]->isAlive() && (*indexBucket)[i]->matches(publicSocket, localSocket, nodeType)) {
                 // we already have this node, stop checking
+                node = (*indexBucket)[i];
                 break;
             }
         }
     } 
     
-    if (node == end()) {
+    if (!node) {
         // we didn't have this node, so add them
         Node* newNode = new Node(publicSocket, localSocket, nodeType, nodeId);
         
@@ -355,27 +395,44 @@ Node* NodeList::addOrUpdateNode(sockaddr* publicSocket, sockaddr* localSocket, c
         }
         
         // we had this node already, do nothing for now
-        return &*node;
+        return node;
     }    
 }
 
 void NodeList::addNodeToList(Node* newNode) {
+    pthread_mutex_lock(&_indexMutex);
+    
+    // take the slot of a node that's been reclaimed if there is one, otherwise add to the end
+    int nodeIndex = _numNodes;
+    if (!_freeNodeIndexes.empty()) {
+        nodeIndex = _freeNodeIndexes.back();
+        _freeNodeIndexes.pop_back();
+    }
+    
     // find the correct array to add this node to
-    int bucketIndex = _numNodes / NODES_PER_BUCKET;
+    int bucketIndex = nodeIndex / NODES_PER_BUCKET;
     
     if (!_nodeBuckets[bucketIndex]) {
-        _nodeBuckets[bucketIndex] = new Node*[NODES_PER_BUCKET]();
+        atomicStoreRelease(&_nodeBuckets[bucketIndex], new Node*[NODES_PER_BUCKET]());
     }
     
-    _nodeBuckets[bucketIndex][_numNodes % NODES_PER_BUCKET] = newNode;
+    // the node goes in its slot before the slot is counted, so iterators never find an empty one past the old end
+    atomicStoreRelease(&_nodeBuckets[bucketIndex][nodeIndex % NODES_PER_BUCKET], newNode);
+    
+    if (nodeIndex == _numNodes) {
+        atomicStoreRelease(&_numNodes, _numNodes + 1);
+    }
     
-    ++_numNodes;
+    addNodeToIndexes(newNode);
+    
+    pthread_mutex_unlock(&_indexMutex);
     
     printLog("Added ");
     Node::printLog(*newNode);
 }
 
 unsigned NodeList::broadcastToNodes(unsigned char *broadcastData, size_t dataBytes, const char* nodeTypes, int numNodeTypes) {
+    NodeListReadScope readScope(this);
     unsigned n = 0;
     for(NodeList::iterator node = begin(); node != end(); node++) {
         // only send to the NodeTypes we are asked to send to.
@@ -422,18 +479,24 @@ void *removeSilentNodes(void *args) {
     while (!silentNodeThreadStopFlag) {
         checkTimeUSecs = usecTimestampNow();
         
-        for(NodeList::iterator node = nodeList->begin(); node != nodeList->end(); ++node) {
-            
-            if ((checkTimeUSecs - node->getLastHeardMicrostamp()) > NODE_SILENCE_THRESHOLD_USECS
-            	&& node->getType() != NODE_TYPE_VOXEL_SERVER) {
-            
-                printLog("Killed ");
-                Node::printLog(*node);
+        {
+            // closed before reclaiming, an open scope here would hold the reclaim back
+            NodeListReadScope readScope(nodeList);
+            for(NodeList::iterator node = nodeList->begin(); node != nodeList->end(); ++node) {
+                
+                if ((checkTimeUSecs - node->getLastHeardMicrostamp()) > NODE_SILENCE_THRESHOLD_USECS
+                	&& node->getType() != NODE_TYPE_VOXEL_SERVER) {
                 
-                node->setAlive(false);
+                    printLog("Killed ");
+                    Node::printLog(*node);
+                    
+                    node->setAlive(false);
+                }
             }
         }
         
+        nodeList->reclaimDeadNodes();
+        
         sleepTime = NODE_SILENCE_THRESHOLD_USECS - (usecTimestampNow() - checkTimeUSecs);
         #ifdef _WIN32
         Sleep( static_cast<int>(1000.0f*sleepTime) );
@@ -446,6 +509,98 @@ void *removeSilentNodes(void *args) {
     return NULL;
 }
 
+void NodeList::reclaimDeadNodes() {
+    std::vector<Node*> nodesToDelete;
+    
+    pthread_mutex_lock(&_indexMutex);
+    
+    // whatever was taken out before the oldest open reader started, it can't have found
+    unsigned int oldestEpoch = oldestReaderEpoch();
+    
+    int numStillRetired = 0;
+    for (int i = 0; i < _retiredNodes.size(); i++) {
+        if (_retiredNodes[i].epoch < oldestEpoch) {
+            nodesToDelete.push_back(_retiredNodes[i].node);
+            _freeNodeIndexes.push_back(_retiredNodes[i].nodeIndex);
+        } else {
+            _retiredNodes[numStillRetired++] = _retiredNodes[i];
+        }
+    }
+    _retiredNodes.resize(numStillRetired);
+    
+    numStillRetired = 0;
+    for (int i = 0; i < _retiredIndexBuckets.size(); i++) {
+        if (_retiredIndexBuckets[i].epoch < oldestEpoch) {
+            delete _retiredIndexBuckets[i].bucket;
+        } else {
+            _retiredIndexBuckets[numStillRetired++] = _retiredIndexBuckets[i];
+        }
+    }
+    _retiredIndexBuckets.resize(numStillRetired);
+    
+    // nodes can be killed elsewhere too, so look for any that died since
+    for (int i = 0; i < _numNodes; i++) {
+        Node* node = nodeAtIndex(i);
+        if (node && !node->isAlive()) {
+            removeNodeFromIndexes(node);
+            atomicStoreRelease(&_nodeBuckets[i / NODES_PER_BUCKET][i % NODES_PER_BUCKET], (Node*) NULL);
+            
+            RetiredNode retiredNode = { node, i, _epoch };
+            _retiredNodes.push_back(retiredNode);
+        }
+    }
+    
+    // readers that start from here on can't find anything taken out so far
+    atomicStoreRelease(&_epoch, _epoch + 1);
+    
+    pthread_mutex_unlock(&_indexMutex);
+    
+    // deleting a node deletes its linked data too, which whoever holds the lock could be using
+    if (!nodesToDelete.empty()) {
+        lock();
+        for (int i = 0; i < nodesToDelete.size(); i++) {
+            delete nodesToDelete[i];
+        }
+        unlock();
+    }
+}
+
+unsigned int NodeList::oldestReaderEpoch() {
+    // pairs with the barrier in beginRead(), either we see the reader here or it sees what we've taken out
+    atomicFullBarrier();
+    
+    unsigned int oldestEpoch = _epoch;
+    for (int i = 0; i < MAX_NODE_LIST_READERS; i++) {
+        if (atomicLoadAcquire(&_readers[i].isReading)) {
+            oldestEpoch = std::min(oldestEpoch, atomicLoadAcquire(&_readers[i].epoch));
+        }
+    }
+    return oldestEpoch;
+}
+
+int NodeList::beginRead() const {
+    while (true) {
+        for (int i = 0; i < MAX_NODE_LIST_READERS; i++) {
+            if (atomicExchange(&_readers[i].isReading, 1) == 0) {
+                atomicStoreRelease(&_readers[i].epoch, atomicLoadAcquire(&_epoch));
+                atomicFullBarrier();
+                return i;
+            }
+        }
+        
+        // every slot is taken, one will be given back soon
+        #ifdef _WIN32
+        Sleep(0);
+        #else
+        usleep(0);
+        #endif
+    }
+}
+
+void NodeList::endRead(int readerIndex) const {
+    atomicStoreRelease(&_readers[readerIndex].isReading, 0);
+}
+
 void NodeList::startSilentNodeRemovalThread() {
     pthread_create(&removeSilentNodesThread, NULL, removeSilentNodes, (void*) this);
 }
@@ -455,39 +610,47 @@ void NodeList::stopSilentNodeRemovalThread() {
     pthread_join(removeSilentNodesThread, NULL);
 }
 
+Node* NodeList::nodeAtIndex(int nodeIndex) const {
+    Node** nodeBucket = atomicLoadAcquire(&_nodeBuckets[nodeIndex / NODES_PER_BUCKET]);
+    return atomicLoadAcquire(&nodeBucket[nodeIndex % NODES_PER_BUCKET]);
+}
+
 NodeList::iterator NodeList::begin() const {
-    Node** nodeBucket = NULL;
+    int numNodes = atomicLoadAcquire(&_numNodes);
     
-    for (int i = 0; i < _numNodes; i++) {
-        if (i % NODES_PER_BUCKET == 0) {
-            nodeBucket =  _nodeBuckets[i / NODES_PER_BUCKET];
-        }
-        
-        if (nodeBucket[i % NODES_PER_BUCKET]->isAlive()) {
-            return NodeListIterator(this, i);
+    for (int i = 0; i < numNodes; i++) {
+        Node* node = nodeAtIndex(i);
+        if (node && node->isAlive()) {
+            return NodeListIterator(this, i, node);
         }
     }
     
     // there's no alive node to start from - return the end
-    return end();
+    return NodeListIterator(this, numNodes, NULL);
 }
 
 NodeList::iterator NodeList::end() const {
-    return NodeListIterator(this, _numNodes);
+    return NodeListIterator(this, atomicLoadAcquire(&_numNodes), NULL);
 }
 
-NodeListIterator::NodeListIterator(const NodeList* nodeList, int nodeIndex) :
-    _nodeIndex(nodeIndex) {
+NodeListIterator::NodeListIterator(const NodeList* nodeList, int nodeIndex, Node* node) :
+    _nodeIndex(nodeIndex),
+    _node(node) {
     _nodeList = nodeList;
 }
 
 NodeListIterator& NodeListIterator::operator=(const NodeListIterator& otherValue) {
     _nodeList = otherValue._nodeList;
     _nodeIndex = otherValue._nodeIndex;
+    _node = otherValue._node;
     return *this;
 }
 
 bool NodeListIterator::operator==(const NodeListIterator &otherValue) {
+    // nodes can be added while we're iterating, so any two iterators that have run out of nodes are the end
+    if (!_node || !otherValue._node) {
+        return _node == otherValue._node;
+    }
     return _nodeIndex == otherValue._nodeIndex;
 }
 
@@ -496,13 +659,11 @@ bool NodeListIterator::operator!=(const NodeListIterator &otherValue) {
 }
 
 Node& NodeListIterator::operator*() {
-    Node** nodeBucket = _nodeList->_nodeBuckets[_nodeIndex / NODES_PER_BUCKET];
-    return *nodeBucket[_nodeIndex % NODES_PER_BUCKET];
+    return *_node;
 }
 
 Node* NodeListIterator::operator->() {
-    Node** nodeBucket = _nodeList->_nodeBuckets[_nodeIndex / NODES_PER_BUCKET];
-    return nodeBucket[_nodeIndex % NODES_PER_BUCKET];
+    return _node;
 }
 
 NodeListIterator& NodeListIterator::operator++() {
@@ -517,13 +678,21 @@ NodeList::iterator NodeListIterator::operator++(int) {
 }
 
 void NodeListIterator::skipDeadAndStopIncrement() {
-    while (_nodeIndex != _nodeList->_numNodes) {
+    int numNodes = atomicLoadAcquire(&_nodeList->_numNodes);
+    
+    _node = NULL;
+    while (_nodeIndex < numNodes) {
         ++_nodeIndex;
         
-        if (_nodeIndex == _nodeList->_numNodes) {
+        if (_nodeIndex == numNodes) {
             break;
-        } else if ((*(*this)).isAlive()) {
-            // skip over the dead nodes
+        }
+        
+        // skip over the dead nodes, and the slots they've been reclaimed from - the slot can be emptied again right
+        // after this, so hold on to the node we checked rather than going back to it
+        Node* node = _nodeList->nodeAtIndex(_nodeIndex);
+        if (node && node->isAlive()) {
+            _node = node;
             break;
         }
     }
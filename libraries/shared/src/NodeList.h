@@ -11,7 +11,9 @@
 
 #include <stdint.h>
 #include <iterator>
+#include <vector>
 
+#include "AtomicUtil.h"
 #include "Node.h"
 #include "UDPSocket.h"
 
@@ -22,6 +24,12 @@
 const int MAX_NUM_NODES = 10000;
 const int NODES_PER_BUCKET = 100;
 
+// hash buckets in each of the indexes nodes are looked up by, a power of two
+const int NODE_INDEX_BUCKETS = 1024;
+
+// how many NodeListReadScopes can be open at once, across every thread
+const int MAX_NODE_LIST_READERS = 64;
+
 const int MAX_PACKET_SIZE = 1500;
 const unsigned int NODE_SOCKET_LISTEN_PORT = 40103;
 
@@ -38,6 +46,13 @@ const int UNKNOWN_NODE_ID = -1;
 
 class NodeListIterator;
 
+// Iterating the list and looking nodes up never takes a lock, from any number of threads. Writers (adding and
+// reclaiming nodes) serialize among themselves and publish each change with a release store: a node's slot before
+// the count of slots that takes it in, and each index bucket as a whole new copy of it. What they take out is only
+// deleted once every NodeListReadScope that was open when it was taken out has closed, and only with lock() held.
+// So a thread can use a Node* (and its linked data) for as long as it has a NodeListReadScope open or holds lock(),
+// and shouldn't hold on to one past that without looking it up again. Looking a node up needs the scope either way:
+// the index buckets a lookup walks are freed without lock(), so holding it doesn't keep them around.
 class NodeList {
 public:
     static NodeList* createInstance(char ownerType, unsigned int socketListenPort = NODE_SOCKET_LISTEN_PORT);
@@ -62,9 +77,11 @@ public:
     
     void(*linkedDataCreateCallback)(Node *);
     
-    int size() { return _numNodes; }
+    int size() { return atomicLoadAcquire(&_numNodes); }
     int getNumAliveNodes() const;
     
+    // Not needed to iterate, only to keep the nodes' linked data from being parsed into while it's being used. No
+    // node is deleted while it's held either.
     void lock() { pthread_mutex_lock(&mutex); }
     void unlock() { pthread_mutex_unlock(&mutex); }
     
@@ -72,13 +89,13 @@ public:
     void sendDomainServerCheckIn();
     int processDomainServerList(unsigned char *packetData, size_t dataBytes);
     
+    // both look the node up in a hash index rather than going through the list
     Node* nodeWithAddress(sockaddr *senderAddress);
     Node* nodeWithID(uint16_t nodeID);
     
     Node* addOrUpdateNode(sockaddr* publicSocket, sockaddr* localSocket, char nodeType, uint16_t nodeId);
     
     void processNodeData(sockaddr *senderAddress, unsigned char *packetData, size_t dataBytes);
-    void processBulkNodeData(sockaddr *senderAddress, unsigned char *packetData, int numTotalBytes);
    
     int updateNodeWithData(sockaddr *senderAddress, unsigned char *packetData, size_t dataBytes);
     int updateNodeWithData(Node *node, unsigned char *packetData, int dataBytes);
@@ -90,6 +107,15 @@ public:
     void startSilentNodeRemovalThread();
     void stopSilentNodeRemovalThread();
     
+    // Takes nodes that have died out of the list and the indexes, and frees the ones taken out earlier that no open
+    // NodeListReadScope could still be looking at, so their slots can be used again. Called by the silent node
+    // removal thread.
+    void reclaimDeadNodes();
+    
+    // for NodeListReadScope, beginRead() returns the reader slot it took
+    int beginRead() const;
+    void endRead(int readerIndex) const;
+    
     friend class NodeListIterator;
 private:
     static NodeList* _sharedInstance;
@@ -100,9 +126,57 @@ private:
     void operator=(NodeList const&); // Don't implement, needed to avoid copies of singleton
     
     void addNodeToList(Node* newNode);
+    Node* nodeAtIndex(int nodeIndex) const;
+    
+    // the buckets are never changed once they're published, so readers don't need the lock
+    typedef std::vector<Node*> NodeIndexBucket;
+    
+    // an open NodeListReadScope, each on its own cache line since they're written by different threads
+    class ReaderSlot {
+    public:
+        int isReading;
+        unsigned int epoch; // the reclaim pass the reader started in
+        char padding[CACHE_LINE_BYTES - sizeof(int) - sizeof(unsigned int)];
+    };
+    
+    // taken out of the list in reclaim pass epoch, deleted once no reader started in that pass or before it
+    class RetiredNode {
+    public:
+        Node* node;
+        int nodeIndex; // the slot it was in, free once it's deleted
+        unsigned int epoch;
+    };
+    
+    class RetiredIndexBucket {
+    public:
+        const NodeIndexBucket* bucket;
+        unsigned int epoch;
+    };
+    
+    unsigned int oldestReaderEpoch();
+    
+    const NodeIndexBucket** indexBucketForAddress(const sockaddr* address);
+    const NodeIndexBucket** indexBucketForID(uint16_t nodeID);
+    void addToIndexBucket(const NodeIndexBucket** indexBucket, Node* node);
+    void removeFromIndexBucket(const NodeIndexBucket** indexBucket, Node* node);
+    void addNodeToIndexes(Node* node);
+    void removeNodeFromIndexes(Node* node);
     
     Node** _nodeBuckets[MAX_NUM_NODES / NODES_PER_BUCKET];
-    int _numNodes;
+    int _numNodes; // how far into the buckets there have ever been nodes, some of the slots may be empty now
+    
+    // The nodes by their public and local addresses, and by ID. Everything below is only changed with _indexMutex
+    // held.
+    const NodeIndexBucket* _nodesByAddress[NODE_INDEX_BUCKETS];
+    const NodeIndexBucket* _nodesByID[NODE_INDEX_BUCKETS];
+    std::vector<RetiredIndexBucket> _retiredIndexBuckets;
+    std::vector<int> _freeNodeIndexes;
+    std::vector<RetiredNode> _retiredNodes; // dead and out of their slots and the indexes, waiting to be deleted
+    unsigned int _epoch; // counts the reclaim passes, readers take it when they start
+    pthread_mutex_t _indexMutex;
+    
+    mutable ReaderSlot _readers[MAX_NODE_LIST_READERS];
+
     UDPSocket _nodeSocket;
     char _ownerType;
     char* _nodeTypesOfInterest;
@@ -117,9 +191,27 @@ private:
     void timePingReply(sockaddr *nodeAddress, unsigned char *packetData);
 };
 
+// Keeps the nodes the calling thread finds (and their linked data) from being deleted until it goes out of scope.
+// Open one around each piece of work that looks nodes up or goes through the list, rather than around each loop,
+// and don't keep one open while waiting on something. Thread pool jobs are covered by one open on the thread that
+// runs them, since it can't close it before they're done.
+class NodeListReadScope {
+public:
+    NodeListReadScope(const NodeList* nodeList) : _nodeList(nodeList), _readerIndex(nodeList->beginRead()) {}
+    ~NodeListReadScope() { _nodeList->endRead(_readerIndex); }
+    
+private:
+    // privatize copy and assignment operator to disallow NodeListReadScope copying
+    NodeListReadScope(const NodeListReadScope&);
+    NodeListReadScope& operator= (const NodeListReadScope&);
+    
+    const NodeList* _nodeList;
+    int _readerIndex;
+};
+
 class NodeListIterator : public std::iterator<std::input_iterator_tag, Node> {
 public:
-    NodeListIterator(const NodeList* nodeList, int nodeIndex);
+    NodeListIterator(const NodeList* nodeList, int nodeIndex, Node* node);
     ~NodeListIterator() {};
     
     int getNodeIndex() { return _nodeIndex; };
@@ -139,6 +231,7 @@ private:
     
     const NodeList* _nodeList;
     int _nodeIndex;
+    Node* _node; // NULL once we've run out of nodes
 };
 
 #endif /* defined(__hifi__NodeList__) */
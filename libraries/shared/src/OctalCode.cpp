@@ -58,6 +58,17 @@ int branchIndexWithDescendant(unsigned char * ancestorOctalCode, unsigned char *
 }
 
 unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber) {
+    int parentCodeSections = parentOctalCode != NULL
+        ? numberOfThreeBitSectionsInCode(parentOctalCode)
+        : 0;
+    
+    // create a new buffer to hold the new octal code, child code will have one more section than the parent
+    unsigned char *newCode = new unsigned char[bytesRequiredForCodeLength(parentCodeSections + 1)];
+    copyChildOctalCode(parentOctalCode, childNumber, newCode);
+    return newCode;
+}
+
+void copyChildOctalCode(unsigned char * parentOctalCode, char childNumber, unsigned char* output) {
     
     // find the length (in number of three bit code sequences)
     // in the parent
@@ -71,8 +82,7 @@ unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber
     // child code will have one more section than the parent
     int childCodeBytes = bytesRequiredForCodeLength(parentCodeSections + 1);
     
-    // create a new buffer to hold the new octal code
-    unsigned char *newCode = new unsigned char[childCodeBytes];
+    unsigned char *newCode = output;
     
     // copy the parent code to the child
     if (parentOctalCode != NULL) {
@@ -107,8 +117,6 @@ unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber
         // no wraparound, left shift and add
         newCode[(startBit / 8) + 1] += (childNumber << leftShift);
     }
-    
-    return newCode;
 }
 
 void copyFirstVertexForCode(unsigned char * octalCode, float* output) {
@@ -253,3 +261,15 @@ unsigned char* rebaseOctalCode(unsigned char* originalOctalCode, unsigned char*
     return newCode;
 }
 
+bool isAncestorOf(unsigned char* possibleAncestor, unsigned char* possibleDescendant) {
+    int ancestorSections = numberOfThreeBitSectionsInCode(possibleAncestor);
+    if (ancestorSections > numberOfThreeBitSectionsInCode(possibleDescendant)) {
+        return false;
+    }
+    for (int section = 0; section < ancestorSections; section++) {
+        if (getOctalCodeSectionValue(possibleAncestor, section) != getOctalCodeSectionValue(possibleDescendant, section)) {
+            return false;
+        }
+    }
+    return true;
+}
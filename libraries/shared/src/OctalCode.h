@@ -24,6 +24,9 @@ int bytesRequiredForCodeLength(unsigned char threeBitCodes);
 bool isDirectParentOfChild(unsigned char *parentOctalCode, unsigned char * childOctalCode);
 int branchIndexWithDescendant(unsigned char * ancestorOctalCode, unsigned char * descendantOctalCode);
 unsigned char * childOctalCode(unsigned char * parentOctalCode, char childNumber);
+// Note: copyChildOctalCode() is preferred when you already have somewhere to put the code, output must be at
+// least bytesRequiredForCodeLength(parent sections + 1) bytes
+void copyChildOctalCode(unsigned char * parentOctalCode, char childNumber, unsigned char* output);
 int numberOfThreeBitSectionsInCode(unsigned char * octalCode);
 unsigned char* chopOctalCode(unsigned char* originalOctalCode, int chopLevels);
 unsigned char* rebaseOctalCode(unsigned char* originalOctalCode, unsigned char* newParentOctalCode, 
@@ -42,4 +45,7 @@ typedef enum {
 } OctalCodeComparison;
 
 OctalCodeComparison compareOctalCodes(unsigned char* code1, unsigned char* code2);
+
+// true if possibleDescendant is possibleAncestor itself, or is somewhere in the subtree below it
+bool isAncestorOf(unsigned char* possibleAncestor, unsigned char* possibleDescendant);
 #endif /* defined(__hifi__OctalCode__) */
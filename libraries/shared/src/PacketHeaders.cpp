@@ -12,17 +12,36 @@
 
 PACKET_VERSION versionForPacketType(PACKET_TYPE type) {
     switch (type) {
+        case PACKET_TYPE_BULK_AVATAR_DATA:
+            // avatars are sent as changes since a state the agent has acked, see AvatarStateStream.h
+            return 1;
         default:
             return 0;
             break;
     }
 }
 
+bool packetTypeHasAudioCodec(PACKET_TYPE type) {
+    switch (type) {
+        case PACKET_TYPE_INJECT_AUDIO:
+        case PACKET_TYPE_MIXED_AUDIO:
+        case PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO:
+        case PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO:
+        case PACKET_TYPE_SILENT_AUDIO_FRAME:
+            return true;
+        default:
+            return false;
+    }
+}
+
 bool packetVersionMatch(unsigned char* packetHeader) {
     // currently this just checks if the version in the packet matches our return from versionForPacketType
     // may need to be expanded in the future for types and versions that take > than 1 byte
     if (packetHeader[1] == versionForPacketType(packetHeader[0])) {
         return true;
+    } else if (packetTypeHasAudioCodec(packetHeader[0]) && packetHeader[1] < NUM_AUDIO_CODECS) {
+        // any codec we can decode will do
+        return true;
     } else {
         printf("There is a packet version mismatch for packet with header %c\n", packetHeader[0]);
         return false;
@@ -37,6 +56,12 @@ int populateTypeAndVersion(unsigned char* destinationHeader, PACKET_TYPE type) {
     return 2;
 }
 
+int populateTypeAndVersion(unsigned char* destinationHeader, PACKET_TYPE type, PACKET_VERSION version) {
+    destinationHeader[0] = type;
+    destinationHeader[1] = version;
+    return 2;
+}
+
 int numBytesForPacketType(const unsigned char* packetType) {
     if (packetType[0] == 255) {
         return 1 + numBytesForPacketType(packetType + 1);
@@ -22,12 +22,14 @@ const PACKET_TYPE PACKET_TYPE_INJECT_AUDIO = 'I';
 const PACKET_TYPE PACKET_TYPE_MIXED_AUDIO = 'A';
 const PACKET_TYPE PACKET_TYPE_MICROPHONE_AUDIO_NO_ECHO = 'M';
 const PACKET_TYPE PACKET_TYPE_MICROPHONE_AUDIO_WITH_ECHO = 'm';
+const PACKET_TYPE PACKET_TYPE_SILENT_AUDIO_FRAME = 'a'; // in place of a frame of silence, from agents it has their position
 const PACKET_TYPE PACKET_TYPE_SET_VOXEL = 'S';
 const PACKET_TYPE PACKET_TYPE_SET_VOXEL_DESTRUCTIVE = 'O';
 const PACKET_TYPE PACKET_TYPE_ERASE_VOXEL = 'E';
 const PACKET_TYPE PACKET_TYPE_VOXEL_DATA = 'V';
 const PACKET_TYPE PACKET_TYPE_VOXEL_DATA_MONOCHROME = 'v';
 const PACKET_TYPE PACKET_TYPE_BULK_AVATAR_DATA = 'X';
+const PACKET_TYPE PACKET_TYPE_BULK_AVATAR_DATA_ACK = 'x';
 const PACKET_TYPE PACKET_TYPE_AVATAR_VOXEL_URL = 'U';
 const PACKET_TYPE PACKET_TYPE_TRANSMITTER_DATA_V2 = 'T';
 const PACKET_TYPE PACKET_TYPE_ENVIRONMENT_DATA = 'e';
@@ -36,11 +38,21 @@ const PACKET_TYPE PACKET_TYPE_DOMAIN_REPORT_FOR_DUTY = 'C';
 
 typedef char PACKET_VERSION;
 
+// packets with audio in them use their version to say which codec it's in, see AudioCodec.h
+const PACKET_VERSION AUDIO_CODEC_PCM = 0;
+const PACKET_VERSION AUDIO_CODEC_IMA_ADPCM = 1;
+const PACKET_VERSION NUM_AUDIO_CODECS = 2;
+
 PACKET_VERSION versionForPacketType(PACKET_TYPE type);
 
+bool packetTypeHasAudioCodec(PACKET_TYPE type);
+
 bool packetVersionMatch(unsigned char* packetHeader);
 
 int populateTypeAndVersion(unsigned char* destinationHeader, PACKET_TYPE type);
+
+// for packets where the version isn't fixed, like the codec of an audio packet
+int populateTypeAndVersion(unsigned char* destinationHeader, PACKET_TYPE type, PACKET_VERSION version);
 int numBytesForPacketHeader(unsigned char* packetHeader);
 
 const int MAX_PACKET_HEADER_BYTES = sizeof(PACKET_TYPE) + sizeof(PACKET_VERSION);
@@ -0,0 +1,296 @@
+//
+//  Reactor.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include "Syssocket.h"
+#else
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#endif
+
+#include "Log.h"
+#include "SharedUtil.h"
+#include "Reactor.h"
+
+#ifdef __linux__
+const int MAX_EVENTS_PER_WAIT = 64;
+#endif
+
+#ifdef _WIN32
+// there's no wakeup pipe to poll on windows, so we look for deferred tasks and stop() at least this often
+const int MAX_WAIT_MSECS = 10;
+#endif
+
+Reactor::Reactor() :
+    _nextTimerID(1),
+    _shouldStop(false) {
+    pthread_mutex_init(&_deferredTasksLock, NULL);
+    _wakeupPipe[0] = _wakeupPipe[1] = -1;
+
+#ifndef _WIN32
+    // defer() and stop() write to this pipe to get us out of a wait
+    if (pipe(_wakeupPipe) == 0) {
+        fcntl(_wakeupPipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(_wakeupPipe[1], F_SETFL, O_NONBLOCK);
+    } else {
+        printLog("Reactor failed to create its wakeup pipe - %s\n", strerror(errno));
+    }
+#endif
+
+#ifdef __linux__
+    // all the timers share one timerfd, armed for whichever is due first
+    _epollHandle = epoll_create(MAX_EVENTS_PER_WAIT);
+    _timerHandle = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = _wakeupPipe[0];
+    epoll_ctl(_epollHandle, EPOLL_CTL_ADD, _wakeupPipe[0], &event);
+    event.data.fd = _timerHandle;
+    epoll_ctl(_epollHandle, EPOLL_CTL_ADD, _timerHandle, &event);
+#endif
+}
+
+Reactor::~Reactor() {
+#ifdef __linux__
+    close(_timerHandle);
+    close(_epollHandle);
+#endif
+#ifndef _WIN32
+    close(_wakeupPipe[0]);
+    close(_wakeupPipe[1]);
+#endif
+    pthread_mutex_destroy(&_deferredTasksLock);
+}
+
+bool Reactor::watchForRead(int fileDescriptor, ReactorHandler handler, void* extraData) {
+#ifdef __linux__
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fileDescriptor;
+    if (epoll_ctl(_epollHandle, EPOLL_CTL_ADD, fileDescriptor, &event) != 0) {
+        printLog("Reactor failed to watch %d - %s\n", fileDescriptor, strerror(errno));
+        return false;
+    }
+#endif
+    Watch watch;
+    watch.fileDescriptor = fileDescriptor;
+    watch.handler = handler;
+    watch.extraData = extraData;
+    _watches.push_back(watch);
+    return true;
+}
+
+void Reactor::unwatch(int fileDescriptor) {
+    for (int i = 0; i < _watches.size(); i++) {
+        if (_watches[i].fileDescriptor == fileDescriptor) {
+#ifdef __linux__
+            epoll_event event = {};
+            epoll_ctl(_epollHandle, EPOLL_CTL_DEL, fileDescriptor, &event);
+#endif
+            _watches.erase(_watches.begin() + i);
+            return;
+        }
+    }
+}
+
+int Reactor::addTimer(uint64_t intervalUsecs, ReactorHandler handler, void* extraData) {
+    Timer timer;
+    timer.timerID = _nextTimerID++;
+    timer.intervalUsecs = intervalUsecs;
+    timer.nextFireUsecs = usecTimestampNow() + intervalUsecs;
+    timer.handler = handler;
+    timer.extraData = extraData;
+    _timers.push_back(timer);
+    return timer.timerID;
+}
+
+void Reactor::removeTimer(int timerID) {
+    // the timer may be in the middle of firing, so it's only marked here and dropped by fireDueTimers()
+    for (int i = 0; i < _timers.size(); i++) {
+        if (_timers[i].timerID == timerID) {
+            _timers[i].handler = NULL;
+        }
+    }
+}
+
+void Reactor::defer(ReactorHandler task, void* extraData) {
+    Task deferredTask;
+    deferredTask.task = task;
+    deferredTask.extraData = extraData;
+
+    pthread_mutex_lock(&_deferredTasksLock);
+    _deferredTasks.push_back(deferredTask);
+    pthread_mutex_unlock(&_deferredTasksLock);
+
+    wakeup();
+}
+
+void Reactor::stop() {
+    _shouldStop = true;
+    wakeup();
+}
+
+void Reactor::wakeup() {
+#ifndef _WIN32
+    // if the pipe is full there's already a wakeup waiting, so a failed write is fine
+    const char wakeupByte = 0;
+    write(_wakeupPipe[1], &wakeupByte, sizeof(wakeupByte));
+#endif
+}
+
+void Reactor::run() {
+    while (!_shouldStop) {
+        fireDueTimers();
+        runDeferredTasks();
+
+        if (!_shouldStop) {
+            waitForEvents();
+        }
+    }
+}
+
+void Reactor::fireDueTimers() {
+    uint64_t now = usecTimestampNow();
+
+    // timers added by a handler are at the end, and aren't due yet
+    int timersToCheck = _timers.size();
+    for (int i = 0; i < timersToCheck; i++) {
+        if (_timers[i].handler && _timers[i].nextFireUsecs <= now) {
+            // If we're more than a whole interval behind we skip the firings we missed rather than calling the
+            // handler back to back, but stay on the original schedule.
+            _timers[i].nextFireUsecs += _timers[i].intervalUsecs;
+            if (_timers[i].nextFireUsecs <= now) {
+                uint64_t missedIntervals = (now - _timers[i].nextFireUsecs) / _timers[i].intervalUsecs + 1;
+                _timers[i].nextFireUsecs += missedIntervals * _timers[i].intervalUsecs;
+            }
+
+            ReactorHandler handler = _timers[i].handler;
+            handler(_timers[i].extraData);
+        }
+    }
+
+    for (int i = _timers.size() - 1; i >= 0; i--) {
+        if (!_timers[i].handler) {
+            _timers.erase(_timers.begin() + i);
+        }
+    }
+}
+
+void Reactor::runDeferredTasks() {
+    // take the whole list, so tasks that defer more tasks don't keep us here
+    std::vector<Task> tasks;
+    pthread_mutex_lock(&_deferredTasksLock);
+    tasks.swap(_deferredTasks);
+    pthread_mutex_unlock(&_deferredTasksLock);
+
+    for (int i = 0; i < tasks.size(); i++) {
+        tasks[i].task(tasks[i].extraData);
+    }
+}
+
+void Reactor::dispatchRead(int fileDescriptor) {
+    for (int i = 0; i < _watches.size(); i++) {
+        if (_watches[i].fileDescriptor == fileDescriptor) {
+            _watches[i].handler(_watches[i].extraData);
+            return;
+        }
+    }
+}
+
+void Reactor::waitForEvents() {
+    uint64_t nextDeadline = 0;
+    for (int i = 0; i < _timers.size(); i++) {
+        if (nextDeadline == 0 || _timers[i].nextFireUsecs < nextDeadline) {
+            nextDeadline = _timers[i].nextFireUsecs;
+        }
+    }
+
+    pthread_mutex_lock(&_deferredTasksLock);
+    bool haveDeferredTasks = !_deferredTasks.empty();
+    pthread_mutex_unlock(&_deferredTasksLock);
+    if (haveDeferredTasks) {
+        return;
+    }
+
+#ifdef __linux__
+    // the timerfd uses the same clock as usecTimestampNow(), so the deadline can be handed to it as is
+    itimerspec timerSpec = {};
+    const uint64_t USECS_PER_SECOND = 1000000;
+    const uint64_t NSECS_PER_USEC = 1000;
+    timerSpec.it_value.tv_sec = nextDeadline / USECS_PER_SECOND;
+    timerSpec.it_value.tv_nsec = (nextDeadline % USECS_PER_SECOND) * NSECS_PER_USEC;
+    timerfd_settime(_timerHandle, TFD_TIMER_ABSTIME, &timerSpec, NULL);
+
+    epoll_event events[MAX_EVENTS_PER_WAIT];
+    int numEvents = epoll_wait(_epollHandle, events, MAX_EVENTS_PER_WAIT, -1);
+
+    for (int i = 0; i < numEvents; i++) {
+        int fileDescriptor = events[i].data.fd;
+        if (fileDescriptor == _timerHandle) {
+            uint64_t expirations;
+            read(_timerHandle, &expirations, sizeof(expirations));
+        } else if (fileDescriptor == _wakeupPipe[0]) {
+            char wakeupBytes[MAX_EVENTS_PER_WAIT];
+            while (read(_wakeupPipe[0], wakeupBytes, sizeof(wakeupBytes)) > 0);
+        } else {
+            dispatchRead(fileDescriptor);
+        }
+    }
+#else
+    int timeoutMsecs = -1;
+    if (nextDeadline) {
+        uint64_t now = usecTimestampNow();
+        timeoutMsecs = nextDeadline > now ? (nextDeadline - now + 999) / 1000 : 0;
+    }
+
+    std::vector<pollfd> pollFileDescriptors;
+    pollfd pollFileDescriptor = {};
+    pollFileDescriptor.events = POLLIN;
+#ifdef _WIN32
+    if (timeoutMsecs < 0 || timeoutMsecs > MAX_WAIT_MSECS) {
+        timeoutMsecs = MAX_WAIT_MSECS;
+    }
+#else
+    pollFileDescriptor.fd = _wakeupPipe[0];
+    pollFileDescriptors.push_back(pollFileDescriptor);
+#endif
+    for (int i = 0; i < _watches.size(); i++) {
+        pollFileDescriptor.fd = _watches[i].fileDescriptor;
+        pollFileDescriptors.push_back(pollFileDescriptor);
+    }
+
+#ifdef _WIN32
+    int numReady = pollFileDescriptors.empty() ? (Sleep(timeoutMsecs), 0)
+        : WSAPoll(&pollFileDescriptors[0], pollFileDescriptors.size(), timeoutMsecs);
+#else
+    int numReady = poll(&pollFileDescriptors[0], pollFileDescriptors.size(), timeoutMsecs);
+#endif
+
+    for (int i = 0; numReady > 0 && i < pollFileDescriptors.size(); i++) {
+        if (pollFileDescriptors[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+#ifndef _WIN32
+            if (pollFileDescriptors[i].fd == _wakeupPipe[0]) {
+                char wakeupBytes[64];
+                while (read(_wakeupPipe[0], wakeupBytes, sizeof(wakeupBytes)) > 0);
+                continue;
+            }
+#endif
+            dispatchRead(pollFileDescriptors[i].fd);
+        }
+    }
+#endif
+}
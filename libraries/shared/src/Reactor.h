@@ -0,0 +1,96 @@
+//
+//  Reactor.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Single threaded event loop for the assignment servers. It waits (using epoll and a timerfd on Linux, poll()
+//  elsewhere) until a watched socket is readable, a timer is due or another thread defers a task to it, and then
+//  calls the matching handlers on the thread that called run().
+//
+
+#ifndef __hifi__Reactor__
+#define __hifi__Reactor__
+
+#include <stdint.h>
+#include <vector>
+
+#ifdef _WIN32
+#include "pthread.h"
+#else
+#include <pthread.h>
+#endif
+
+// Callback for readable sockets, timers and deferred tasks
+typedef void (*ReactorHandler)(void* extraData);
+
+class Reactor {
+public:
+    Reactor();
+    ~Reactor();
+
+    // calls handler each time fileDescriptor has data waiting, until unwatch() is called
+    bool watchForRead(int fileDescriptor, ReactorHandler handler, void* extraData);
+    void unwatch(int fileDescriptor);
+
+    // Calls handler every intervalUsecs, the first time intervalUsecs from now. Timers keep to their schedule, so
+    // one that fires late is due again sooner rather than drifting. Returns an ID for removeTimer().
+    int addTimer(uint64_t intervalUsecs, ReactorHandler handler, void* extraData);
+    void removeTimer(int timerID);
+
+    // runs task once on the reactor thread, as soon as it's done with what it's handling now. Any thread can call this.
+    void defer(ReactorHandler task, void* extraData);
+
+    // handles events on the calling thread until stop() is called, stop() can be called from any thread
+    void run();
+    void stop();
+
+private:
+    // privatize copy and assignment operator to disallow Reactor copying
+    Reactor(const Reactor&);
+    Reactor& operator= (const Reactor&);
+
+    class Watch {
+    public:
+        int fileDescriptor;
+        ReactorHandler handler;
+        void* extraData;
+    };
+
+    class Timer {
+    public:
+        int timerID;
+        uint64_t intervalUsecs;
+        uint64_t nextFireUsecs;
+        ReactorHandler handler; // NULL once removed
+        void* extraData;
+    };
+
+    class Task {
+    public:
+        ReactorHandler task;
+        void* extraData;
+    };
+
+    void fireDueTimers();
+    void runDeferredTasks();
+    void waitForEvents();
+    void dispatchRead(int fileDescriptor);
+    void wakeup();
+
+    std::vector<Watch> _watches;
+    std::vector<Timer> _timers;
+    int _nextTimerID;
+
+    pthread_mutex_t _deferredTasksLock;
+    std::vector<Task> _deferredTasks;
+
+    volatile bool _shouldStop;
+    int _wakeupPipe[2];
+#ifdef __linux__
+    int _epollHandle;
+    int _timerHandle;
+#endif
+};
+
+#endif /* defined(__hifi__Reactor__) */
@@ -85,17 +85,6 @@ void outputBits(unsigned char byte, bool withNewLine) {
     }
 }
 
-int numberOfOnes(unsigned char byte) {
-    return (byte >> 7)
-        + ((byte >> 6) & 1)
-        + ((byte >> 5) & 1)
-        + ((byte >> 4) & 1)
-        + ((byte >> 3) & 1)
-        + ((byte >> 2) & 1)
-        + ((byte >> 1) & 1)
-        + (byte & 1);
-}
-
 bool oneAtBit(unsigned char byte, int bitIndex) {
     return (byte >> (7 - bitIndex) & 1);
 }
@@ -210,10 +199,10 @@ bool createVoxelEditMessage(unsigned char command, short int sequence,
         
     bool success = true; // assume the best
     int messageSize = MAXIMUM_EDIT_VOXEL_MESSAGE_SIZE; // just a guess for now
-    int actualMessageSize = 3;
     unsigned char* messageBuffer = new unsigned char[messageSize];
     
     int numBytesPacketHeader = populateTypeAndVersion(messageBuffer, command);
+    int actualMessageSize = numBytesPacketHeader + sizeof(sequence);
     unsigned short int* sequenceAt = (unsigned short int*) &messageBuffer[numBytesPacketHeader];
   
     *sequenceAt = sequence;
@@ -50,7 +50,14 @@ bool shouldDo(float desiredInterval, float deltaTime);
 void outputBufferBits(unsigned char* buffer, int length, bool withNewLine = true);
 void outputBits(unsigned char byte, bool withNewLine = true);
 void printVoxelCode(unsigned char* voxelCode);
-int numberOfOnes(unsigned char byte);
+
+// inline since it's how a voxel finds its children, adds up the bits in pairs, then nibbles, then the two nibbles
+inline int numberOfOnes(unsigned char byte) {
+    int count = byte - ((byte >> 1) & 0x55);
+    count = (count & 0x33) + ((count >> 2) & 0x33);
+    return (count + (count >> 4)) & 0x0F;
+}
+
 bool oneAtBit(unsigned char byte, int bitIndex);
 void setAtBit(unsigned char& byte, int bitIndex);
 
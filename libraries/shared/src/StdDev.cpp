@@ -17,6 +17,10 @@ StDev::StDev() {
     sampleCount = 0;
 }
 
+StDev::~StDev() {
+    delete[] data;
+}
+
 void StDev::reset() {
     sampleCount = 0;
 }
@@ -12,12 +12,17 @@
 class StDev {
     public:
         StDev();
+        ~StDev();
         void reset();
         void addValue(float v);
         float getAverage();
         float getStDev();
         int getSamples() {return sampleCount;};
     private:
+        // privatize copy and assignment operator, a copy would delete data twice
+        StDev(const StDev&);
+        StDev& operator= (const StDev&);
+
         float * data;
         int sampleCount;
 };
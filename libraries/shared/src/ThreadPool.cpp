@@ -0,0 +1,146 @@
+//
+//  ThreadPool.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#include "Log.h"
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(int numThreads) :
+    _numThreads(numThreads < 1 ? 1 : numThreads),
+    _threads(NULL),
+    _workerArgs(NULL),
+    _job(NULL),
+    _jobData(NULL),
+    _numJobs(0),
+    _nextJob(0),
+    _jobsRemaining(0),
+    _batch(0),
+    _shouldStop(false)
+{
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_jobsReady, NULL);
+    pthread_cond_init(&_jobsComplete, NULL);
+
+    // the calling thread is worker 0, so we only need to spawn the others
+    int threadsToSpawn = _numThreads - 1;
+    if (threadsToSpawn > 0) {
+        _threads = new pthread_t[threadsToSpawn];
+        _workerArgs = new ThreadPoolWorkerArgs[threadsToSpawn];
+        for (int i = 0; i < threadsToSpawn; i++) {
+            _workerArgs[i].pool = this;
+            _workerArgs[i].workerIndex = i + 1;
+            pthread_create(&_threads[i], NULL, workerThread, &_workerArgs[i]);
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    pthread_mutex_lock(&_mutex);
+    _shouldStop = true;
+    pthread_cond_broadcast(&_jobsReady);
+    pthread_mutex_unlock(&_mutex);
+
+    for (int i = 0; i < _numThreads - 1; i++) {
+        pthread_join(_threads[i], NULL);
+    }
+    delete[] _threads;
+    delete[] _workerArgs;
+
+    pthread_cond_destroy(&_jobsComplete);
+    pthread_cond_destroy(&_jobsReady);
+    pthread_mutex_destroy(&_mutex);
+}
+
+int ThreadPool::getNumberOfCores() {
+#ifdef _WIN32
+    return 1;
+#else
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return (cores > 0) ? (int)cores : 1;
+#endif
+}
+
+void ThreadPool::runJobs(ThreadPoolJob job, void** jobData, int numJobs) {
+    if (numJobs <= 0) {
+        return;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    _job = job;
+    _jobData = jobData;
+    _numJobs = numJobs;
+    _nextJob = 0;
+    _jobsRemaining = numJobs;
+    _batch++;
+    pthread_cond_broadcast(&_jobsReady);
+    pthread_mutex_unlock(&_mutex);
+
+    // the calling thread helps out instead of just waiting
+    runAvailableJobs(0);
+
+    pthread_mutex_lock(&_mutex);
+    while (_jobsRemaining > 0) {
+        pthread_cond_wait(&_jobsComplete, &_mutex);
+    }
+    _job = NULL;
+    _jobData = NULL;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void ThreadPool::runAvailableJobs(int workerIndex) {
+    while (true) {
+        pthread_mutex_lock(&_mutex);
+        if (_nextJob >= _numJobs) {
+            pthread_mutex_unlock(&_mutex);
+            return;
+        }
+        ThreadPoolJob job = _job;
+        void* jobData = _jobData[_nextJob++];
+        pthread_mutex_unlock(&_mutex);
+
+        job(jobData, workerIndex);
+
+        pthread_mutex_lock(&_mutex);
+        if (--_jobsRemaining == 0) {
+            pthread_cond_signal(&_jobsComplete);
+        }
+        pthread_mutex_unlock(&_mutex);
+    }
+}
+
+void ThreadPool::workerLoop(int workerIndex) {
+    unsigned int lastBatch = 0;
+
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        while (!_shouldStop && _batch == lastBatch) {
+            pthread_cond_wait(&_jobsReady, &_mutex);
+        }
+        if (_shouldStop) {
+            break;
+        }
+        lastBatch = _batch;
+        pthread_mutex_unlock(&_mutex);
+
+        runAvailableJobs(workerIndex);
+
+        pthread_mutex_lock(&_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
+}
+
+void* ThreadPool::workerThread(void* args) {
+    ThreadPoolWorkerArgs* workerArgs = (ThreadPoolWorkerArgs*) args;
+    workerArgs->pool->workerLoop(workerArgs->workerIndex);
+    pthread_exit(0);
+    return NULL;
+}
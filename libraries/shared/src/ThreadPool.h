@@ -0,0 +1,71 @@
+//
+//  ThreadPool.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  A small fixed size pool of worker threads. The caller hands the pool a batch of jobs, the jobs are claimed
+//  by the workers (and the calling thread) in order, and runJobs() returns once every job in the batch is done.
+//  This makes it usable as a "parallel for" with a barrier at the end of each batch.
+//
+
+#ifndef __hifi__ThreadPool__
+#define __hifi__ThreadPool__
+
+#ifdef _WIN32
+#include "pthread.h"
+#else
+#include <pthread.h>
+#endif
+
+// Job function, workerIndex is in the range [0, getNumThreads()) and can be used to index per worker scratch data
+typedef void (*ThreadPoolJob)(void* jobData, int workerIndex);
+
+class ThreadPool;
+
+class ThreadPoolWorkerArgs {
+public:
+    ThreadPool* pool;
+    int         workerIndex;
+};
+
+class ThreadPool {
+public:
+    // numThreads includes the calling thread, so a pool of 1 runs every job inline
+    ThreadPool(int numThreads);
+    ~ThreadPool();
+
+    int getNumThreads() const { return _numThreads; }
+
+    // runs job once for every element of jobData, blocks until all of them have completed
+    void runJobs(ThreadPoolJob job, void** jobData, int numJobs);
+
+    static int getNumberOfCores();
+
+private:
+    // privatize copy and assignment operator to disallow ThreadPool copying
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator= (const ThreadPool&);
+
+    static void* workerThread(void* args);
+    void workerLoop(int workerIndex);
+    void runAvailableJobs(int workerIndex);
+
+    int                   _numThreads;
+    pthread_t*            _threads;
+    ThreadPoolWorkerArgs* _workerArgs;
+
+    pthread_mutex_t _mutex;
+    pthread_cond_t  _jobsReady;
+    pthread_cond_t  _jobsComplete;
+
+    ThreadPoolJob _job;
+    void**        _jobData;
+    int           _numJobs;
+    int           _nextJob;
+    int           _jobsRemaining;
+    unsigned int  _batch;
+    bool          _shouldStop;
+};
+
+#endif /* defined(__hifi__ThreadPool__) */
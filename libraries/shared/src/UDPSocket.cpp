@@ -11,6 +11,7 @@
 #include <cstdio>
 #include <errno.h>
 #include <string.h>
+#include <algorithm>
 
 #ifdef _WIN32
 #include "Syssocket.h"
@@ -248,3 +249,146 @@ int UDPSocket::send(char* destAddress, int destPort, const void* data, size_t by
     
     return send((sockaddr *)&destSockaddr, data, byteLength);
 }
+
+int UDPSocket::sendPackets(const sockaddr_in* destAddresses, unsigned char* const* packets, const size_t* byteLengths,
+                           int numPackets) const {
+    int packetsSent = 0;
+#ifdef __linux__
+    mmsghdr messages[MAX_PACKETS_PER_BATCH];
+    iovec packetVectors[MAX_PACKETS_PER_BATCH];
+    
+    int nextPacket = 0;
+    while (nextPacket < numPackets) {
+        int packetsThisCall = std::min(numPackets - nextPacket, MAX_PACKETS_PER_BATCH);
+        memset(messages, 0, packetsThisCall * sizeof(mmsghdr));
+        for (int i = 0; i < packetsThisCall; i++) {
+            packetVectors[i].iov_base = packets[nextPacket + i];
+            packetVectors[i].iov_len = byteLengths[nextPacket + i];
+            messages[i].msg_hdr.msg_name = (void*) &destAddresses[nextPacket + i];
+            messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+            messages[i].msg_hdr.msg_iov = &packetVectors[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        
+        int result = sendmmsg(handle, messages, packetsThisCall, 0);
+        if (result <= 0) {
+            // the first packet in this call couldn't be sent, give up on it and carry on with the rest
+            printLog("Failed to send packet: %s\n", strerror(errno));
+            nextPacket++;
+        } else {
+            nextPacket += result;
+            packetsSent += result;
+        }
+    }
+#else
+    for (int i = 0; i < numPackets; i++) {
+        if (send((sockaddr*) &destAddresses[i], packets[i], byteLengths[i])) {
+            packetsSent++;
+        }
+    }
+#endif
+    return packetsSent;
+}
+
+int UDPSocket::receivePackets(sockaddr_in* recvAddresses, unsigned char* const* packets, ssize_t* receivedBytes,
+                              int maxPackets) const {
+    maxPackets = std::min(maxPackets, MAX_PACKETS_PER_BATCH);
+#ifdef __linux__
+    mmsghdr messages[MAX_PACKETS_PER_BATCH];
+    iovec packetVectors[MAX_PACKETS_PER_BATCH];
+    memset(messages, 0, maxPackets * sizeof(mmsghdr));
+    for (int i = 0; i < maxPackets; i++) {
+        packetVectors[i].iov_base = packets[i];
+        packetVectors[i].iov_len = MAX_BUFFER_LENGTH_BYTES;
+        messages[i].msg_hdr.msg_name = &recvAddresses[i];
+        messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+        messages[i].msg_hdr.msg_iov = &packetVectors[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+    
+    // blocks (if we're blocking) for the first packet only
+    int packetsReceived = recvmmsg(handle, messages, maxPackets, MSG_WAITFORONE, NULL);
+    if (packetsReceived < 0) {
+        return 0;
+    }
+    for (int i = 0; i < packetsReceived; i++) {
+        receivedBytes[i] = messages[i].msg_len;
+    }
+    return packetsReceived;
+#else
+    int packetsReceived = 0;
+    if (!receive((sockaddr*) &recvAddresses[0], packets[0], &receivedBytes[0])) {
+        return 0;
+    }
+    packetsReceived++;
+    
+#ifndef _WIN32
+    // pick up anything else that's already waiting, without blocking
+    while (packetsReceived < maxPackets) {
+        socklen_t addressSize = sizeof(sockaddr_in);
+        receivedBytes[packetsReceived] = recvfrom(handle, packets[packetsReceived], MAX_BUFFER_LENGTH_BYTES, MSG_DONTWAIT,
+                                                  (sockaddr*) &recvAddresses[packetsReceived], &addressSize);
+        if (receivedBytes[packetsReceived] <= 0) {
+            break;
+        }
+        packetsReceived++;
+    }
+#endif
+    return packetsReceived;
+#endif
+}
+
+UDPSendBatch::UDPSendBatch(UDPSocket* socket) :
+    _socket(socket),
+    _numPackets(0) {
+    _buffer = new unsigned char[MAX_PACKETS_PER_BATCH * MAX_BUFFER_LENGTH_BYTES];
+    for (int i = 0; i < MAX_PACKETS_PER_BATCH; i++) {
+        _packets[i] = _buffer + (i * MAX_BUFFER_LENGTH_BYTES);
+    }
+}
+
+UDPSendBatch::~UDPSendBatch() {
+    flush();
+    delete[] _buffer;
+}
+
+void UDPSendBatch::queue(sockaddr* destAddress, const void* data, size_t byteLength) {
+    if (byteLength > MAX_BUFFER_LENGTH_BYTES) {
+        // too big to queue, nothing that big fits in a datagram we'd want to send anyway, but it still goes out after
+        // what was queued before it
+        flush();
+        _socket->send(destAddress, data, byteLength);
+        return;
+    }
+    if (_numPackets == MAX_PACKETS_PER_BATCH) {
+        flush();
+    }
+    memcpy(_packets[_numPackets], data, byteLength);
+    memcpy(&_destAddresses[_numPackets], destAddress, sizeof(sockaddr_in));
+    _byteLengths[_numPackets] = byteLength;
+    _numPackets++;
+}
+
+int UDPSendBatch::flush() {
+    int packetsSent = _numPackets ? _socket->sendPackets(_destAddresses, _packets, _byteLengths, _numPackets) : 0;
+    _numPackets = 0;
+    return packetsSent;
+}
+
+UDPReceiveBatch::UDPReceiveBatch(UDPSocket* socket) :
+    _socket(socket),
+    _numPackets(0) {
+    _buffer = new unsigned char[MAX_PACKETS_PER_BATCH * MAX_BUFFER_LENGTH_BYTES];
+    for (int i = 0; i < MAX_PACKETS_PER_BATCH; i++) {
+        _packets[i] = _buffer + (i * MAX_BUFFER_LENGTH_BYTES);
+    }
+}
+
+UDPReceiveBatch::~UDPReceiveBatch() {
+    delete[] _buffer;
+}
+
+int UDPReceiveBatch::receive() {
+    _numPackets = _socket->receivePackets(_senderAddresses, _packets, _byteLengths, MAX_PACKETS_PER_BATCH);
+    return _numPackets;
+}
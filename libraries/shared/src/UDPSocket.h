@@ -18,24 +18,78 @@
 
 #define MAX_BUFFER_LENGTH_BYTES 1500
 
+// the most packets handed to the kernel in a single sendmmsg()/recvmmsg() call
+const int MAX_PACKETS_PER_BATCH = 32;
+
 class UDPSocket {    
 public:
     UDPSocket(int listening_port);
     ~UDPSocket();
     bool init();
     int getListeningPort() const { return listeningPort; }
+    int getHandle() const { return handle; }
     void setBlocking(bool blocking);
     bool isBlocking() const { return blocking; }
     int send(sockaddr* destAddress, const void* data, size_t byteLength) const;
     int send(char* destAddress, int destPort, const void* data, size_t byteLength) const;
     bool receive(void* receivedData, ssize_t* receivedBytes) const;
     bool receive(sockaddr* recvAddress, void* receivedData, ssize_t* receivedBytes) const;
+    
+    // Sends or receives several packets with as few system calls as possible (sendmmsg()/recvmmsg() on Linux).
+    // sendPackets() returns the number of packets sent. receivePackets() waits like receive() for the first packet
+    // then takes whatever else has already arrived, up to maxPackets, each buffer must hold MAX_BUFFER_LENGTH_BYTES.
+    int sendPackets(const sockaddr_in* destAddresses, unsigned char* const* packets, const size_t* byteLengths,
+                    int numPackets) const;
+    int receivePackets(sockaddr_in* recvAddresses, unsigned char* const* packets, ssize_t* receivedBytes,
+                       int maxPackets) const;
 private:
     int handle;
     int listeningPort;
     bool blocking;
 };
 
+// Packets queued up to go out together through UDPSocket::sendPackets(). The packets are copied, so the caller can
+// reuse its buffer as soon as queue() returns. A batch isn't locked, so each sending thread needs its own.
+class UDPSendBatch {
+public:
+    UDPSendBatch(UDPSocket* socket);
+    ~UDPSendBatch(); // sends anything still queued
+    
+    // sends the batch first if it's full, or if this packet is too big to queue and has to go out on its own
+    void queue(sockaddr* destAddress, const void* data, size_t byteLength);
+    int flush(); // returns the number of packets sent
+    
+    int getQueuedCount() const { return _numPackets; }
+private:
+    UDPSocket* _socket;
+    unsigned char* _buffer;
+    unsigned char* _packets[MAX_PACKETS_PER_BATCH];
+    size_t _byteLengths[MAX_PACKETS_PER_BATCH];
+    sockaddr_in _destAddresses[MAX_PACKETS_PER_BATCH];
+    int _numPackets;
+};
+
+// Buffers for the packets read by one UDPSocket::receivePackets() call
+class UDPReceiveBatch {
+public:
+    UDPReceiveBatch(UDPSocket* socket);
+    ~UDPReceiveBatch();
+    
+    int receive(); // returns the number of packets received, they replace the ones from the last call
+    
+    int getCount() const { return _numPackets; }
+    unsigned char* getPacket(int index) const { return _packets[index]; }
+    ssize_t getByteLength(int index) const { return _byteLengths[index]; }
+    sockaddr* getSenderAddress(int index) { return (sockaddr*) &_senderAddresses[index]; }
+private:
+    UDPSocket* _socket;
+    unsigned char* _buffer;
+    unsigned char* _packets[MAX_PACKETS_PER_BATCH];
+    ssize_t _byteLengths[MAX_PACKETS_PER_BATCH];
+    sockaddr_in _senderAddresses[MAX_PACKETS_PER_BATCH];
+    int _numPackets;
+};
+
 bool socketMatch(const sockaddr* first, const sockaddr* second);
 int packSocket(unsigned char* packStore, in_addr_t inAddress, in_port_t networkOrderPort);
 int packSocket(unsigned char* packStore, sockaddr* socketToPack);
@@ -0,0 +1,258 @@
+//
+//  VoxelChunkFile.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+#include "Log.h"
+#include "OctalCode.h"
+#include "VoxelChunkFile.h"
+
+const int VOXEL_CHUNK_FILE_HEADER_BYTES = sizeof(VOXEL_CHUNK_FILE_MAGIC) + sizeof(VOXEL_CHUNK_FILE_VERSION) + sizeof(unsigned char);
+const int VOXEL_CHUNK_FILE_FOOTER_BYTES = sizeof(uint64_t) + sizeof(uint32_t) + sizeof(VOXEL_CHUNK_FILE_MAGIC);
+
+// the chunks are addressed with 64 bit offsets, so big worlds can be more than 2GB
+static bool seekTo(FILE* file, uint64_t offset) {
+#ifdef _WIN32
+    return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, offset, SEEK_SET) == 0;
+#endif
+}
+
+VoxelChunkFile::VoxelChunkFile() :
+    _file(NULL) {
+}
+
+VoxelChunkFile::~VoxelChunkFile() {
+    close();
+}
+
+bool VoxelChunkFile::chunkKeyLessThan(const Chunk& chunkA, const Chunk& chunkB) {
+    return compareOctalCodes((unsigned char*)&chunkA.key[0], (unsigned char*)&chunkB.key[0]) == LESS_THAN;
+}
+
+VoxelChunkFile::Chunk& VoxelChunkFile::chunkForSubtree(unsigned char* octalCode) {
+    // the key is the octal code cut off at VOXEL_CHUNK_LEVEL
+    int keySections = std::min(numberOfThreeBitSectionsInCode(octalCode), VOXEL_CHUNK_LEVEL);
+    int keyBytes = bytesRequiredForCodeLength(keySections);
+    std::vector<unsigned char> key(octalCode, octalCode + keyBytes);
+    key[0] = keySections;
+
+    // clear any bits past the last section we kept
+    int usedBitsInLastByte = (keySections * BITS_IN_OCTAL) % BITS_IN_BYTE;
+    if (keyBytes > 1 && usedBitsInLastByte) {
+        key[keyBytes - 1] &= (unsigned char)(0xFF << (BITS_IN_BYTE - usedBitsInLastByte));
+    }
+
+    std::string keyString(key.begin(), key.end());
+    std::map<std::string, int>::iterator existingChunk = _chunksByKey.find(keyString);
+    if (existingChunk != _chunksByKey.end()) {
+        return _chunks[existingChunk->second];
+    }
+
+    Chunk newChunk;
+    newChunk.key = key;
+    newChunk.offset = 0;
+    newChunk.storedLength = 0;
+    newChunk.length = 0;
+    newChunk.compression = VOXEL_CHUNK_UNCOMPRESSED;
+    _chunks.push_back(newChunk);
+    _chunksByKey[keyString] = _chunks.size() - 1;
+    return _chunks.back();
+}
+
+void VoxelChunkFile::addSubtreeBitstream(unsigned char* bitstream, int length) {
+    Chunk& chunk = chunkForSubtree(bitstream);
+    chunk.data.insert(chunk.data.end(), bitstream, bitstream + length);
+}
+
+bool VoxelChunkFile::save(const char* fileName, bool wantCompression) {
+    FILE* file = fopen(fileName, "wb");
+    if (!file) {
+        printLog("Unable to open %s for writing\n", fileName);
+        return false;
+    }
+
+    // chunks go out in octal code order, the index built from them follows that order too
+    std::sort(_chunks.begin(), _chunks.end(), chunkKeyLessThan);
+    _chunksByKey.clear();
+
+    const unsigned char flags = 0; // reserved
+    fwrite(VOXEL_CHUNK_FILE_MAGIC, sizeof(VOXEL_CHUNK_FILE_MAGIC), 1, file);
+    fwrite(&VOXEL_CHUNK_FILE_VERSION, sizeof(VOXEL_CHUNK_FILE_VERSION), 1, file);
+    fwrite(&flags, sizeof(flags), 1, file);
+    uint64_t offset = VOXEL_CHUNK_FILE_HEADER_BYTES;
+
+    std::vector<unsigned char> compressed;
+    for (int i = 0; i < _chunks.size(); i++) {
+        Chunk& chunk = _chunks[i];
+        chunk.offset = offset;
+        chunk.length = chunk.data.size();
+        chunk.storedLength = chunk.length;
+        chunk.compression = VOXEL_CHUNK_UNCOMPRESSED;
+        unsigned char* storedData = &chunk.data[0];
+
+        // only keep the compressed version if it actually saves something
+        if (wantCompression) {
+            uLongf compressedLength = compressBound(chunk.length);
+            compressed.resize(compressedLength);
+            if (compress2(&compressed[0], &compressedLength, &chunk.data[0], chunk.length, Z_DEFAULT_COMPRESSION) == Z_OK
+                && compressedLength < chunk.length) {
+                chunk.storedLength = compressedLength;
+                chunk.compression = VOXEL_CHUNK_ZLIB_COMPRESSED;
+                storedData = &compressed[0];
+            }
+        }
+
+        fwrite(storedData, chunk.storedLength, 1, file);
+        offset += chunk.storedLength;
+
+        std::vector<unsigned char>().swap(chunk.data); // we're done with it
+    }
+
+    uint64_t indexOffset = offset;
+    for (int i = 0; i < _chunks.size(); i++) {
+        Chunk& chunk = _chunks[i];
+        fwrite(&chunk.key[0], chunk.key.size(), 1, file);
+        fwrite(&chunk.offset, sizeof(chunk.offset), 1, file);
+        fwrite(&chunk.storedLength, sizeof(chunk.storedLength), 1, file);
+        fwrite(&chunk.length, sizeof(chunk.length), 1, file);
+        fwrite(&chunk.compression, sizeof(chunk.compression), 1, file);
+    }
+
+    uint32_t chunkCount = _chunks.size();
+    fwrite(&indexOffset, sizeof(indexOffset), 1, file);
+    fwrite(&chunkCount, sizeof(chunkCount), 1, file);
+    fwrite(VOXEL_CHUNK_FILE_MAGIC, sizeof(VOXEL_CHUNK_FILE_MAGIC), 1, file);
+
+    // a persist snapshot is moved over the last one if this succeeds, so the close has to have worked too
+    bool success = (ferror(file) == 0);
+    if (fclose(file) != 0) {
+        success = false;
+    }
+    return success;
+}
+
+bool VoxelChunkFile::isChunkFile(const char* fileName) {
+    FILE* file = fopen(fileName, "rb");
+    if (!file) {
+        return false;
+    }
+    unsigned char magic[sizeof(VOXEL_CHUNK_FILE_MAGIC)];
+    bool isChunkFile = fread(magic, sizeof(magic), 1, file) == 1
+        && memcmp(magic, VOXEL_CHUNK_FILE_MAGIC, sizeof(magic)) == 0;
+    fclose(file);
+    return isChunkFile;
+}
+
+bool VoxelChunkFile::open(const char* fileName) {
+    close();
+    _chunks.clear();
+
+    _file = fopen(fileName, "rb");
+    if (!_file) {
+        return false;
+    }
+
+    // a version we don't know could lay anything out differently, so don't guess at it
+    unsigned char headerMagic[sizeof(VOXEL_CHUNK_FILE_MAGIC)];
+    unsigned char version;
+    if (fread(headerMagic, sizeof(headerMagic), 1, _file) != 1
+        || memcmp(headerMagic, VOXEL_CHUNK_FILE_MAGIC, sizeof(headerMagic)) != 0
+        || fread(&version, sizeof(version), 1, _file) != 1) {
+        printLog("%s is not a voxel chunk file\n", fileName);
+        close();
+        return false;
+    }
+    if (version != VOXEL_CHUNK_FILE_VERSION) {
+        printLog("%s is a version %d voxel chunk file, only version %d can be read\n", fileName, version,
+                 VOXEL_CHUNK_FILE_VERSION);
+        close();
+        return false;
+    }
+
+    // the footer tells us where the index is
+    uint64_t indexOffset;
+    uint32_t chunkCount;
+    unsigned char magic[sizeof(VOXEL_CHUNK_FILE_MAGIC)];
+    if (fseek(_file, -VOXEL_CHUNK_FILE_FOOTER_BYTES, SEEK_END) != 0
+        || fread(&indexOffset, sizeof(indexOffset), 1, _file) != 1
+        || fread(&chunkCount, sizeof(chunkCount), 1, _file) != 1
+        || fread(magic, sizeof(magic), 1, _file) != 1
+        || memcmp(magic, VOXEL_CHUNK_FILE_MAGIC, sizeof(magic)) != 0
+        || !seekTo(_file, indexOffset)) {
+        printLog("%s is not a voxel chunk file, or it was not completely written\n", fileName);
+        close();
+        return false;
+    }
+
+    for (int i = 0; i < chunkCount; i++) {
+        Chunk chunk;
+        unsigned char keySections;
+        if (fread(&keySections, sizeof(keySections), 1, _file) != 1) {
+            break;
+        }
+        chunk.key.resize(bytesRequiredForCodeLength(keySections));
+        chunk.key[0] = keySections;
+        if ((chunk.key.size() > 1 && fread(&chunk.key[1], chunk.key.size() - 1, 1, _file) != 1)
+            || fread(&chunk.offset, sizeof(chunk.offset), 1, _file) != 1
+            || fread(&chunk.storedLength, sizeof(chunk.storedLength), 1, _file) != 1
+            || fread(&chunk.length, sizeof(chunk.length), 1, _file) != 1
+            || fread(&chunk.compression, sizeof(chunk.compression), 1, _file) != 1) {
+            break;
+        }
+        _chunks.push_back(chunk);
+    }
+
+    if (_chunks.size() != chunkCount) {
+        printLog("%s has a damaged chunk index\n", fileName);
+        close();
+        _chunks.clear();
+        return false;
+    }
+    return true;
+}
+
+void VoxelChunkFile::close() {
+    if (_file) {
+        fclose(_file);
+        _file = NULL;
+    }
+}
+
+bool VoxelChunkFile::chunkTouchesSubtree(int chunkIndex, unsigned char* subtreeOctalCode) {
+    unsigned char* key = getChunkKey(chunkIndex);
+    return isAncestorOf(key, subtreeOctalCode) || isAncestorOf(subtreeOctalCode, key);
+}
+
+int VoxelChunkFile::readChunk(int chunkIndex, std::vector<unsigned char>& bitstream) {
+    Chunk& chunk = _chunks[chunkIndex];
+    if (!_file || !seekTo(_file, chunk.offset)) {
+        return 0;
+    }
+
+    if (chunk.compression == VOXEL_CHUNK_UNCOMPRESSED) {
+        bitstream.resize(chunk.length);
+        if (chunk.length == 0 || fread(&bitstream[0], chunk.length, 1, _file) != 1) {
+            return 0;
+        }
+    } else if (chunk.compression == VOXEL_CHUNK_ZLIB_COMPRESSED) {
+        std::vector<unsigned char> compressed(chunk.storedLength);
+        bitstream.resize(chunk.length);
+        uLongf length = chunk.length;
+        if (chunk.storedLength == 0 || fread(&compressed[0], chunk.storedLength, 1, _file) != 1
+            || uncompress(&bitstream[0], &length, &compressed[0], chunk.storedLength) != Z_OK || length != chunk.length) {
+            return 0;
+        }
+    } else {
+        printLog("Unknown compression %d on voxel chunk %d\n", chunk.compression, chunkIndex);
+        return 0;
+    }
+    return chunk.length;
+}
@@ -0,0 +1,76 @@
+//
+//  VoxelChunkFile.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Indexed, chunked voxel file. The encoded subtrees that make up an SVO file are grouped into chunks keyed by an
+//  octal code, so that a region of the tree can be read without parsing everything before it.
+//
+//  Layout:
+//      header      magic "HVOX", version, flags
+//      chunks      each chunk is a run of encoded subtrees (each starting with its octal code) just like an SVO
+//                  file, optionally zlib compressed, in octal code order of their keys
+//      index       for each chunk: key octal code, offset, stored length, length, compression
+//      footer      index offset, chunk count, magic "HVOX"
+//
+
+#ifndef __hifi__VoxelChunkFile__
+#define __hifi__VoxelChunkFile__
+
+#include <cstdio>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+const unsigned char VOXEL_CHUNK_FILE_MAGIC[] = { 'H', 'V', 'O', 'X' };
+const unsigned char VOXEL_CHUNK_FILE_VERSION = 1;
+
+// subtrees rooted at this level or deeper are grouped with the rest of the subtrees below their ancestor at
+// this level, subtrees above it each get their own chunk
+const int VOXEL_CHUNK_LEVEL = 4;
+
+const unsigned char VOXEL_CHUNK_UNCOMPRESSED = 0;
+const unsigned char VOXEL_CHUNK_ZLIB_COMPRESSED = 1;
+
+class VoxelChunkFile {
+public:
+    VoxelChunkFile();
+    ~VoxelChunkFile();
+
+    // writing: add each encoded subtree (as written by encodeTreeBitstream()) then save
+    void addSubtreeBitstream(unsigned char* bitstream, int length);
+    bool save(const char* fileName, bool wantCompression = true);
+
+    // reading: open() only reads the index, chunks are read from the file as they're asked for
+    bool open(const char* fileName);
+    void close();
+
+    int getChunkCount() const { return _chunks.size(); }
+    unsigned char* getChunkKey(int chunkIndex) { return &_chunks[chunkIndex].key[0]; }
+    bool chunkTouchesSubtree(int chunkIndex, unsigned char* subtreeOctalCode);
+    int readChunk(int chunkIndex, std::vector<unsigned char>& bitstream); // returns the length, 0 on failure
+
+    static bool isChunkFile(const char* fileName);
+
+private:
+    class Chunk {
+    public:
+        std::vector<unsigned char> key;
+        std::vector<unsigned char> data; // only used while writing
+        uint64_t offset;
+        uint32_t storedLength;
+        uint32_t length;
+        unsigned char compression;
+    };
+
+    static bool chunkKeyLessThan(const Chunk& chunkA, const Chunk& chunkB);
+    Chunk& chunkForSubtree(unsigned char* octalCode);
+
+    std::vector<Chunk> _chunks;
+    std::map<std::string, int> _chunksByKey; // only used while writing
+    FILE* _file;
+};
+
+#endif /* defined(__hifi__VoxelChunkFile__) */
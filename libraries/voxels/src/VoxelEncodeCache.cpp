@@ -0,0 +1,108 @@
+//
+//  VoxelEncodeCache.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+
+#include "VoxelNode.h"
+#include "VoxelNodeBag.h"
+#include "VoxelEncodeCache.h"
+
+bool VoxelEncodeCacheKey::operator<(const VoxelEncodeCacheKey& other) const {
+    if (node != other.node) {
+        return node < other.node;
+    }
+    if (lodLevel != other.lodLevel) {
+        return lodLevel < other.lodLevel;
+    }
+    if (availableBytes != other.availableBytes) {
+        return availableBytes < other.availableBytes;
+    }
+    if (includeColor != other.includeColor) {
+        return includeColor < other.includeColor;
+    }
+    return includeExistsBits < other.includeExistsBits;
+}
+
+VoxelEncodeCache::VoxelEncodeCache(long maxBytes) :
+    _maxBytes(maxBytes),
+    _bytesUsed(0),
+    _hits(0),
+    _misses(0) {
+    pthread_mutex_init(&_lock, NULL);
+}
+
+VoxelEncodeCache::~VoxelEncodeCache() {
+    pthread_mutex_destroy(&_lock);
+}
+
+long VoxelEncodeCache::bytesUsedBy(const Encoding& encoding) {
+    return sizeof(VoxelEncodeCacheKey) + sizeof(Encoding) + encoding.bytes.size()
+        + encoding.nodesBagged.size() * sizeof(VoxelNode*);
+}
+
+bool VoxelEncodeCache::fetch(const VoxelEncodeCacheKey& key, unsigned char* outputBuffer, int& bytesWritten,
+                             int& levelsReached, VoxelNodeBag& bag) {
+    pthread_mutex_lock(&_lock);
+    std::map<VoxelEncodeCacheKey, Encoding>::iterator found = _encodings.find(key);
+
+    // a change in the same usec as the encoding might have come after it, so treat that as stale too
+    if (found == _encodings.end() || key.node->getLastChanged() >= found->second.encodedAt) {
+        _misses++;
+        pthread_mutex_unlock(&_lock);
+        return false;
+    }
+
+    const Encoding& encoding = found->second;
+    bytesWritten = encoding.bytes.size();
+    if (bytesWritten) {
+        memcpy(outputBuffer, &encoding.bytes[0], bytesWritten);
+    }
+    levelsReached = encoding.levelsReached;
+
+    // the subtree is unchanged, so the nodes that were left for later are still there
+    for (int i = 0; i < encoding.nodesBagged.size(); i++) {
+        bag.insert(encoding.nodesBagged[i]);
+    }
+    _hits++;
+    pthread_mutex_unlock(&_lock);
+    return true;
+}
+
+void VoxelEncodeCache::store(const VoxelEncodeCacheKey& key, uint64_t encodedAt, const unsigned char* outputBuffer,
+                             int bytesWritten, int levelsReached, const std::vector<VoxelNode*>& nodesBagged) {
+    pthread_mutex_lock(&_lock);
+
+    // replaces any stale encoding of the same subtree
+    std::map<VoxelEncodeCacheKey, Encoding>::iterator existing = _encodings.find(key);
+    if (existing != _encodings.end()) {
+        _bytesUsed -= bytesUsedBy(existing->second);
+        _encodings.erase(existing);
+    }
+
+    // Stale encodings are only ever replaced, so rather than tracking which ones are still useful we start over
+    // whenever we hit our limit. Viewers that are still around fill it back up with what they're looking at.
+    if (_bytesUsed >= _maxBytes) {
+        _encodings.clear();
+        _bytesUsed = 0;
+    }
+
+    Encoding& encoding = _encodings[key];
+    encoding.encodedAt = encodedAt;
+    encoding.bytes.assign(outputBuffer, outputBuffer + bytesWritten);
+    encoding.nodesBagged = nodesBagged;
+    encoding.levelsReached = levelsReached;
+    _bytesUsed += bytesUsedBy(encoding);
+
+    pthread_mutex_unlock(&_lock);
+}
+
+void VoxelEncodeCache::clear() {
+    pthread_mutex_lock(&_lock);
+    _encodings.clear();
+    _bytesUsed = 0;
+    pthread_mutex_unlock(&_lock);
+}
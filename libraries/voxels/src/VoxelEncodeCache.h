@@ -0,0 +1,82 @@
+//
+//  VoxelEncodeCache.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Remembers the bytes encodeTreeBitstream() wrote for a subtree, so that other viewers who are looking at the same
+//  subtree in the same way can be sent those bytes without encoding it again. An encoding is only reused while the
+//  subtree root hasn't been marked as changed (see VoxelNode::markWithChangedTime()) since it was made. The cache
+//  can be shared by threads encoding for different viewers.
+//
+
+#ifndef __hifi__VoxelEncodeCache__
+#define __hifi__VoxelEncodeCache__
+
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+#ifdef _WIN32
+#include "pthread.h"
+#else
+#include <pthread.h>
+#endif
+
+class VoxelNode;
+class VoxelNodeBag;
+
+const long DEFAULT_VOXEL_ENCODE_CACHE_BYTES = 16 * 1024 * 1024;
+
+// everything besides the subtree contents that the encoded bytes depend on
+class VoxelEncodeCacheKey {
+public:
+    VoxelNode*  node;
+    int         lodLevel; // deepest level sent in full, see VoxelTree::encodeTreeBitstream()
+    int         availableBytes;
+    bool        includeColor;
+    bool        includeExistsBits;
+
+    bool operator<(const VoxelEncodeCacheKey& other) const;
+};
+
+class VoxelEncodeCache {
+public:
+    VoxelEncodeCache(long maxBytes = DEFAULT_VOXEL_ENCODE_CACHE_BYTES);
+    ~VoxelEncodeCache();
+
+    // Copies a still valid encoding into outputBuffer and puts the nodes it left for later back in the bag. The
+    // caller must hold the tree for reading, so that key.node can't change underneath us.
+    bool fetch(const VoxelEncodeCacheKey& key, unsigned char* outputBuffer, int& bytesWritten, int& levelsReached,
+               VoxelNodeBag& bag);
+
+    // encodedAt is when the encoding started, nodesBagged are the nodes it put in the bag because they didn't fit
+    void store(const VoxelEncodeCacheKey& key, uint64_t encodedAt, const unsigned char* outputBuffer, int bytesWritten,
+               int levelsReached, const std::vector<VoxelNode*>& nodesBagged);
+
+    void clear();
+
+    long getHits() const { return _hits; }
+    long getMisses() const { return _misses; }
+    long getBytesUsed() const { return _bytesUsed; }
+
+private:
+    class Encoding {
+    public:
+        uint64_t encodedAt;
+        std::vector<unsigned char> bytes;
+        std::vector<VoxelNode*> nodesBagged;
+        int levelsReached;
+    };
+
+    static long bytesUsedBy(const Encoding& encoding);
+
+    std::map<VoxelEncodeCacheKey, Encoding> _encodings;
+    pthread_mutex_t _lock;
+    long _maxBytes;
+    long _bytesUsed;
+    long _hits;
+    long _misses;
+};
+
+#endif /* defined(__hifi__VoxelEncodeCache__) */
@@ -9,6 +9,15 @@
 #include <stdio.h>
 #include <cmath>
 #include <cstring>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include "pthread.h"
+#else
+#include <pthread.h>
+#endif
+
 #include "SharedUtil.h"
 #include "Log.h"
 #include "VoxelNode.h"
@@ -17,19 +26,107 @@
 #include "OctalCode.h"
 #include "AABox.h"
 
+// The node slabs are shared by every VoxelTree in the process. Freed nodes go on a free list (linked through
+// the freed nodes themselves) and are reused before a new slab is carved out. Slabs are never given back.
+static pthread_mutex_t nodePoolLock = PTHREAD_MUTEX_INITIALIZER;
+static void* nodePoolFreeList = NULL;
+static unsigned long nodePoolNodesAllocated = 0;
+static unsigned long nodePoolNodesInUse = 0;
+
+// these are only statistics, so they aren't locked
+static unsigned long octcodeMemoryUsage = 0;
+static unsigned long childrenMemoryUsage = 0;
+
+void* VoxelNode::operator new(size_t size) {
+    // only VoxelNode sized things come out of the pool
+    if (size != sizeof(VoxelNode)) {
+        return ::operator new(size);
+    }
+    
+    pthread_mutex_lock(&nodePoolLock);
+    if (!nodePoolFreeList) {
+        unsigned char* slab = (unsigned char*) malloc(VOXEL_NODES_PER_SLAB * sizeof(VoxelNode));
+        if (!slab) {
+            pthread_mutex_unlock(&nodePoolLock);
+            throw std::bad_alloc();
+        }
+        
+        // chain the slab from the back, so that consecutive allocations walk forward through memory
+        for (int i = VOXEL_NODES_PER_SLAB - 1; i >= 0; i--) {
+            void* node = slab + (i * sizeof(VoxelNode));
+            *(void**)node = nodePoolFreeList;
+            nodePoolFreeList = node;
+        }
+        nodePoolNodesAllocated += VOXEL_NODES_PER_SLAB;
+    }
+    void* node = nodePoolFreeList;
+    nodePoolFreeList = *(void**)node;
+    nodePoolNodesInUse++;
+    pthread_mutex_unlock(&nodePoolLock);
+    
+    return node;
+}
+
+void VoxelNode::operator delete(void* node) {
+    if (!node) {
+        return;
+    }
+    pthread_mutex_lock(&nodePoolLock);
+    *(void**)node = nodePoolFreeList;
+    nodePoolFreeList = node;
+    nodePoolNodesInUse--;
+    pthread_mutex_unlock(&nodePoolLock);
+}
+
+unsigned long VoxelNode::getNodesInUse() {
+    return nodePoolNodesInUse;
+}
+
+unsigned long VoxelNode::getNodesAllocated() {
+    return nodePoolNodesAllocated;
+}
+
+unsigned long VoxelNode::getVoxelMemoryUsage() {
+    return (getNodesInUse() * sizeof(VoxelNode)) + getOctcodeMemoryUsage() + getChildrenMemoryUsage();
+}
+
+unsigned long VoxelNode::getOctcodeMemoryUsage() {
+    return octcodeMemoryUsage;
+}
+
+unsigned long VoxelNode::getChildrenMemoryUsage() {
+    return childrenMemoryUsage;
+}
+
 VoxelNode::VoxelNode() {
-    unsigned char* rootCode = new unsigned char[1];
-    *rootCode = 0;
-    init(rootCode);
+    *allocateOctalCode(1) = 0; // root code
+    init();
 }
 
 VoxelNode::VoxelNode(unsigned char * octalCode) {
-    init(octalCode);
+    int codeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(octalCode));
+    memcpy(allocateOctalCode(codeBytes), octalCode, codeBytes);
+    init();
 }
 
-void VoxelNode::init(unsigned char * octalCode) {
-    _octalCode = octalCode;
-    
+VoxelNode::VoxelNode(VoxelNode* parent, int childIndex) {
+    unsigned char* parentCode = parent->getOctalCode();
+    int codeBytes = bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(parentCode) + 1);
+    copyChildOctalCode(parentCode, childIndex, allocateOctalCode(codeBytes));
+    init();
+}
+
+// returns the storage for an octal code of the given size, inline if it fits
+unsigned char* VoxelNode::allocateOctalCode(int bytes) {
+    _isOctalCodeInline = (bytes <= MAX_INLINE_OCTAL_CODE_BYTES);
+    if (!_isOctalCodeInline) {
+        _octalCode.pointer = new unsigned char[bytes];
+        octcodeMemoryUsage += bytes;
+    }
+    return getOctalCode();
+}
+
+void VoxelNode::init() {
 #ifndef NO_FALSE_COLOR // !NO_FALSE_COLOR means, does have false color
     _falseColored = false; // assume true color
     _currentColor[0] = _currentColor[1] = _currentColor[2] = _currentColor[3] = 0;
@@ -37,11 +134,9 @@ void VoxelNode::init(unsigned char * octalCode) {
     _trueColor[0] = _trueColor[1] = _trueColor[2] = _trueColor[3] = 0;
     _density = 0.0f;
     
-    // default pointers to child nodes to NULL
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        _children[i] = NULL;
-    }
-    _childCount = 0;
+    // no children to start with
+    _childBitmask = 0;
+    _children = NULL;
     
     _glBufferIndex = GLBUFFER_INDEX_UNKNOWN;
     _isDirty = true;
@@ -52,13 +147,55 @@ void VoxelNode::init(unsigned char * octalCode) {
 }
 
 VoxelNode::~VoxelNode() {
-    delete[] _octalCode;
+    if (!_isOctalCodeInline) {
+        octcodeMemoryUsage -= bytesRequiredForCodeLength(numberOfThreeBitSectionsInCode(_octalCode.pointer));
+        delete[] _octalCode.pointer;
+    }
     
     // delete all of this node's children
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        if (_children[i]) {
-            delete _children[i];
+    int childCount = getChildCount();
+    for (int i = 0; i < childCount; i++) {
+        delete _children[i];
+    }
+    delete[] _children;
+    childrenMemoryUsage -= childCount * sizeof(VoxelNode*);
+}
+
+// Sets (or with NULL clears) the child at childIndex, growing or shrinking the packed child array as needed.
+// Does not delete any child being replaced or cleared, and does not mark the node as changed.
+void VoxelNode::setChildAtIndex(int childIndex, VoxelNode* child) {
+    unsigned char childBit = (1 << childIndex);
+    int arrayIndex = numberOfOnes(_childBitmask & (childBit - 1));
+    bool hadChild = (_childBitmask & childBit);
+    
+    if (hadChild && child) {
+        _children[arrayIndex] = child;
+    } else if (hadChild || child) {
+        int oldChildCount = getChildCount();
+        int newChildCount = child ? oldChildCount + 1 : oldChildCount - 1;
+        VoxelNode** newChildren = newChildCount ? new VoxelNode*[newChildCount] : NULL;
+        
+        // children before this one keep their spot, the ones after move back (adding) or forward (removing). Either
+        // array can be NULL when there's nothing to copy, and memcpy() can't be handed NULL even to copy nothing.
+        if (arrayIndex > 0) {
+            memcpy(newChildren, _children, arrayIndex * sizeof(VoxelNode*));
         }
+        if (child) {
+            newChildren[arrayIndex] = child;
+            if (oldChildCount > arrayIndex) {
+                memcpy(&newChildren[arrayIndex + 1], &_children[arrayIndex],
+                       (oldChildCount - arrayIndex) * sizeof(VoxelNode*));
+            }
+        } else if (oldChildCount - arrayIndex - 1 > 0) {
+            memcpy(&newChildren[arrayIndex], &_children[arrayIndex + 1],
+                   (oldChildCount - arrayIndex - 1) * sizeof(VoxelNode*));
+        }
+        
+        delete[] _children;
+        _children = newChildren;
+        _childBitmask ^= childBit;
+        childrenMemoryUsage += newChildCount * sizeof(VoxelNode*);
+        childrenMemoryUsage -= oldChildCount * sizeof(VoxelNode*);
     }
 }
 
@@ -93,45 +230,46 @@ void VoxelNode::calculateAABox() {
     glm::vec3 size;
     
     // copy corner into box
-    copyFirstVertexForCode(_octalCode,(float*)&corner);
+    unsigned char* octalCode = getOctalCode();
+    copyFirstVertexForCode(octalCode,(float*)&corner);
     
     // this tells you the "size" of the voxel
-    float voxelScale = 1 / powf(2, *_octalCode);
+    float voxelScale = 1 / powf(2, *octalCode);
     size = glm::vec3(voxelScale,voxelScale,voxelScale);
     
     _box.setBox(corner,size);
 }
 
 void VoxelNode::deleteChildAtIndex(int childIndex) {
-    if (_children[childIndex]) {
-        delete _children[childIndex];
-        _children[childIndex] = NULL;
+    VoxelNode* childAt = getChildAtIndex(childIndex);
+    if (childAt) {
+        delete childAt;
+        setChildAtIndex(childIndex, NULL);
         _isDirty = true;
         markWithChangedTime();
-        _childCount--;
     }
 }
 
 // does not delete the node!
 VoxelNode* VoxelNode::removeChildAtIndex(int childIndex) {
-    VoxelNode* returnedChild = _children[childIndex];
-    if (_children[childIndex]) {
-        _children[childIndex] = NULL;
+    VoxelNode* returnedChild = getChildAtIndex(childIndex);
+    if (returnedChild) {
+        setChildAtIndex(childIndex, NULL);
         _isDirty = true;
         markWithChangedTime();
-        _childCount--;
     }
     return returnedChild;
 }
 
 VoxelNode* VoxelNode::addChildAtIndex(int childIndex) {
-    if (!_children[childIndex]) {
-        _children[childIndex] = new VoxelNode(childOctalCode(_octalCode, childIndex));
+    VoxelNode* childAt = getChildAtIndex(childIndex);
+    if (!childAt) {
+        childAt = new VoxelNode(this, childIndex);
+        setChildAtIndex(childIndex, childAt);
         _isDirty = true;
         markWithChangedTime();
-        _childCount++;
     }
-    return _children[childIndex];
+    return childAt;
 }
 
 // handles staging or deletion of all deep children
@@ -165,16 +303,15 @@ void VoxelNode::safeDeepDeleteChildAtIndex(int childIndex, bool& stagedForDeleti
 void VoxelNode::setColorFromAverageOfChildren() {
     int colorArray[4] = {0,0,0,0};
     float density = 0.0f;
-    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        if (_children[i] && !_children[i]->isStagedForDeletion() && _children[i]->isColored()) {
+    int childCount = getChildCount();
+    for (int i = 0; i < childCount; i++) {
+        if (!_children[i]->isStagedForDeletion() && _children[i]->isColored()) {
             for (int j = 0; j < 3; j++) {
                 colorArray[j] += _children[i]->getTrueColor()[j]; // color averaging should always be based on true colors
             }
             colorArray[3]++;
         }
-        if (_children[i]) {
-            density += _children[i]->getDensity();
-        }
+        density += _children[i]->getDensity();
     }
     density /= (float) NUMBER_OF_CHILDREN;    
     //
@@ -255,7 +392,8 @@ bool VoxelNode::collapseIdenticalLeaves() {
     int red,green,blue;
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
         // if no child, child isn't a leaf, or child doesn't have a color
-        if (!_children[i] || _children[i]->isStagedForDeletion() || !_children[i]->isLeaf() || !_children[i]->isColored()) {
+        if (getChildCount() != NUMBER_OF_CHILDREN ||
+            _children[i]->isStagedForDeletion() || !_children[i]->isLeaf() || !_children[i]->isColored()) {
             allChildrenMatch=false;
             //printLog("SADNESS child missing or not colored! i=%d\n",i);
             break;
@@ -277,9 +415,11 @@ bool VoxelNode::collapseIdenticalLeaves() {
         //printLog("allChildrenMatch: pruning tree\n");
         for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
             delete _children[i]; // delete all the child nodes
-            _children[i]=NULL; // set it to NULL
         }
-        _childCount = 0;
+        delete[] _children;
+        _children = NULL;
+        _childBitmask = 0;
+        childrenMemoryUsage -= NUMBER_OF_CHILDREN * sizeof(VoxelNode*);
         nodeColor collapsedColor;
         collapsedColor[0]=red;        
         collapsedColor[1]=green;        
@@ -303,7 +443,7 @@ void VoxelNode::setRandomColor(int minimumBrightness) {
 void VoxelNode::printDebugDetails(const char* label) const {
     unsigned char childBits = 0;
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
-        if (_children[i]) {
+        if (getChildAtIndex(i)) {
             setAtBit(childBits,i);            
         }
     }
@@ -315,7 +455,7 @@ void VoxelNode::printDebugDetails(const char* label) const {
         
     outputBits(childBits, false);
     printLog("\n octalCode=");
-    printOctalCode(_octalCode);
+    printOctalCode(getOctalCode());
 }
 
 float VoxelNode::getEnclosingRadius() const {
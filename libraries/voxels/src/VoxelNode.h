@@ -20,6 +20,13 @@ typedef unsigned char colorPart;
 typedef unsigned char nodeColor[4];
 typedef unsigned char rgbColor[3];
 
+// octal codes up to this many bytes (18 levels deep) are stored in the node itself instead of on the heap
+const int MAX_INLINE_OCTAL_CODE_BYTES = sizeof(uint64_t);
+
+// VoxelNodes are carved out of large slabs instead of being individually heap allocated, so nodes that are
+// created together (like siblings read out of the same packet) end up next to each other in memory
+const int VOXEL_NODES_PER_SLAB = 4096;
+
 class VoxelNode {
 private:
     nodeColor _trueColor;
@@ -33,22 +40,48 @@ private:
     bool _shouldRender;
     bool _isStagedForDeletion;
     AABox _box;
-    unsigned char* _octalCode;
-    VoxelNode* _children[8];
-    int _childCount;
+    union {
+        unsigned char buffer[MAX_INLINE_OCTAL_CODE_BYTES];
+        unsigned char* pointer;
+    } _octalCode;
+    bool _isOctalCodeInline;
+    
+    // Most nodes are leaves, so rather than always carrying 8 child pointers we keep a bit per possible child
+    // (bit i set means child i exists) and a packed array holding only the children that exist, in index order
+    unsigned char _childBitmask;
+    VoxelNode** _children;
     float _density;             // If leaf: density = 1, if internal node: 0-1 density of voxels inside
 
     void calculateAABox();
 
-    void init(unsigned char * octalCode);
+    void init();
+    unsigned char* allocateOctalCode(int bytes);
+    void setChildAtIndex(int childIndex, VoxelNode* child);
+
+    VoxelNode(VoxelNode* parent, int childIndex); // child constructor, used by addChildAtIndex()
 
 public:
     VoxelNode(); // root node constructor
-    VoxelNode(unsigned char * octalCode); // regular constructor
+    VoxelNode(unsigned char * octalCode); // regular constructor, octalCode is copied so the caller still owns it
     ~VoxelNode();
     
-    unsigned char* getOctalCode() const { return _octalCode; };
-    VoxelNode* getChildAtIndex(int childIndex) const { return _children[childIndex]; };
+    static void* operator new(size_t size);
+    static void operator delete(void* node);
+    static unsigned long getNodesInUse();
+    static unsigned long getNodesAllocated();
+    
+    // memory used by all voxels in the process: the nodes themselves, octal codes too big to be stored
+    // inline, and the packed child arrays
+    static unsigned long getVoxelMemoryUsage();
+    static unsigned long getOctcodeMemoryUsage();
+    static unsigned long getChildrenMemoryUsage();
+
+    unsigned char* getOctalCode() const {
+        return _isOctalCodeInline ? (unsigned char*)_octalCode.buffer : _octalCode.pointer;
+    };
+    VoxelNode* getChildAtIndex(int childIndex) const {
+        return (_childBitmask & (1 << childIndex)) ? _children[numberOfOnes(_childBitmask & ((1 << childIndex) - 1))] : NULL;
+    };
     void deleteChildAtIndex(int childIndex);
     VoxelNode* removeChildAtIndex(int childIndex);
     VoxelNode* addChildAtIndex(int childIndex);
@@ -62,7 +95,7 @@ public:
     const glm::vec3& getCenter() const { return _box.getCenter(); };
     const glm::vec3& getCorner() const { return _box.getCorner(); };
     float getScale() const { return _box.getSize().x;  /* voxelScale = (1 / powf(2, *node->getOctalCode())); */ };
-    int getLevel() const { return *_octalCode + 1; /* one based or zero based? this doesn't correctly handle 2 byte case */ };
+    int getLevel() const { return *getOctalCode() + 1; /* one based or zero based? this doesn't correctly handle 2 byte case */ };
     
     float getEnclosingRadius() const;
     
@@ -75,12 +108,13 @@ public:
     float distanceSquareToPoint(const glm::vec3& point) const; // when you don't need the actual distance, use this.
     float distanceToPoint(const glm::vec3& point) const;
 
-    bool isLeaf() const { return _childCount == 0; }
-    int getChildCount() const { return _childCount; }
+    bool isLeaf() const { return _childBitmask == 0; }
+    int getChildCount() const { return numberOfOnes(_childBitmask); }
     void printDebugDetails(const char* label) const;
     bool isDirty() const { return _isDirty; };
     void clearDirtyBit() { _isDirty = false; };
     bool hasChangedSince(uint64_t time) const { return (_lastChanged > time);  };
+    uint64_t getLastChanged() const { return _lastChanged; }
     void markWithChangedTime() { _lastChanged = usecTimestampNow();  };
     void handleSubtreeChanged(VoxelTree* myTree);
     
@@ -25,10 +25,19 @@
 #include "CoverageMap.h"
 #include "SquarePixelMap.h"
 #include "Tags.h"
+#include "VoxelChunkFile.h"
+#include "VoxelEncodeCache.h"
 
 
 #include <glm/gtc/noise.hpp>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 float boundaryDistanceForRenderLevel(unsigned int renderLevel) {
     const float voxelSizeScale = 50000.0f;
     return voxelSizeScale / powf(2, renderLevel);
@@ -47,8 +56,15 @@ VoxelTree::VoxelTree(bool shouldReaverage) :
     voxelsColoredStats(100),
     voxelsBytesReadStats(100),
     _isDirty(true),
-    _shouldReaverage(shouldReaverage) {
+    _shouldReaverage(shouldReaverage),
+    _editBatchHook(NULL),
+    _editBatchHookData(NULL),
+    _numUnmaterializedSubtrees(0),
+    _mappedFile(NULL),
+    _mappedFileLength(0) {
     rootNode = new VoxelNode();
+    pthread_rwlock_init(&_treeLock, NULL);
+    pthread_mutex_init(&_queuedEditsLock, NULL);
 }
 
 VoxelTree::~VoxelTree() {
@@ -57,6 +73,16 @@ VoxelTree::~VoxelTree() {
     for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
         delete rootNode->getChildAtIndex(i);
     }
+    
+    // throw away any edits that never got applied
+    for (int i = 0; i < _queuedEditPackets.size(); i++) {
+        delete[] _queuedEditPackets[i];
+    }
+    
+    unmapSVOFile();
+    
+    pthread_mutex_destroy(&_queuedEditsLock);
+    pthread_rwlock_destroy(&_treeLock);
 }
 
 
@@ -316,6 +342,47 @@ int VoxelTree::readNodeData(VoxelNode* destinationNode, unsigned char* nodeData,
             }
         }
     }
+
+    // a change anywhere below us is a change to our subtree, the same as edits mark it (see handleSubtreeChanged())
+    for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+        VoxelNode* childNode = destinationNode->getChildAtIndex(i);
+        if (childNode && childNode->hasChangedSince(destinationNode->getLastChanged())) {
+            destinationNode->markWithChangedTime();
+            break;
+        }
+    }
+    return bytesRead;
+}
+
+// walks the same bytes readNodeData() would read, without creating any voxels, returns -1 if they run out first
+int VoxelTree::skipNodeData(unsigned char* nodeData, int bytesLeftToRead, bool includeColor, bool includeExistsBits) {
+    if (bytesLeftToRead < (int) sizeof(unsigned char)) {
+        return -1;
+    }
+    unsigned char colorInPacketMask = *nodeData;
+    int bytesRead = sizeof(colorInPacketMask);
+    if (includeColor) {
+        bytesRead += numberOfOnes(colorInPacketMask) * SIZE_OF_COLOR_DATA;
+    }
+    
+    // the child mask comes after the exists mask, if there is one
+    int maskBytes = includeExistsBits ? 2 * sizeof(unsigned char) : sizeof(unsigned char);
+    if (bytesLeftToRead - bytesRead < maskBytes) {
+        return -1;
+    }
+    unsigned char childMask = *(nodeData + bytesRead + maskBytes - sizeof(unsigned char));
+    bytesRead += maskBytes;
+    
+    for (int childIndex = 0; childIndex < NUMBER_OF_CHILDREN; childIndex++) {
+        if (oneAtBit(childMask, childIndex)) {
+            int childBytesRead = skipNodeData(nodeData + bytesRead, bytesLeftToRead - bytesRead,
+                                              includeColor, includeExistsBits);
+            if (childBytesRead < 0) {
+                return -1;
+            }
+            bytesRead += childBytesRead;
+        }
+    }
     return bytesRead;
 }
 
@@ -353,9 +420,15 @@ void VoxelTree::readBitstreamToTree(unsigned char * bitstream, unsigned long int
         int octalCodeBytes = bytesRequiredForCodeLength(*bitstreamAt);
         int theseBytesRead = 0;
         theseBytesRead += octalCodeBytes;
+        uint64_t readStart = usecTimestampNow();
         theseBytesRead += readNodeData(bitstreamRootNode, bitstreamAt + octalCodeBytes,
                                        bufferSizeBytes - (bytesRead + octalCodeBytes), includeColor, includeExistsBits);
 
+        // readNodeData() marks the changes within the subtree, the nodes above it changed too
+        if (bitstreamRootNode->getLastChanged() >= readStart) {
+            markPathChanged(destinationNode, bitstreamRootNode);
+        }
+
         // skip bitstream to new startPoint
         bitstreamAt += theseBytesRead;
         bytesRead +=  theseBytesRead;
@@ -504,6 +577,9 @@ void VoxelTree::eraseAllVoxels() {
     delete rootNode; // this will recurse and delete all children
     rootNode = new VoxelNode();
     _isDirty = true;
+    
+    // anything we hadn't loaded yet is gone too
+    unmapSVOFile();
 }
 
 class ReadCodeColorBufferToTreeArgs {
@@ -594,6 +670,95 @@ void VoxelTree::readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraD
     }
 }
 
+void VoxelTree::queueEditPacket(unsigned char* packetData, int packetLength) {
+    // keep our own copy, the caller is free to reuse its receive buffer
+    unsigned char* queuedPacket = new unsigned char[packetLength];
+    memcpy(queuedPacket, packetData, packetLength);
+    
+    pthread_mutex_lock(&_queuedEditsLock);
+    _queuedEditPackets.push_back(queuedPacket);
+    _queuedEditPacketLengths.push_back(packetLength);
+    pthread_mutex_unlock(&_queuedEditsLock);
+}
+
+bool VoxelTree::hasQueuedEdits() {
+    pthread_mutex_lock(&_queuedEditsLock);
+    bool hasEdits = !_queuedEditPackets.empty();
+    pthread_mutex_unlock(&_queuedEditsLock);
+    return hasEdits;
+}
+
+int VoxelTree::processQueuedEdits(bool waitForLock) {
+    if (!hasQueuedEdits()) {
+        return 0;
+    }
+    
+    if (waitForLock) {
+        lockForWrite();
+    } else if (!tryLockForWrite()) {
+        return 0;
+    }
+    
+    // grab the current batch, new edits can keep being queued while we apply this one
+    std::vector<unsigned char*> editPackets;
+    std::vector<int> editPacketLengths;
+    
+    pthread_mutex_lock(&_queuedEditsLock);
+    editPackets.swap(_queuedEditPackets);
+    editPacketLengths.swap(_queuedEditPacketLengths);
+    pthread_mutex_unlock(&_queuedEditsLock);
+    
+    for (int i = 0; i < editPackets.size(); i++) {
+        processEditPacket(editPackets[i], editPacketLengths[i]);
+    }
+    
+    if (_editBatchHook && !editPackets.empty()) {
+        _editBatchHook(&editPackets[0], &editPacketLengths[0], editPackets.size(), _editBatchHookData);
+    }
+    unlock();
+    
+    for (int i = 0; i < editPackets.size(); i++) {
+        delete[] editPackets[i];
+    }
+    return editPackets.size();
+}
+
+void VoxelTree::processEditPacket(unsigned char* packetData, int packetLength) {
+    switch (packetData[0]) {
+        case PACKET_TYPE_SET_VOXEL:
+            processSetVoxelsBitstream(packetData, packetLength, false);
+            break;
+        case PACKET_TYPE_SET_VOXEL_DESTRUCTIVE:
+            processSetVoxelsBitstream(packetData, packetLength, true);
+            break;
+        case PACKET_TYPE_ERASE_VOXEL:
+            processRemoveVoxelBitstream(packetData, packetLength);
+            break;
+        default:
+            printLog("VoxelTree::processEditPacket() ignoring packet with header %c\n", packetData[0]);
+            break;
+    }
+}
+
+void VoxelTree::processSetVoxelsBitstream(unsigned char* bitstream, int bufferSizeBytes, bool destructive) {
+    // skip the packet header and the item number, the rest is code color buffers
+    int atByte = sizeof(short int) + numBytesForPacketHeader(bitstream);
+    unsigned char* voxelData = (unsigned char*)&bitstream[atByte];
+    while (atByte < bufferSizeBytes) {
+        int codeLength = numberOfThreeBitSectionsInCode(voxelData);
+        int voxelDataSize = bytesRequiredForCodeLength(codeLength) + SIZE_OF_COLOR_DATA;
+        
+        // any part of a mapped file this touches has to be loaded first, or loading it later would undo the edit
+        if (hasUnmaterializedSubtrees()) {
+            materializeSubtreesTouching(voxelData);
+        }
+        readCodeColorBufferToTree(voxelData, destructive);
+        
+        voxelData += voxelDataSize;
+        atByte += voxelDataSize;
+    }
+}
+
 void VoxelTree::processRemoveVoxelBitstream(unsigned char * bitstream, int bufferSizeBytes) {
     //unsigned short int itemNumber = (*((unsigned short int*)&bitstream[sizeof(PACKET_HEADER)]));
     int atByte = sizeof(short int) + numBytesForPacketHeader(bitstream);
@@ -602,6 +767,9 @@ void VoxelTree::processRemoveVoxelBitstream(unsigned char * bitstream, int buffe
         int codeLength = numberOfThreeBitSectionsInCode(voxelCode);
         int voxelDataSize = bytesRequiredForCodeLength(codeLength) + SIZE_OF_COLOR_DATA;
 
+        if (hasUnmaterializedSubtrees()) {
+            materializeSubtreesTouching(voxelCode);
+        }
         deleteVoxelCodeFromTree(voxelCode, ACTUALLY_DELETE, COLLAPSE_EMPTY_TREE);
 
         voxelCode+=voxelDataSize;
@@ -676,6 +844,24 @@ void VoxelTree::reaverageVoxelColors(VoxelNode *startNode) {
     }
 }
 
+// like reaverageVoxelColors() but only visits the parts of the tree that changed since the given time
+void VoxelTree::reaverageVoxelColorsChangedSince(VoxelNode* startNode, uint64_t time) {
+    if (_shouldReaverage && startNode->hasChangedSince(time)) {
+        bool hasChildren = false;
+
+        for (int i = 0; i < NUMBER_OF_CHILDREN; i++) {
+            if (startNode->getChildAtIndex(i)) {
+                reaverageVoxelColorsChangedSince(startNode->getChildAtIndex(i), time);
+                hasChildren = true;
+            }
+        }
+
+        if (hasChildren && !startNode->collapseIdenticalLeaves()) {
+            startNode->setColorFromAverageOfChildren();
+        }
+    }
+}
+
 void VoxelTree::loadVoxelsFile(const char* fileName, bool wantColorRandomizer) {
     int vCount = 0;
 
@@ -1096,17 +1282,88 @@ int VoxelTree::searchForColoredNodesRecursion(int maxSearchLevel, int& currentSe
     return maxChildLevel;
 }
 
+// a little extra room on the distances used by canUseEncodeCache(), for float error in distanceToCamera()
+const float ENCODE_CACHE_DISTANCE_SLOP = 0.001f;
+
+// The bytes for a subtree only depend on its contents when the whole subtree is inside the view frustum, there's no
+// occlusion culling or delta sending, and every voxel in it is on the same side of the LOD boundary for its level
+// wherever it is in the subtree. lodLevel is set to the deepest level sent, which is all the cache needs to know
+// about the viewer.
+bool VoxelTree::canUseEncodeCache(VoxelNode* node, const EncodeBitstreamParams& params, int& lodLevel) const {
+    if (params.wantOcclusionCulling || params.deltaViewFrustum || params.chopLevels
+        || params.maxEncodeLevel != INT_MAX) {
+        return false;
+    }
+    if (!params.viewFrustum) {
+        lodLevel = INT_MAX;
+        return true;
+    }
+    if (node->inFrustum(*params.viewFrustum) != ViewFrustum::INSIDE) {
+        return false;
+    }
+
+    // every voxel center in the subtree is within half the subtree's diagonal of its center
+    float distance = node->distanceToCamera(*params.viewFrustum);
+    float halfDiagonal = node->getAABox().getSize().x * TREE_SCALE * sqrtf(3.0f) / 2.0f;
+    float slop = distance * ENCODE_CACHE_DISTANCE_SLOP;
+    float nearest = distance - halfDiagonal - slop;
+    float farthest = distance + halfDiagonal + slop;
+
+    lodLevel = node->getLevel();
+    if (farthest >= boundaryDistanceForRenderLevel(lodLevel + params.boundaryLevelAdjust)) {
+        return false;
+    }
+    while (farthest < boundaryDistanceForRenderLevel(lodLevel + 1 + params.boundaryLevelAdjust)) {
+        lodLevel++;
+    }
+    return nearest > boundaryDistanceForRenderLevel(lodLevel + 1 + params.boundaryLevelAdjust);
+}
+
 int VoxelTree::encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag,
                                    EncodeBitstreamParams& params) const {
 
-    // How many bytes have we written so far at this level;
-    int bytesWritten = 0;
-
     // If we're at a node that is out of view, then we can return, because no nodes below us will be in view!
     if (params.viewFrustum && !node->isInView(*params.viewFrustum)) {
+        return 0;
+    }
+
+    VoxelEncodeCacheKey cacheKey;
+    if (!params.encodeCache || !canUseEncodeCache(node, params, cacheKey.lodLevel)) {
+        return encodeTreeBitstreamUncached(node, outputBuffer, availableBytes, bag, params);
+    }
+    cacheKey.node = node;
+    cacheKey.availableBytes = availableBytes;
+    cacheKey.includeColor = params.includeColor;
+    cacheKey.includeExistsBits = params.includeExistsBits;
+
+    int bytesWritten = 0;
+    int levelsReached = 0;
+    if (params.encodeCache->fetch(cacheKey, outputBuffer, bytesWritten, levelsReached, bag)) {
+        params.maxLevelReached = std::max(levelsReached, params.maxLevelReached);
         return bytesWritten;
     }
 
+    // encode it ourselves, keeping track of what this subtree alone reached and left in the bag
+    uint64_t encodedAt = usecTimestampNow();
+    std::vector<VoxelNode*> nodesBagged;
+    int maxLevelReached = params.maxLevelReached;
+    params.maxLevelReached = 0;
+    params.nodesBagged = &nodesBagged;
+
+    bytesWritten = encodeTreeBitstreamUncached(node, outputBuffer, availableBytes, bag, params);
+
+    params.nodesBagged = NULL;
+    params.encodeCache->store(cacheKey, encodedAt, outputBuffer, bytesWritten, params.maxLevelReached, nodesBagged);
+    params.maxLevelReached = std::max(maxLevelReached, params.maxLevelReached);
+    return bytesWritten;
+}
+
+int VoxelTree::encodeTreeBitstreamUncached(VoxelNode* node, unsigned char* outputBuffer, int availableBytes,
+                                           VoxelNodeBag& bag, EncodeBitstreamParams& params) const {
+
+    // How many bytes have we written so far at this level;
+    int bytesWritten = 0;
+
     // write the octal code
     int codeLength;
     if (params.chopLevels) {
@@ -1421,6 +1678,9 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
         availableBytes -= bytesAtThisLevel;
     } else {
         bag.insert(node);
+        if (params.nodesBagged) {
+            params.nodesBagged->push_back(node);
+        }
         return 0;
     }
 
@@ -1532,6 +1792,10 @@ int VoxelTree::encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outp
 }
 
 bool VoxelTree::readFromSVOFile(const char* fileName) {
+    if (VoxelChunkFile::isChunkFile(fileName)) {
+        return readFromChunkedFile(fileName);
+    }
+
     std::ifstream file(fileName, std::ios::in|std::ios::binary|std::ios::ate);
     if(file.is_open()) {
         printLog("loading file %s...\n", fileName);
@@ -1552,6 +1816,183 @@ bool VoxelTree::readFromSVOFile(const char* fileName) {
     return false;
 }
 
+bool VoxelTree::mapSVOFile(const char* fileName) {
+    unmapSVOFile();
+
+    // chunked files are compressed, so there's nothing to map, read them in and reaverage like a mapped file would
+    if (VoxelChunkFile::isChunkFile(fileName)) {
+        if (!readFromChunkedFile(fileName)) {
+            return false;
+        }
+        reaverageVoxelColors(rootNode);
+        return true;
+    }
+    
+#ifdef _WIN32
+    // no mmap() here, so just read it all in, but the voxels are still created lazily
+    std::ifstream file(fileName, std::ios::in|std::ios::binary|std::ios::ate);
+    if (!file.is_open()) {
+        return false;
+    }
+    _mappedFileLength = file.tellg();
+    file.seekg(0, std::ios::beg);
+    _mappedFile = new unsigned char[_mappedFileLength];
+    file.read((char*)_mappedFile, _mappedFileLength);
+    file.close();
+#else
+    int fileDescriptor = open(fileName, O_RDONLY);
+    if (fileDescriptor < 0) {
+        return false;
+    }
+    struct stat fileStats;
+    if (fstat(fileDescriptor, &fileStats) == 0 && fileStats.st_size > 0) {
+        void* mapping = mmap(NULL, fileStats.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+        if (mapping != MAP_FAILED) {
+            _mappedFile = (unsigned char*) mapping;
+            _mappedFileLength = fileStats.st_size;
+        }
+    }
+    close(fileDescriptor);
+    if (!_mappedFile) {
+        return (fileStats.st_size == 0); // an empty file is fine, it's just an empty tree
+    }
+#endif
+    
+    printLog("mapped file %s...\n", fileName);
+    
+    // the file is a run of subtrees just like readBitstreamToTree() handles, each starting with its octal code
+    unsigned char* bitstreamAt = _mappedFile;
+    unsigned char* bitstreamEnd = _mappedFile + _mappedFileLength;
+    while (bitstreamAt < bitstreamEnd) {
+        int octalCodeBytes = bytesRequiredForCodeLength(*bitstreamAt);
+        int subtreeDataBytes = octalCodeBytes < bitstreamEnd - bitstreamAt
+            ? skipNodeData(bitstreamAt + octalCodeBytes, bitstreamEnd - (bitstreamAt + octalCodeBytes),
+                           WANT_COLOR, NO_EXISTS_BITS)
+            : -1;
+        
+        // a file cut short (say by a crash while it was written) keeps the subtrees before the cut
+        if (subtreeDataBytes < 0) {
+            printLog("%s is cut short, ignoring the last %d bytes\n", fileName, (int) (bitstreamEnd - bitstreamAt));
+            break;
+        }
+        
+        UnmaterializedSubtree subtree;
+        subtree.bitstream = bitstreamAt;
+        subtree.length = octalCodeBytes + subtreeDataBytes;
+        subtree.materialized = false;
+        
+        glm::vec3 corner;
+        copyFirstVertexForCode(bitstreamAt, (float*)&corner);
+        float voxelScale = 1 / powf(2, *bitstreamAt);
+        subtree.box.setBox(corner, glm::vec3(voxelScale, voxelScale, voxelScale));
+        
+        _unmaterializedSubtrees.push_back(subtree);
+        bitstreamAt += subtree.length;
+    }
+    
+    atomicStoreRelease(&_numUnmaterializedSubtrees, (int) _unmaterializedSubtrees.size());
+    printLog("DONE indexing %d subtrees in %s\n", _unmaterializedSubtrees.size(), fileName);
+    return true;
+}
+
+void VoxelTree::unmapSVOFile() {
+    _unmaterializedSubtrees.clear();
+    atomicStoreRelease(&_numUnmaterializedSubtrees, 0);
+    if (_mappedFile) {
+#ifdef _WIN32
+        delete[] _mappedFile;
+#else
+        munmap(_mappedFile, _mappedFileLength);
+#endif
+        _mappedFile = NULL;
+        _mappedFileLength = 0;
+    }
+}
+
+// marks startNode, endNode (which must be below startNode) and every node between them as changed
+void VoxelTree::markPathChanged(VoxelNode* startNode, VoxelNode* endNode) {
+    unsigned char* endCode = endNode->getOctalCode();
+    VoxelNode* pathNode = startNode;
+    while (pathNode && pathNode != endNode) {
+        pathNode->markWithChangedTime();
+        pathNode = pathNode->getChildAtIndex(branchIndexWithDescendant(pathNode->getOctalCode(), endCode));
+    }
+    endNode->markWithChangedTime();
+}
+
+void VoxelTree::materializeSubtree(int subtreeIndex) {
+    UnmaterializedSubtree& subtree = _unmaterializedSubtrees[subtreeIndex];
+    unsigned char* octalCode = subtree.bitstream;
+    
+    VoxelNode* subtreeRootNode = nodeForOctalCode(rootNode, octalCode, NULL);
+    if (*octalCode != *subtreeRootNode->getOctalCode()) {
+        subtreeRootNode = createMissingNode(rootNode, octalCode);
+    }
+    int octalCodeBytes = bytesRequiredForCodeLength(*octalCode);
+    readNodeData(subtreeRootNode, octalCode + octalCodeBytes, subtree.length - octalCodeBytes, WANT_COLOR, NO_EXISTS_BITS);
+    
+    // mark the path down to the subtree, so its new voxels get averaged into their ancestors
+    markPathChanged(rootNode, subtreeRootNode);
+    
+    subtree.materialized = true;
+}
+
+// reaverages what the materializeSubtree() calls since materializeStart changed, and drops them from the index
+int VoxelTree::finishMaterializingSubtrees(uint64_t materializeStart) {
+    int subtreesMaterialized = 0;
+    int subtreesLeft = 0;
+    for (int i = 0; i < _unmaterializedSubtrees.size(); i++) {
+        if (_unmaterializedSubtrees[i].materialized) {
+            subtreesMaterialized++;
+        } else {
+            _unmaterializedSubtrees[subtreesLeft++] = _unmaterializedSubtrees[i];
+        }
+    }
+    
+    if (subtreesMaterialized > 0) {
+        _unmaterializedSubtrees.resize(subtreesLeft);
+        atomicStoreRelease(&_numUnmaterializedSubtrees, subtreesLeft);
+        reaverageVoxelColorsChangedSince(rootNode, materializeStart);
+        
+        if (_unmaterializedSubtrees.empty()) {
+            printLog("DONE materializing mapped voxels\n");
+            unmapSVOFile();
+        }
+    }
+    return subtreesMaterialized;
+}
+
+int VoxelTree::materializeSubtreesInView(const ViewFrustum& viewFrustum) {
+    uint64_t materializeStart = usecTimestampNow() - 1;
+    for (int i = 0; i < _unmaterializedSubtrees.size(); i++) {
+        AABox box = _unmaterializedSubtrees[i].box; // use temporary box so we can scale it
+        box.scale(TREE_SCALE);
+        if (viewFrustum.boxInFrustum(box) != ViewFrustum::OUTSIDE) {
+            materializeSubtree(i);
+        }
+    }
+    return finishMaterializingSubtrees(materializeStart);
+}
+
+int VoxelTree::materializeSubtreesTouching(unsigned char* octalCode) {
+    uint64_t materializeStart = usecTimestampNow() - 1;
+    for (int i = 0; i < _unmaterializedSubtrees.size(); i++) {
+        unsigned char* subtreeCode = _unmaterializedSubtrees[i].bitstream;
+        if (isAncestorOf(subtreeCode, octalCode) || isAncestorOf(octalCode, subtreeCode)) {
+            materializeSubtree(i);
+        }
+    }
+    return finishMaterializingSubtrees(materializeStart);
+}
+
+int VoxelTree::materializeSubtrees(int maxSubtrees) {
+    uint64_t materializeStart = usecTimestampNow() - 1;
+    for (int i = 0; i < _unmaterializedSubtrees.size() && i < maxSubtrees; i++) {
+        materializeSubtree(i);
+    }
+    return finishMaterializingSubtrees(materializeStart);
+}
+
 bool VoxelTree::readFromSquareARGB32Pixels(const uint32_t* pixels, int dimension) {
     SquarePixelMap pixelMap = SquarePixelMap(pixels, dimension);
     pixelMap.addVoxelsToVoxelTree(this);
@@ -1652,7 +2093,8 @@ void VoxelTree::writeToSVOFile(const char* fileName, VoxelNode* node) const {
             nodeBag.insert(rootNode);
         }
 
-        static unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
+        // not static, so that a snapshot can be written from another thread while the tree is in use
+        unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
         int bytesWritten = 0;
 
         while (!nodeBag.isEmpty()) {
@@ -1667,6 +2109,62 @@ void VoxelTree::writeToSVOFile(const char* fileName, VoxelNode* node) const {
     file.close();
 }
 
+bool VoxelTree::writeToChunkedFile(const char* fileName, VoxelNode* node, bool wantCompression) const {
+    printLog("saving to chunked file %s...\n", fileName);
+
+    VoxelChunkFile chunkFile;
+    VoxelNodeBag nodeBag;
+    // If we were given a specific node, start from there, otherwise start from root
+    if (node) {
+        nodeBag.insert(node);
+    } else {
+        nodeBag.insert(rootNode);
+    }
+
+    unsigned char outputBuffer[MAX_VOXEL_PACKET_SIZE - 1];
+    int bytesWritten = 0;
+
+    // same subtrees as writeToSVOFile(), the chunk file groups them by where they are in the tree
+    while (!nodeBag.isEmpty()) {
+        VoxelNode* subTree = nodeBag.extract();
+
+        EncodeBitstreamParams params(INT_MAX, IGNORE_VIEW_FRUSTUM, WANT_COLOR, NO_EXISTS_BITS);
+        bytesWritten = encodeTreeBitstream(subTree, &outputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1, nodeBag, params);
+
+        if (bytesWritten > 0) {
+            chunkFile.addSubtreeBitstream(&outputBuffer[0], bytesWritten);
+        }
+    }
+    return chunkFile.save(fileName, wantCompression);
+}
+
+bool VoxelTree::readFromChunkedFile(const char* fileName, unsigned char* subtreeOctalCode) {
+    VoxelChunkFile chunkFile;
+    if (!chunkFile.open(fileName)) {
+        return false;
+    }
+    printLog("loading chunked file %s...\n", fileName);
+
+    // Chunks above the subtree are read too, since a subtree written from higher up can reach down into it. Those
+    // are only the few chunks keyed above VOXEL_CHUNK_LEVEL, so they may bring in some voxels outside the subtree.
+    std::vector<unsigned char> bitstream;
+    int chunksRead = 0;
+    for (int i = 0; i < chunkFile.getChunkCount(); i++) {
+        if (subtreeOctalCode && !chunkFile.chunkTouchesSubtree(i, subtreeOctalCode)) {
+            continue;
+        }
+        int length = chunkFile.readChunk(i, bitstream);
+        if (length == 0) {
+            printLog("unable to read chunk %d of %s\n", i, fileName);
+            continue;
+        }
+        readBitstreamToTree(&bitstream[0], length, WANT_COLOR, NO_EXISTS_BITS);
+        chunksRead++;
+    }
+    printLog("DONE loading chunked file, read %d of %d chunks\n", chunksRead, chunkFile.getChunkCount());
+    return true;
+}
+
 unsigned long VoxelTree::getVoxelCount() {
     unsigned long nodeCount = 0;
     recurseTreeWithOperation(countVoxelsOperation, &nodeCount);
@@ -9,6 +9,15 @@
 #ifndef __hifi__VoxelTree__
 #define __hifi__VoxelTree__
 
+#include <vector>
+
+#ifdef _WIN32
+#include "pthread.h"
+#else
+#include <pthread.h>
+#endif
+
+#include "AtomicUtil.h"
 #include "SimpleMovingAverage.h"
 #include "ViewFrustum.h"
 #include "VoxelNode.h"
@@ -20,6 +29,9 @@
 typedef bool (*RecurseVoxelTreeOperation)(VoxelNode* node, void* extraData);
 typedef enum {GRADIENT, RANDOM, NATURAL} creationMode;
 
+// called by processQueuedEdits() after each batch of edit packets has been applied to the tree
+typedef void (*EditBatchHook)(unsigned char** editPackets, int* editPacketLengths, int numEdits, void* extraData);
+
 #define NO_EXISTS_BITS         false
 #define WANT_EXISTS_BITS       true
 #define NO_COLOR               false
@@ -35,6 +47,9 @@ typedef enum {GRADIENT, RANDOM, NATURAL} creationMode;
 #define DONT_CHOP              0
 #define NO_BOUNDARY_ADJUST     0
 #define LOW_RES_MOVING_ADJUST  1
+#define IGNORE_ENCODE_CACHE    NULL
+
+class VoxelEncodeCache;
 
 class EncodeBitstreamParams {
 public:
@@ -51,6 +66,8 @@ public:
     int                 boundaryLevelAdjust;
 
     CoverageMap*        map;
+    VoxelEncodeCache*   encodeCache;
+    std::vector<VoxelNode*>* nodesBagged; // used by encodeTreeBitstream() while filling the encode cache
     
     EncodeBitstreamParams(
         int                 maxEncodeLevel      = INT_MAX, 
@@ -62,7 +79,8 @@ public:
         const ViewFrustum*  lastViewFrustum     = IGNORE_VIEW_FRUSTUM,
         bool                wantOcclusionCulling= NO_OCCLUSION_CULLING,
         CoverageMap*        map                 = IGNORE_COVERAGE_MAP,
-        int                 boundaryLevelAdjust = NO_BOUNDARY_ADJUST) :
+        int                 boundaryLevelAdjust = NO_BOUNDARY_ADJUST,
+        VoxelEncodeCache*   encodeCache         = IGNORE_ENCODE_CACHE) :
             maxEncodeLevel          (maxEncodeLevel),
             maxLevelReached         (0),
             viewFrustum             (viewFrustum),
@@ -74,7 +92,9 @@ public:
             wantOcclusionCulling    (wantOcclusionCulling),
             childWasInViewDiscarded (0),
             boundaryLevelAdjust     (boundaryLevelAdjust),
-            map                     (map)
+            map                     (map),
+            encodeCache             (encodeCache),
+            nodesBagged             (NULL)
     {}
 };
 
@@ -98,6 +118,28 @@ public:
 
     void eraseAllVoxels();
 
+    // Concurrency: any number of readers (encodeTreeBitstream(), writeToSVOFile(), etc) can hold the tree at the
+    // same time, anything that changes the tree must hold it exclusively.
+    void lockForRead()  { pthread_rwlock_rdlock(&_treeLock); }
+    void lockForWrite() { pthread_rwlock_wrlock(&_treeLock); }
+    bool tryLockForWrite() { return (pthread_rwlock_trywrlock(&_treeLock) == 0); }
+    void unlock()       { pthread_rwlock_unlock(&_treeLock); }
+
+    // Edit packets (PACKET_TYPE_SET_VOXEL, PACKET_TYPE_SET_VOXEL_DESTRUCTIVE and PACKET_TYPE_ERASE_VOXEL) can be
+    // queued from any thread without waiting on the tree. The queued edits are then applied as a single batch
+    // under one write lock by processQueuedEdits(), so readers see either none or all of a batch.
+    void queueEditPacket(unsigned char* packetData, int packetLength);
+    // returns the number of edit packets applied, if waitForLock is false and a reader currently holds the tree
+    // the edits are left queued for the next call
+    int processQueuedEdits(bool waitForLock = true);
+    bool hasQueuedEdits();
+    
+    // the hook is called with the write lock still held, so whatever it records about a batch (like a journal)
+    // is in the same order the batches were applied to the tree
+    void setEditBatchHook(EditBatchHook hook, void* extraData) { _editBatchHook = hook; _editBatchHookData = extraData; }
+    void processEditPacket(unsigned char* packetData, int packetLength); // caller must hold the write lock
+
+    void processSetVoxelsBitstream(unsigned char* bitstream, int bufferSizeBytes, bool destructive);
     void processRemoveVoxelBitstream(unsigned char* bitstream, int bufferSizeBytes);
     void readBitstreamToTree(unsigned char* bitstream,  unsigned long int bufferSizeBytes, 
                              bool includeColor = WANT_COLOR, bool includeExistsBits = WANT_EXISTS_BITS, 
@@ -120,6 +162,8 @@ public:
     void recurseTreeWithOperationDistanceSorted(RecurseVoxelTreeOperation operation, 
                                                 const glm::vec3& point, void* extraData=NULL);
 
+    // if params.encodeCache is set, subtrees that will encode the same way for any viewer come from (and go into)
+    // the cache, see canUseEncodeCache()
     int encodeTreeBitstream(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag, 
                             EncodeBitstreamParams& params) const;
 
@@ -143,11 +187,28 @@ public:
     // these will read/write files that match the wireformat, excluding the 'V' leading
     void writeToSVOFile(const char* filename, VoxelNode* node = NULL) const;
     bool readFromSVOFile(const char* filename);
+
+    // these read/write the indexed, chunked format (see VoxelChunkFile.h), readFromSVOFile() also reads it. When
+    // reading, a subtree octal code limits the read to the chunks at, above, or below that subtree
+    bool writeToChunkedFile(const char* filename, VoxelNode* node = NULL, bool wantCompression = true) const;
+    bool readFromChunkedFile(const char* filename, unsigned char* subtreeOctalCode = NULL);
     // reads voxels from square image with alpha as a Y-axis
     bool readFromSquareARGB32Pixels(const uint32_t* pixels, int dimension);
     bool readFromSchematicFile(const char* filename);
     void computeBlockColor(int id, int data, int& r, int& g, int& b, int& create);
 
+    // Maps an SVO file and indexes the subtrees in it without creating any voxels. The subtrees are then created
+    // when they are first needed, by materializeSubtreesInView() or by edits that touch them (see
+    // processEditPacket()), and materializeSubtrees() builds whatever is left a few at a time. All of these
+    // change the tree, so the caller must hold the write lock. The count can be checked without it, but it can go
+    // down (or to zero, if all voxels are erased) as soon as it's been read unless the lock is held.
+    bool mapSVOFile(const char* filename);
+    bool hasUnmaterializedSubtrees() const { return getUnmaterializedSubtreeCount() > 0; }
+    int getUnmaterializedSubtreeCount() const { return atomicLoadAcquire(&_numUnmaterializedSubtrees); }
+    int materializeSubtreesInView(const ViewFrustum& viewFrustum);
+    int materializeSubtreesTouching(unsigned char* octalCode);
+    int materializeSubtrees(int maxSubtrees);
+
     unsigned long getVoxelCount();
 
     void copySubTreeIntoNewTree(VoxelNode* startNode, VoxelTree* destinationTree, bool rebaseToRoot);
@@ -168,8 +229,11 @@ private:
     void deleteVoxelCodeFromTreeRecursion(VoxelNode* node, void* extraData);
     void readCodeColorBufferToTreeRecursion(VoxelNode* node, void* extraData);
 
+    int encodeTreeBitstreamUncached(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag, 
+                                    EncodeBitstreamParams& params) const;
     int encodeTreeBitstreamRecursion(VoxelNode* node, unsigned char* outputBuffer, int availableBytes, VoxelNodeBag& bag, 
                                      EncodeBitstreamParams& params, int& currentEncodeLevel) const;
+    bool canUseEncodeCache(VoxelNode* node, const EncodeBitstreamParams& params, int& lodLevel) const;
 
     int searchForColoredNodesRecursion(int maxSearchLevel, int& currentSearchLevel, 
                                        VoxelNode* node, const ViewFrustum& viewFrustum, VoxelNodeBag& bag,
@@ -181,10 +245,39 @@ private:
     VoxelNode* createMissingNode(VoxelNode* lastParentNode, unsigned char* deepestCodeToCreate);
     int readNodeData(VoxelNode *destinationNode, unsigned char* nodeData, int bufferSizeBytes, 
                      bool includeColor = WANT_COLOR, bool includeExistsBits = WANT_EXISTS_BITS);
+    static int skipNodeData(unsigned char* nodeData, int bufferSizeBytes, 
+                            bool includeColor = WANT_COLOR, bool includeExistsBits = WANT_EXISTS_BITS);
+
+    void markPathChanged(VoxelNode* startNode, VoxelNode* endNode);
+    void materializeSubtree(int subtreeIndex);
+    int finishMaterializingSubtrees(uint64_t materializeStart);
+    void reaverageVoxelColorsChangedSince(VoxelNode* startNode, uint64_t time);
+    void unmapSVOFile();
     
     bool _isDirty;
     unsigned long int _nodesChangedFromBitstream;
     bool _shouldReaverage;
+
+    pthread_rwlock_t _treeLock;
+
+    pthread_mutex_t _queuedEditsLock;
+    std::vector<unsigned char*> _queuedEditPackets;
+    std::vector<int> _queuedEditPacketLengths;
+    
+    EditBatchHook _editBatchHook;
+    void* _editBatchHookData;
+
+    // a subtree of a mapped SVO file that hasn't been turned into voxels yet
+    struct UnmaterializedSubtree {
+        unsigned char* bitstream; // starts with the octal code of the subtree
+        int length;
+        AABox box;
+        bool materialized;
+    };
+    std::vector<UnmaterializedSubtree> _unmaterializedSubtrees;
+    int _numUnmaterializedSubtrees; // its size, stored each time it changes
+    unsigned char* _mappedFile;
+    unsigned long _mappedFileLength;
 };
 
 float boundaryDistanceForRenderLevel(unsigned int renderLevel);
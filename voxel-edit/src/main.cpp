@@ -91,6 +91,8 @@ int main(int argc, const char * argv[])
 
         unsigned long nodeCount = myTree.getVoxelCount();
         printf("Nodes after adding scenes: %ld nodes\n", nodeCount);
+        printf("Voxel memory usage %ld bytes, %f bytes per node\n", VoxelNode::getVoxelMemoryUsage(),
+               nodeCount ? (float)VoxelNode::getVoxelMemoryUsage() / nodeCount : 0.0f);
 
         myTree.writeToSVOFile("voxels.svo");
 
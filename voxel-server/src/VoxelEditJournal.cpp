@@ -0,0 +1,158 @@
+//
+//  VoxelEditJournal.cpp
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+
+#include <cstring>
+#include <NodeList.h>
+#include <PacketHeaders.h>
+#include <SceneUtils.h>
+#include "VoxelEditJournal.h"
+
+// each record in the journal is the length of the edit packet followed by the packet itself
+typedef int journalRecordLength;
+
+VoxelEditJournal::VoxelEditJournal(const char* fileName) :
+    _file(NULL),
+    _size(0),
+    _hasWriteFailed(false) {
+    _fileName = new char[strlen(fileName) + 1];
+    strcpy(_fileName, fileName);
+}
+
+VoxelEditJournal::~VoxelEditJournal() {
+    close();
+    delete[] _fileName;
+}
+
+int VoxelEditJournal::replay(VoxelTree* tree) {
+    FILE* journal = fopen(_fileName, "rb");
+    if (!journal) {
+        return 0;
+    }
+
+    printf("replaying voxel edit journal %s...\n", _fileName);
+
+    unsigned char packetData[MAX_PACKET_SIZE];
+    journalRecordLength packetLength;
+    int editsReplayed = 0;
+
+    while (fread(&packetLength, sizeof(packetLength), 1, journal) == 1) {
+        if (packetLength <= 0 || packetLength > MAX_PACKET_SIZE) {
+            printf("bad record in voxel edit journal, ignoring the rest of it\n");
+            break;
+        }
+
+        // a crash part way through an append can leave a partial record at the end, skip it
+        if (fread(packetData, packetLength, 1, journal) != 1) {
+            break;
+        }
+
+        if (packetData[0] == PACKET_TYPE_Z_COMMAND) {
+            int numBytesPacketHeader = numBytesForPacketHeader(packetData);
+            const char* command = (const char*) packetData + numBytesPacketHeader;
+            int commandLength = packetLength - numBytesPacketHeader;
+            if (strncmp(command, ERASE_ALL_COMMAND, commandLength) == 0) {
+                tree->eraseAllVoxels();
+            } else if (strncmp(command, ADD_SCENE_COMMAND, commandLength) == 0) {
+                addSphereScene(tree);
+            }
+        } else {
+            tree->processEditPacket(packetData, packetLength);
+        }
+        editsReplayed++;
+    }
+    fclose(journal);
+
+    printf("DONE replaying voxel edit journal, %d edits\n", editsReplayed);
+    return editsReplayed;
+}
+
+bool VoxelEditJournal::open() {
+    close();
+
+    _file = fopen(_fileName, "ab");
+    if (!_file) {
+        printf("Unable to open voxel edit journal %s\n", _fileName);
+        return false;
+    }
+
+    fseek(_file, 0, SEEK_END);
+    _size = ftell(_file);
+    return true;
+}
+
+void VoxelEditJournal::close() {
+    if (_file) {
+        fclose(_file);
+        _file = NULL;
+    }
+}
+
+void VoxelEditJournal::appendEdits(unsigned char** editPackets, int* editPacketLengths, int numEdits) {
+    if (!_file || _hasWriteFailed) {
+        return;
+    }
+
+    for (int i = 0; i < numEdits; i++) {
+        if (!appendRecord(editPackets[i], editPacketLengths[i])) {
+            return;
+        }
+    }
+
+    // one flush per batch, a crash should lose at most the batch being written
+    if (fflush(_file) != 0) {
+        writeFailed();
+    }
+}
+
+void VoxelEditJournal::appendCommand(const char* command) {
+    if (!_file || _hasWriteFailed) {
+        return;
+    }
+
+    unsigned char packetData[MAX_PACKET_SIZE];
+    int numBytesPacketHeader = populateTypeAndVersion(packetData, PACKET_TYPE_Z_COMMAND);
+    int commandLength = strlen(command) + 1; // the null termination too, like the Z command packets
+    memcpy(packetData + numBytesPacketHeader, command, commandLength);
+
+    if (appendRecord(packetData, numBytesPacketHeader + commandLength) && fflush(_file) != 0) {
+        writeFailed();
+    }
+}
+
+bool VoxelEditJournal::appendRecord(const unsigned char* packetData, int packetLength) {
+    journalRecordLength recordLength = packetLength;
+    if (fwrite(&recordLength, sizeof(recordLength), 1, _file) != 1 || fwrite(packetData, packetLength, 1, _file) != 1) {
+        writeFailed();
+        return false;
+    }
+    _size += sizeof(recordLength) + packetLength;
+    return true;
+}
+
+void VoxelEditJournal::writeFailed() {
+    if (!_hasWriteFailed) {
+        printf("Unable to write to voxel edit journal %s, edits wait for the next snapshot\n", _fileName);
+    }
+    _hasWriteFailed = true;
+}
+
+void VoxelEditJournal::truncate() {
+    _size = 0;
+    _hasWriteFailed = false;
+
+    if (_file) {
+        _file = freopen(_fileName, "wb", _file);
+        if (!_file) {
+            // every edit from here on is only safe once it's in a snapshot
+            writeFailed();
+        }
+    }
+}
+
+void VoxelEditJournal::appendEditBatch(unsigned char** editPackets, int* editPacketLengths, int numEdits, void* extraData) {
+    ((VoxelEditJournal*) extraData)->appendEdits(editPackets, editPacketLengths, numEdits);
+}
@@ -0,0 +1,53 @@
+//
+//  VoxelEditJournal.h
+//  hifi
+//
+//  Copyright (c) 2013 High Fidelity, Inc. All rights reserved.
+//
+//  Append-only log of the voxel edit packets (and the Z commands that change the tree) applied to the server tree
+//  since the last full snapshot (.svo) was written. On startup the snapshot is loaded and then the journal is replayed
+//  on top of it.
+//
+
+#ifndef __hifi__VoxelEditJournal__
+#define __hifi__VoxelEditJournal__
+
+#include <cstdio>
+#include <VoxelTree.h>
+
+class VoxelEditJournal {
+public:
+    VoxelEditJournal(const char* fileName);
+    ~VoxelEditJournal();
+
+    // applies every edit in the journal to the tree, returns the number of edit packets replayed
+    int replay(VoxelTree* tree);
+
+    bool open(); // opens the journal for appending, creating it if needed
+    void close();
+
+    void appendEdits(unsigned char** editPackets, int* editPacketLengths, int numEdits);
+    void appendCommand(const char* command); // one of the Z commands replay() knows, like ERASE_ALL_COMMAND
+    void truncate(); // call once the edits in the journal are all in a snapshot
+
+    // Once a write fails (a full disk, say) nothing more is appended, since it would follow a partial record. The
+    // journal is usable again after the next snapshot truncates it.
+    bool hasWriteFailed() const { return _hasWriteFailed; }
+
+    long getSize() const { return _size; }
+    const char* getFileName() const { return _fileName; }
+
+    // matches EditBatchHook, extraData is the VoxelEditJournal
+    static void appendEditBatch(unsigned char** editPackets, int* editPacketLengths, int numEdits, void* extraData);
+
+private:
+    bool appendRecord(const unsigned char* packetData, int packetLength);
+    void writeFailed();
+
+    char* _fileName;
+    FILE* _file;
+    long _size;
+    bool _hasWriteFailed;
+};
+
+#endif /* defined(__hifi__VoxelEditJournal__) */
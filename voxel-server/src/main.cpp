@@ -10,16 +10,24 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <string>
+#include <vector>
 #include <OctalCode.h>
 #include <NodeList.h>
 #include <NodeTypes.h>
 #include <EnvironmentData.h>
 #include <VoxelTree.h>
+#include <VoxelChunkFile.h>
+#include <VoxelEncodeCache.h>
 #include "VoxelNodeData.h"
+#include "VoxelEditJournal.h"
 #include <SharedUtil.h>
 #include <PacketHeaders.h>
 #include <SceneUtils.h>
 #include <PerfStat.h>
+#include <ThreadPool.h>
+#include <Reactor.h>
+#include <AtomicUtil.h>
 
 #ifdef _WIN32
 #include "Syssocket.h"
@@ -32,7 +40,18 @@
 
 const char* LOCAL_VOXELS_PERSIST_FILE = "resources/voxels.svo";
 const char* VOXELS_PERSIST_FILE = "/etc/highfidelity/voxel-server/resources/voxels.svo";
-const int VOXEL_PERSIST_INTERVAL = 1000 * 30; // every 30 seconds
+const char* LOCAL_VOXELS_JOURNAL_FILE = "resources/voxels.journal";
+const char* VOXELS_JOURNAL_FILE = "/etc/highfidelity/voxel-server/resources/voxels.journal";
+
+// edits are journaled as they are applied, a full snapshot of the tree is only written (and the journal
+// emptied) when the journal gets big, or the tree has changed and we haven't taken a snapshot in a while
+const int VOXEL_PERSIST_INTERVAL = 1000 * 30; // check every 30 seconds
+const int VOXEL_SNAPSHOT_INTERVAL = 1000 * 60 * 10; // every 10 minutes
+const long MAX_VOXEL_JOURNAL_BYTES = 4 * 1024 * 1024;
+
+// when the persist file is loaded lazily, this many of its subtrees are built per write lock in the background
+const int BACKGROUND_MATERIALIZE_SUBTREES = 64;
+const int BACKGROUND_MATERIALIZE_INTERVAL_USECS = 1000;
 
 const int VOXEL_LISTEN_PORT = 40106;
 
@@ -53,8 +72,21 @@ const int MAX_VOXEL_TREE_DEPTH_LEVELS = 4;
 const int ENVIRONMENT_SEND_INTERVAL_USECS = 1000000;
 
 VoxelTree serverTree(true); // this IS a reaveraging tree 
+
+// encodings of subtrees that look the same to every viewer who can see them, shared by all the send threads
+VoxelEncodeCache encodeCache;
+bool wantEncodeCache = true;
+
+// the per client encoding and sending is spread across this many threads, including the distributor thread
+int numVoxelSendThreads = ThreadPool::getNumberOfCores();
+std::vector<UDPSendBatch*> voxelSendBatches; // one for each of them, kept from one interval to the next
+
 bool wantVoxelPersist = true;
+bool wantLazyVoxelLoad = true;
+bool wantChunkedVoxelPersist = false; // snapshots in the indexed, chunked format, it's loaded whichever it's in
 bool wantLocalDomain = false;
+VoxelEditJournal* editJournal = NULL;
+int forceVoxelSnapshot = 0; // set by the receive thread, taken by the persist thread with atomicExchange()
 
 
 bool wantColorRandomizer = false;
@@ -110,16 +142,17 @@ void eraseVoxelTreeAndCleanupNodeVisitData() {
     }
 }
 
-pthread_mutex_t treeLock;
-
 // Version of voxel distributor that sends the deepest LOD level at once
+// Note: this is called concurrently for different nodes by the voxel send workers, so it must only touch the
+// state of the node it was handed and the worker's own sendBatch, and it may only read from the serverTree
 void deepestLevelVoxelDistributor(NodeList* nodeList, 
-                                  NodeList::iterator& node,
+                                  Node* node,
                                   VoxelNodeData* nodeData,
-                                  bool viewFrustumChanged) {
+                                  bool viewFrustumChanged,
+                                  UDPSendBatch* sendBatch) {
 
 
-    pthread_mutex_lock(&::treeLock);
+    serverTree.lockForRead();
 
     int maxLevelReached = 0;
     uint64_t start = usecTimestampNow();
@@ -144,8 +177,7 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
                 printf("wantColor=%s --- SENDING PARTIAL PACKET! nodeData->getCurrentPacketIsColor()=%s\n", 
                        debug::valueOf(wantColor), debug::valueOf(nodeData->getCurrentPacketIsColor()));
             }
-            nodeList->getNodeSocket()->send(node->getActiveSocket(),
-                                            nodeData->getPacket(), nodeData->getPacketLength());
+            sendBatch->queue(node->getActiveSocket(), nodeData->getPacket(), nodeData->getPacketLength());
             trueBytesSent += nodeData->getPacketLength();
             truePacketsSent++;
             nodeData->resetVoxelPacket();
@@ -236,7 +268,7 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
 
     // If we have something in our nodeBag, then turn them into packets and send them out...
     if (!nodeData->nodeBag.isEmpty()) {
-        static unsigned char tempOutputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // save on allocs by making this static
+        unsigned char tempOutputBuffer[MAX_VOXEL_PACKET_SIZE - 1]; // one per call, since workers run concurrently
         int bytesWritten = 0;
         int packetsSentThisInterval = 0;
         uint64_t start = usecTimestampNow();
@@ -265,9 +297,11 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
                 int boundaryLevelAdjust = viewFrustumChanged && nodeData->getWantLowResMoving() 
                                           ? LOW_RES_MOVING_ADJUST : NO_BOUNDARY_ADJUST;
                 
+                VoxelEncodeCache* cache = ::wantEncodeCache ? &::encodeCache : IGNORE_ENCODE_CACHE;
+                
                 EncodeBitstreamParams params(INT_MAX, &nodeData->getCurrentViewFrustum(), wantColor, 
                                              WANT_EXISTS_BITS, DONT_CHOP, wantDelta, lastViewFrustum,
-                                             wantOcclusionCulling, coverageMap, boundaryLevelAdjust);
+                                             wantOcclusionCulling, coverageMap, boundaryLevelAdjust, cache);
 
                 bytesWritten = serverTree.encodeTreeBitstream(subTree, &tempOutputBuffer[0], MAX_VOXEL_PACKET_SIZE - 1,
                                                               nodeData->nodeBag, params);
@@ -279,8 +313,7 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
                 if (nodeData->getAvailable() >= bytesWritten) {
                     nodeData->writeToPacket(&tempOutputBuffer[0], bytesWritten);
                 } else {
-                    nodeList->getNodeSocket()->send(node->getActiveSocket(),
-                                                    nodeData->getPacket(), nodeData->getPacketLength());
+                    sendBatch->queue(node->getActiveSocket(), nodeData->getPacket(), nodeData->getPacketLength());
                     trueBytesSent += nodeData->getPacketLength();
                     truePacketsSent++;
                     packetsSentThisInterval++;
@@ -289,8 +322,7 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
                 }
             } else {
                 if (nodeData->isPacketWaiting()) {
-                    nodeList->getNodeSocket()->send(node->getActiveSocket(),
-                                                    nodeData->getPacket(), nodeData->getPacketLength());
+                    sendBatch->queue(node->getActiveSocket(), nodeData->getPacket(), nodeData->getPacketLength());
                     trueBytesSent += nodeData->getPacketLength();
                     truePacketsSent++;
                     nodeData->resetVoxelPacket();
@@ -307,7 +339,7 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
                 envPacketLength += environmentData[i].getBroadcastData(tempOutputBuffer + envPacketLength);
             }
             
-            nodeList->getNodeSocket()->send(node->getActiveSocket(), tempOutputBuffer, envPacketLength);
+            sendBatch->queue(node->getActiveSocket(), tempOutputBuffer, envPacketLength);
             trueBytesSent += envPacketLength;
             truePacketsSent++;
         }
@@ -327,6 +359,10 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
             printf("packetLoop() took %d milliseconds to generate %d bytes in %d packets, %d nodes still to send\n",
                     elapsedmsec, trueBytesSent, truePacketsSent, nodeData->nodeBag.count());
         }
+        if (::debugVoxelSending && ::wantEncodeCache) {
+            printf("encodeCache hits=%ld misses=%ld bytes=%ld\n",
+                   ::encodeCache.getHits(), ::encodeCache.getMisses(), ::encodeCache.getBytesUsed());
+        }
         
         // if after sending packets we've emptied our bag, then we want to remember that we've sent all 
         // the voxels from the current view frustum
@@ -341,27 +377,121 @@ void deepestLevelVoxelDistributor(NodeList* nodeList,
         
     } // end if bag wasn't empty, and so we sent stuff...
 
-    pthread_mutex_unlock(&::treeLock);
+    serverTree.unlock();
+    
+    // everything this viewer is sent this interval goes out together
+    sendBatch->flush();
 }
 
-uint64_t lastPersistVoxels = 0;
-void persistVoxelsWhenDirty() {
-    uint64_t now = usecTimestampNow();
-    int sinceLastTime = (now - ::lastPersistVoxels) / 1000;
-
-    // check the dirty bit and persist here...
-    if (::wantVoxelPersist && ::serverTree.isDirty() && sinceLastTime > VOXEL_PERSIST_INTERVAL) {
-        {
-            PerformanceWarning warn(::shouldShowAnimationDebug, 
-                                    "persistVoxelsWhenDirty() - writeToSVOFile()", ::shouldShowAnimationDebug);
+// writes a snapshot of the tree next to the persist file and then moves it into place, so a crash part way
+// through leaves the last snapshot and journal intact, returns false if the snapshot had to be put off
+bool writeVoxelSnapshot() {
+    const char* persistFile = ::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE;
+    std::string snapshotFile = std::string(persistFile) + ".tmp";
+    
+    // new edits wait for the snapshot, but the send workers only need to read the tree so they keep going
+    serverTree.lockForRead();
+    
+    // the part of the persist file that isn't loaded yet would be missing from the snapshot
+    if (serverTree.hasUnmaterializedSubtrees()) {
+        serverTree.unlock();
+        return false;
+    }
+    
+    PerformanceWarning warn(::shouldShowAnimationDebug, "writeVoxelSnapshot() - writeToSVOFile()", ::shouldShowAnimationDebug);
+    printf("saving voxels to file...\n");
+    
+    bool snapshotWritten = true;
+    if (::wantChunkedVoxelPersist) {
+        snapshotWritten = serverTree.writeToChunkedFile(snapshotFile.c_str());
+    } else {
+        serverTree.writeToSVOFile(snapshotFile.c_str());
+    }
+    
+    if (!snapshotWritten) {
+        // the last snapshot and the journal still have everything, so leave them be and try again next time
+        printf("Unable to write voxel snapshot %s\n", snapshotFile.c_str());
+        remove(snapshotFile.c_str());
+        serverTree.unlock();
+        return true;
+    }
+#ifdef _WIN32
+    remove(persistFile);
+#endif
+    if (rename(snapshotFile.c_str(), persistFile) == 0) {
+        // everything in the journal is now in the snapshot
+        if (::editJournal) {
+            ::editJournal->truncate();
+        }
+        serverTree.clearDirtyBit(); // tree is clean after saving
+    } else {
+        printf("Unable to move voxel snapshot %s to %s\n", snapshotFile.c_str(), persistFile);
+    }
+    serverTree.unlock();
+    
+    printf("DONE saving voxels to file...\n");
+    return true;
+}
 
-            printf("saving voxels to file...\n");
-            serverTree.writeToSVOFile(::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE);
-            serverTree.clearDirtyBit(); // tree is clean after saving
-            printf("DONE saving voxels to file...\n");
+void* persistVoxelsInBackground(void* args) {
+    // anything done to the tree after loading it (-i, --AddRandomVoxels, etc) isn't in the journal
+    uint64_t lastSnapshot = serverTree.isDirty() ? 0 : usecTimestampNow();
+    
+    while (true) {
+        usleep(VOXEL_PERSIST_INTERVAL * 1000);
+        
+        uint64_t now = usecTimestampNow();
+        int sinceLastSnapshot = (now - lastSnapshot) / 1000;
+        
+        // the journal is only written to under the write lock
+        serverTree.lockForRead();
+        bool changedSinceSnapshot = serverTree.rootNode->hasChangedSince(lastSnapshot);
+        bool journalTooBig = ::editJournal && ::editJournal->getSize() > MAX_VOXEL_JOURNAL_BYTES;
+        bool journalFailed = ::editJournal && ::editJournal->hasWriteFailed() && changedSinceSnapshot;
+        serverTree.unlock();
+        
+        // taken before the snapshot, so a Z command that comes in while it's being written forces the next one
+        bool forced = atomicExchange(&::forceVoxelSnapshot, 0) != 0;
+        
+        if (forced || journalTooBig || journalFailed
+            || (changedSinceSnapshot && sinceLastSnapshot > VOXEL_SNAPSHOT_INTERVAL)) {
+            if (writeVoxelSnapshot()) {
+                lastSnapshot = now;
+            } else if (forced) {
+                atomicStoreRelease(&::forceVoxelSnapshot, 1);
+            }
         }
-        ::lastPersistVoxels = usecTimestampNow();
     }
+    
+    pthread_exit(0);
+}
+
+// builds whatever the viewers and edits haven't needed yet from a lazily loaded persist file, a little at a time
+void* materializeVoxelsInBackground(void* args) {
+    bool done = false;
+    while (!done) {
+        serverTree.lockForWrite();
+        serverTree.materializeSubtrees(BACKGROUND_MATERIALIZE_SUBTREES);
+        done = !serverTree.hasUnmaterializedSubtrees();
+        serverTree.unlock();
+        
+        usleep(BACKGROUND_MATERIALIZE_INTERVAL_USECS);
+    }
+    
+    pthread_exit(0);
+}
+
+// ThreadPoolJob that encodes and sends the voxels for a single node
+void distributeVoxelsToNode(void* jobData, int workerIndex) {
+    Node* node = (Node*) jobData;
+    VoxelNodeData* nodeData = (VoxelNodeData*) node->getLinkedData();
+
+    bool viewFrustumChanged = nodeData->updateCurrentViewFrustum();
+    if (::debugVoxelSending) {
+        printf("worker %d nodeData->updateCurrentViewFrustum() changed=%s\n", workerIndex, debug::valueOf(viewFrustumChanged));
+    }
+    deepestLevelVoxelDistributor(NodeList::getInstance(), node, nodeData, viewFrustumChanged,
+                                 ::voxelSendBatches[workerIndex]);
 }
 
 void *distributeVoxelsToListeners(void *args) {
@@ -369,23 +499,55 @@ void *distributeVoxelsToListeners(void *args) {
     NodeList* nodeList = NodeList::getInstance();
     timeval lastSendTime;
     
+    ThreadPool sendWorkers(::numVoxelSendThreads);
+    for (int i = 0; i < ::numVoxelSendThreads; i++) {
+        ::voxelSendBatches.push_back(new UDPSendBatch(nodeList->getNodeSocket()));
+    }
+    std::vector<void*> nodesToSend;
+    
     while (true) {
         gettimeofday(&lastSendTime, NULL);
         
-        // enumerate the nodes to send 3 packets to each
-        for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
-            VoxelNodeData* nodeData = (VoxelNodeData*) node->getLinkedData();
-
-            // Sometimes the node data has not yet been linked, in which case we can't really do anything
-            if (nodeData) {
-                bool viewFrustumChanged = nodeData->updateCurrentViewFrustum();
-                if (::debugVoxelSending) {
-                    printf("nodeData->updateCurrentViewFrustum() changed=%s\n", debug::valueOf(viewFrustumChanged));
-                }
-                deepestLevelVoxelDistributor(nodeList, node, nodeData, viewFrustumChanged);
+        // apply the edits that arrived since the last send as one batch, the workers below then all
+        // encode against the same version of the tree
+        if (serverTree.hasQueuedEdits()) {
+            PerformanceWarning warn(::shouldShowAnimationDebug, "processQueuedEdits()", ::shouldShowAnimationDebug);
+            // if a snapshot is being written these just wait for the next interval
+            int editsApplied = serverTree.processQueuedEdits(false);
+            if (::shouldShowAnimationDebug) {
+                printf("applied %d queued edit packets\n", editsApplied);
             }
         }
         
+        // the nodes gathered here can't be deleted until the workers are done with them
+        {
+            NodeListReadScope readScope(nodeList);
+            
+            // gather the nodes to send to, sometimes the node data has not yet been linked, in which case we can't
+            // really do anything for that node this time around
+            nodesToSend.clear();
+            for (NodeList::iterator node = nodeList->begin(); node != nodeList->end(); node++) {
+                if (node->getLinkedData()) {
+                    nodesToSend.push_back(&*node);
+                }
+            }
+            
+            // if the persist file is still being loaded, make sure the parts our viewers can see are there first,
+            // the count can be read without the lock but whatever is left once we have it is what gets loaded
+            if (serverTree.hasUnmaterializedSubtrees() && serverTree.tryLockForWrite()) {
+                for (int i = 0; i < nodesToSend.size(); i++) {
+                    VoxelNodeData* nodeData = (VoxelNodeData*) ((Node*) nodesToSend[i])->getLinkedData();
+                    serverTree.materializeSubtreesInView(nodeData->getCurrentViewFrustum());
+                }
+                serverTree.unlock();
+            }
+            
+            // each node is encoded and sent independently, so let the workers split them up
+            if (!nodesToSend.empty()) {
+                sendWorkers.runJobs(distributeVoxelsToNode, &nodesToSend[0], nodesToSend.size());
+            }
+        }
+            
         // dynamically sleep until we need to fire off the next set of voxels
         int usecToSleep =  VOXEL_SEND_INTERVAL_USECS - (usecTimestampNow() - usecTimestamp(&lastSendTime));
         
@@ -405,9 +567,159 @@ void attachVoxelNodeDataToNode(Node* newNode) {
     }
 }
 
-int main(int argc, const char * argv[]) {
+// Reactor handler for the node socket, handles everything that arrived together before the reactor
+// gets back to its timers
+void processVoxelServerPackets(void* extraData) {
+    UDPReceiveBatch* receiveBatch = (UDPReceiveBatch*) extraData;
+    NodeList* nodeList = NodeList::getInstance();
+    NodeListReadScope readScope(nodeList);
+    
+    int packetsReceived = receiveBatch->receive();
+    for (int packetIndex = 0; packetIndex < packetsReceived; packetIndex++) {
+        unsigned char* packetData = receiveBatch->getPacket(packetIndex);
+        ssize_t receivedBytes = receiveBatch->getByteLength(packetIndex);
+        sockaddr* nodePublicAddress = receiveBatch->getSenderAddress(packetIndex);
+        
+        if (!packetVersionMatch(packetData)) {
+            continue;
+        }
+        
+        int numBytesPacketHeader = numBytesForPacketHeader(packetData);
+        
+        if (packetData[0] == PACKET_TYPE_SET_VOXEL || packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE) {
+            bool destructive = (packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE);
+            PerformanceWarning warn(::shouldShowAnimationDebug,
+                                    destructive ? "PACKET_TYPE_SET_VOXEL_DESTRUCTIVE" : "PACKET_TYPE_SET_VOXEL",
+                                    ::shouldShowAnimationDebug);
+            
+            unsigned short int itemNumber = (*((unsigned short int*)(packetData + numBytesPacketHeader)));
+            if (::shouldShowAnimationDebug) {
+                printf("got %s - command from client receivedBytes=%ld itemNumber=%d\n",
+                    destructive ? "PACKET_TYPE_SET_VOXEL_DESTRUCTIVE" : "PACKET_TYPE_SET_VOXEL",
+                    receivedBytes,itemNumber);
+            }
+            int atByte = numBytesPacketHeader + sizeof(itemNumber);
+            unsigned char* voxelData = (unsigned char*)&packetData[atByte];
+            while (atByte < receivedBytes) {
+                unsigned char octets = (unsigned char)*voxelData;
+                const int COLOR_SIZE_IN_BYTES = 3;
+                int voxelDataSize = bytesRequiredForCodeLength(octets) + COLOR_SIZE_IN_BYTES;
+                int voxelCodeSize = bytesRequiredForCodeLength(octets);
+
+                // color randomization on insert
+                int colorRandomizer = ::wantColorRandomizer ? randIntInRange (-50, 50) : 0;
+                int red   = voxelData[voxelCodeSize + 0];
+                int green = voxelData[voxelCodeSize + 1];
+                int blue  = voxelData[voxelCodeSize + 2];
 
-    pthread_mutex_init(&::treeLock, NULL);
+                if (::shouldShowAnimationDebug) {
+                    printf("insert voxels - wantColorRandomizer=%s old r=%d,g=%d,b=%d \n",
+                        (::wantColorRandomizer?"yes":"no"),red,green,blue);
+                }
+            
+                red   = std::max(0, std::min(255, red   + colorRandomizer));
+                green = std::max(0, std::min(255, green + colorRandomizer));
+                blue  = std::max(0, std::min(255, blue  + colorRandomizer));
+
+                if (::shouldShowAnimationDebug) {
+                    printf("insert voxels - wantColorRandomizer=%s NEW r=%d,g=%d,b=%d \n",
+                        (::wantColorRandomizer?"yes":"no"),red,green,blue);
+                }
+                voxelData[voxelCodeSize + 0] = red;
+                voxelData[voxelCodeSize + 1] = green;
+                voxelData[voxelCodeSize + 2] = blue;
+
+                if (::shouldShowAnimationDebug) {
+                    float* vertices = firstVertexForCode(voxelData);
+                    printf("inserting voxel at: %f,%f,%f\n", vertices[0], vertices[1], vertices[2]);
+                    delete []vertices;
+                }
+            
+                // skip to next
+                voxelData += voxelDataSize;
+                atByte += voxelDataSize;
+            }
+            
+            // the tree picks this up with the rest of the batch on the next send interval,
+            // so we never wait on the send workers here
+            serverTree.queueEditPacket(packetData, receivedBytes);
+        } else if (packetData[0] == PACKET_TYPE_ERASE_VOXEL) {
+
+            // Send these bits off to the VoxelTree class to process them with the next batch of edits
+            serverTree.queueEditPacket(packetData, receivedBytes);
+        } else if (packetData[0] == PACKET_TYPE_Z_COMMAND) {
+
+            // the Z command is a special command that allows the sender to send the voxel server high level semantic
+            // requests, like erase all, or add sphere scene
+            
+            char* command = (char*) &packetData[numBytesPacketHeader]; // start of the command
+            int commandLength = strlen(command); // commands are null terminated strings
+            int totalLength = numBytesPacketHeader + commandLength + 1; // 1 for null termination
+            printf("got Z message len(%ld)= %s\n", receivedBytes, command);
+            bool rebroadcast = true; // by default rebroadcast
+
+            while (totalLength <= receivedBytes) {
+                if (strcmp(command, ERASE_ALL_COMMAND) == 0) {
+                    printf("got Z message == erase all\n");
+                    serverTree.processQueuedEdits(); // edits sent before the erase must not survive it
+                    serverTree.lockForWrite();
+                    eraseVoxelTreeAndCleanupNodeVisitData();
+                    
+                    // nothing before the erase matters any more, the journal only needs the erase itself
+                    if (::editJournal) {
+                        ::editJournal->truncate();
+                        ::editJournal->appendCommand(ERASE_ALL_COMMAND);
+                    }
+                    serverTree.unlock();
+                    atomicStoreRelease(&::forceVoxelSnapshot, 1);
+                    rebroadcast = false;
+                }
+                if (strcmp(command, ADD_SCENE_COMMAND) == 0) {
+                    printf("got Z message == add scene\n");
+                    serverTree.lockForWrite();
+                    addSphereScene(&serverTree);
+                    if (::editJournal) {
+                        ::editJournal->appendCommand(ADD_SCENE_COMMAND);
+                    }
+                    serverTree.unlock();
+                    atomicStoreRelease(&::forceVoxelSnapshot, 1);
+                    rebroadcast = false;
+                }
+                if (strcmp(command, TEST_COMMAND) == 0) {
+                    printf("got Z message == a message, nothing to do, just report\n");
+                }
+                totalLength += commandLength + 1; // 1 for null termination
+            }
+
+            if (rebroadcast) {
+                // Now send this to the connected nodes so they can also process these messages
+                printf("rebroadcasting Z message to connected nodes... nodeList.broadcastToNodes()\n");
+                nodeList->broadcastToNodes(packetData, receivedBytes, &NODE_TYPE_AGENT, 1);
+            }
+        } else if (packetData[0] == PACKET_TYPE_HEAD_DATA) {
+            // If we got a PACKET_TYPE_HEAD_DATA, then we're talking to an NODE_TYPE_AVATAR, and we
+            // need to make sure we have it in our nodeList.
+            
+            uint16_t nodeID = 0;
+            unpackNodeId(packetData + numBytesPacketHeader, &nodeID);
+            Node* node = nodeList->addOrUpdateNode(nodePublicAddress,
+                                                   nodePublicAddress,
+                                                   NODE_TYPE_AGENT,
+                                                   nodeID);
+            
+            nodeList->updateNodeWithData(node, packetData, receivedBytes);
+        } else if (packetData[0] == PACKET_TYPE_PING) {
+            // If the packet is a ping, let processNodeData handle it.
+            nodeList->processNodeData(nodePublicAddress, packetData, receivedBytes);
+        }
+    }
+}
+
+void checkInWithDomainServer(void* extraData) {
+    NodeList::getInstance()->sendDomainServerCheckIn();
+}
+
+int main(int argc, const char * argv[]) {
 
     NodeList* nodeList = NodeList::createInstance(NODE_TYPE_VOXEL_SERVER, VOXEL_LISTEN_PORT);
     setvbuf(stdout, NULL, _IOLBF, 0);
@@ -438,6 +750,13 @@ int main(int argc, const char * argv[]) {
     ::wantColorRandomizer = cmdOptionExists(argc, argv, WANT_COLOR_RANDOMIZER);
     printf("wantColorRandomizer=%s\n", debug::valueOf(::wantColorRandomizer));
 
+    const char* VOXEL_SEND_THREADS = "--sendThreads";
+    const char* voxelSendThreads = getCmdOption(argc, argv, VOXEL_SEND_THREADS);
+    if (voxelSendThreads) {
+        ::numVoxelSendThreads = std::max(1, atoi(voxelSendThreads));
+    }
+    printf("numVoxelSendThreads=%d\n", ::numVoxelSendThreads);
+
     const char* WANT_SEARCH_FOR_NODES = "--wantSearchForColoredNodes";
     ::wantSearchForColoredNodes = cmdOptionExists(argc, argv, WANT_SEARCH_FOR_NODES);
     printf("wantSearchForColoredNodes=%s\n", debug::valueOf(::wantSearchForColoredNodes));
@@ -449,12 +768,40 @@ int main(int argc, const char * argv[]) {
     }
     printf("wantVoxelPersist=%s\n", debug::valueOf(::wantVoxelPersist));
 
+    // By default the persist file is mapped and its voxels are created as they're needed, if you want them all
+    // loaded before we start serving, then pass in this parameter
+    const char* NO_LAZY_VOXEL_LOAD = "--NoLazyVoxelLoad";
+    if (cmdOptionExists(argc, argv, NO_LAZY_VOXEL_LOAD)) {
+        ::wantLazyVoxelLoad = false;
+    }
+    printf("wantLazyVoxelLoad=%s\n", debug::valueOf(::wantLazyVoxelLoad));
+
+    // By default the persist file is written as an SVO file, if you want it written in the indexed, chunked format
+    // (see VoxelChunkFile.h), then pass in this parameter. Either format is read back.
+    const char* CHUNKED_VOXEL_PERSIST = "--chunkedVoxelPersist";
+    ::wantChunkedVoxelPersist = cmdOptionExists(argc, argv, CHUNKED_VOXEL_PERSIST);
+    printf("wantChunkedVoxelPersist=%s\n", debug::valueOf(::wantChunkedVoxelPersist));
+
+    // Subtrees that every viewer sees the same way are encoded once and shared, if you want each viewer's
+    // subtrees encoded on their own, then pass in this parameter
+    const char* NO_ENCODE_CACHE = "--NoEncodeCache";
+    if (cmdOptionExists(argc, argv, NO_ENCODE_CACHE)) {
+        ::wantEncodeCache = false;
+    }
+    printf("wantEncodeCache=%s\n", debug::valueOf(::wantEncodeCache));
+
     // if we want Voxel Persistance, load the local file now...
     bool persistantFileRead = false;
     if (::wantVoxelPersist) {
         printf("loading voxels from file...\n");
-        persistantFileRead = ::serverTree.readFromSVOFile(::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE);
-        if (persistantFileRead) {
+        const char* persistFile = ::wantLocalDomain ? LOCAL_VOXELS_PERSIST_FILE : VOXELS_PERSIST_FILE;
+        if (::wantLazyVoxelLoad) {
+            // voxels from a mapped file are reaveraged as they're created, so there's no need to do it here
+            persistantFileRead = ::serverTree.mapSVOFile(persistFile);
+        } else {
+            persistantFileRead = ::serverTree.readFromSVOFile(persistFile);
+        }
+        if (persistantFileRead && !::wantLazyVoxelLoad) {
             PerformanceWarning warn(::shouldShowAnimationDebug,
                                     "persistVoxelsWhenDirty() - reaverageVoxelColors()", ::shouldShowAnimationDebug);
             
@@ -463,18 +810,50 @@ int main(int argc, const char * argv[]) {
             printf("Voxels reAveraged\n");
         }
         
+        // bring the snapshot up to date with the edits made since it was written
+        ::editJournal = new VoxelEditJournal(::wantLocalDomain ? LOCAL_VOXELS_JOURNAL_FILE : VOXELS_JOURNAL_FILE);
+        if (::editJournal->replay(&serverTree) > 0) {
+            ::forceVoxelSnapshot = 1;
+        }
+        if (::editJournal->open()) {
+            serverTree.setEditBatchHook(VoxelEditJournal::appendEditBatch, ::editJournal);
+        }
+        
         ::serverTree.clearDirtyBit(); // the tree is clean since we just loaded it
         printf("DONE loading voxels from file... fileRead=%s\n", debug::valueOf(persistantFileRead));
         unsigned long nodeCount = ::serverTree.getVoxelCount();
         printf("Nodes after loading scene %ld nodes\n", nodeCount);
+        printf("Voxel memory usage %ld bytes (%ld in octcodes, %ld in child arrays) %f bytes per node\n",
+               VoxelNode::getVoxelMemoryUsage(), VoxelNode::getOctcodeMemoryUsage(), VoxelNode::getChildrenMemoryUsage(),
+               nodeCount ? (float)VoxelNode::getVoxelMemoryUsage() / nodeCount : 0.0f);
     }
 
     // Check to see if the user passed in a command line option for loading an old style local
     // Voxel File. If so, load it now. This is not the same as a voxel persist file
     const char* INPUT_FILE = "-i";
     const char* voxelsFilename = getCmdOption(argc, argv, INPUT_FILE);
+    // If it's a chunked file, then only a region of it can be loaded by also passing in the corner and size of the
+    // region (0.0 to 1.0 of the tree, like an edit), in the form x,y,z,s. Only the chunks in or above the region
+    // are read, so a server can serve part of a world that's too big to load all of.
+    const char* INPUT_REGION = "--inputRegion";
+    const char* inputRegion = getCmdOption(argc, argv, INPUT_REGION);
     if (voxelsFilename) {
-        serverTree.readFromSVOFile(voxelsFilename);
+        float regionX, regionY, regionZ, regionSize;
+        if (inputRegion && sscanf(inputRegion, "%f,%f,%f,%f", &regionX, &regionY, &regionZ, &regionSize) != 4) {
+            printf("%s should be x,y,z,s, loading all of %s\n", INPUT_REGION, voxelsFilename);
+            inputRegion = NULL;
+        } else if (inputRegion && !VoxelChunkFile::isChunkFile(voxelsFilename)) {
+            printf("%s is not a chunked file, loading all of it\n", voxelsFilename);
+            inputRegion = NULL;
+        }
+        
+        if (inputRegion) {
+            unsigned char* regionOctalCode = pointToVoxel(regionX, regionY, regionZ, regionSize);
+            serverTree.readFromChunkedFile(voxelsFilename, regionOctalCode);
+            delete[] regionOctalCode;
+        } else {
+            serverTree.readFromSVOFile(voxelsFilename);
+        }
     }
 
     // Check to see if the user passed in a command line option for setting packet send rate
@@ -529,146 +908,29 @@ int main(int argc, const char * argv[]) {
     
     pthread_t sendVoxelThread;
     pthread_create(&sendVoxelThread, NULL, distributeVoxelsToListeners, NULL);
-
-    sockaddr nodePublicAddress;
     
-    unsigned char *packetData = new unsigned char[MAX_PACKET_SIZE];
-    ssize_t receivedBytes;
+    pthread_t persistVoxelThread;
+    if (::wantVoxelPersist) {
+        pthread_create(&persistVoxelThread, NULL, persistVoxelsInBackground, NULL);
+    }
     
-    timeval lastDomainServerCheckIn = {};
+    pthread_t materializeVoxelThread;
+    if (serverTree.hasUnmaterializedSubtrees()) {
+        pthread_create(&materializeVoxelThread, NULL, materializeVoxelsInBackground, NULL);
+    }
 
-    // loop to send to nodes requesting data
+    UDPReceiveBatch receiveBatch(nodeList->getNodeSocket());
     
-    while (true) {
-
-        // send a check in packet to the domain server if DOMAIN_SERVER_CHECK_IN_USECS has elapsed
-        if (usecTimestampNow() - usecTimestamp(&lastDomainServerCheckIn) >= DOMAIN_SERVER_CHECK_IN_USECS) {
-            gettimeofday(&lastDomainServerCheckIn, NULL);
-            NodeList::getInstance()->sendDomainServerCheckIn();
-        }
-        
-        // check to see if we need to persist our voxel state
-        persistVoxelsWhenDirty();
+    // The socket stays blocking, so the distributor's sends wait for room rather than failing. The reactor only
+    // hands it to us once there's something to read, so the receive itself doesn't block.
+    Reactor reactor;
+    reactor.watchForRead(nodeList->getNodeSocket()->getHandle(), processVoxelServerPackets, &receiveBatch);
+    reactor.addTimer(DOMAIN_SERVER_CHECK_IN_USECS, checkInWithDomainServer, NULL);
     
-        if (nodeList->getNodeSocket()->receive(&nodePublicAddress, packetData, &receivedBytes) &&
-            packetVersionMatch(packetData)) {
-            
-            int numBytesPacketHeader = numBytesForPacketHeader(packetData);
-            
-            if (packetData[0] == PACKET_TYPE_SET_VOXEL || packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE) {
-                bool destructive = (packetData[0] == PACKET_TYPE_SET_VOXEL_DESTRUCTIVE);
-                PerformanceWarning warn(::shouldShowAnimationDebug,
-                                        destructive ? "PACKET_TYPE_SET_VOXEL_DESTRUCTIVE" : "PACKET_TYPE_SET_VOXEL",
-                                        ::shouldShowAnimationDebug);
-                
-                unsigned short int itemNumber = (*((unsigned short int*)(packetData + numBytesPacketHeader)));
-                if (::shouldShowAnimationDebug) {
-                    printf("got %s - command from client receivedBytes=%ld itemNumber=%d\n",
-                        destructive ? "PACKET_TYPE_SET_VOXEL_DESTRUCTIVE" : "PACKET_TYPE_SET_VOXEL",
-                        receivedBytes,itemNumber);
-                }
-                int atByte = numBytesPacketHeader + sizeof(itemNumber);
-                unsigned char* voxelData = (unsigned char*)&packetData[atByte];
-                while (atByte < receivedBytes) {
-                    unsigned char octets = (unsigned char)*voxelData;
-                    const int COLOR_SIZE_IN_BYTES = 3;
-                    int voxelDataSize = bytesRequiredForCodeLength(octets) + COLOR_SIZE_IN_BYTES;
-                    int voxelCodeSize = bytesRequiredForCodeLength(octets);
-
-                    // color randomization on insert
-                    int colorRandomizer = ::wantColorRandomizer ? randIntInRange (-50, 50) : 0;
-                    int red   = voxelData[voxelCodeSize + 0];
-                    int green = voxelData[voxelCodeSize + 1];
-                    int blue  = voxelData[voxelCodeSize + 2];
-
-                    if (::shouldShowAnimationDebug) {
-                        printf("insert voxels - wantColorRandomizer=%s old r=%d,g=%d,b=%d \n",
-                            (::wantColorRandomizer?"yes":"no"),red,green,blue);
-                    }
-                
-                    red   = std::max(0, std::min(255, red   + colorRandomizer));
-                    green = std::max(0, std::min(255, green + colorRandomizer));
-                    blue  = std::max(0, std::min(255, blue  + colorRandomizer));
-
-                    if (::shouldShowAnimationDebug) {
-                        printf("insert voxels - wantColorRandomizer=%s NEW r=%d,g=%d,b=%d \n",
-                            (::wantColorRandomizer?"yes":"no"),red,green,blue);
-                    }
-                    voxelData[voxelCodeSize + 0] = red;
-                    voxelData[voxelCodeSize + 1] = green;
-                    voxelData[voxelCodeSize + 2] = blue;
-
-                    if (::shouldShowAnimationDebug) {
-                        float* vertices = firstVertexForCode(voxelData);
-                        printf("inserting voxel at: %f,%f,%f\n", vertices[0], vertices[1], vertices[2]);
-                        delete []vertices;
-                    }
-                
-                    serverTree.readCodeColorBufferToTree(voxelData, destructive);
-                    // skip to next
-                    voxelData += voxelDataSize;
-                    atByte += voxelDataSize;
-                }
-            } else if (packetData[0] == PACKET_TYPE_ERASE_VOXEL) {
-
-                // Send these bits off to the VoxelTree class to process them
-                pthread_mutex_lock(&::treeLock);
-                serverTree.processRemoveVoxelBitstream((unsigned char*)packetData, receivedBytes);
-                pthread_mutex_unlock(&::treeLock);
-            } else if (packetData[0] == PACKET_TYPE_Z_COMMAND) {
-
-                // the Z command is a special command that allows the sender to send the voxel server high level semantic
-                // requests, like erase all, or add sphere scene
-                
-                char* command = (char*) &packetData[numBytesPacketHeader]; // start of the command
-                int commandLength = strlen(command); // commands are null terminated strings
-                int totalLength = numBytesPacketHeader + commandLength + 1; // 1 for null termination
-                printf("got Z message len(%ld)= %s\n", receivedBytes, command);
-                bool rebroadcast = true; // by default rebroadcast
-
-                while (totalLength <= receivedBytes) {
-                    if (strcmp(command, ERASE_ALL_COMMAND) == 0) {
-                        printf("got Z message == erase all\n");
-                        eraseVoxelTreeAndCleanupNodeVisitData();
-                        rebroadcast = false;
-                    }
-                    if (strcmp(command, ADD_SCENE_COMMAND) == 0) {
-                        printf("got Z message == add scene\n");
-                        addSphereScene(&serverTree);
-                        rebroadcast = false;
-                    }
-                    if (strcmp(command, TEST_COMMAND) == 0) {
-                        printf("got Z message == a message, nothing to do, just report\n");
-                    }
-                    totalLength += commandLength + 1; // 1 for null termination
-                }
-
-                if (rebroadcast) {
-                    // Now send this to the connected nodes so they can also process these messages
-                    printf("rebroadcasting Z message to connected nodes... nodeList.broadcastToNodes()\n");
-                    nodeList->broadcastToNodes(packetData, receivedBytes, &NODE_TYPE_AGENT, 1);
-                }
-            } else if (packetData[0] == PACKET_TYPE_HEAD_DATA) {
-                // If we got a PACKET_TYPE_HEAD_DATA, then we're talking to an NODE_TYPE_AVATAR, and we
-                // need to make sure we have it in our nodeList.
-                
-                uint16_t nodeID = 0;
-                unpackNodeId(packetData + numBytesPacketHeader, &nodeID);
-                Node* node = nodeList->addOrUpdateNode(&nodePublicAddress,
-                                                       &nodePublicAddress,
-                                                       NODE_TYPE_AGENT,
-                                                       nodeID);
-                
-                nodeList->updateNodeWithData(node, packetData, receivedBytes);
-            } else if (packetData[0] == PACKET_TYPE_PING) {
-                // If the packet is a ping, let processNodeData handle it.
-                nodeList->processNodeData(&nodePublicAddress, packetData, receivedBytes);
-            }
-        }
-    }
+    checkInWithDomainServer(NULL);
+    reactor.run();
     
     pthread_join(sendVoxelThread, NULL);
-    pthread_mutex_destroy(&::treeLock);
 
     return 0;
 }